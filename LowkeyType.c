@@ -1,1058 +1,9202 @@
-/*
-* LowkeyType - A Typing Test Game
-*
-* This program implements a console-based typing test game with multiple modes:
-* Features include:
-* - User profiles with persistent statistics
-* - Endurance mode that adjusts difficulty based on user performance
-* - Raw Speed mode for timed typing tests (15-50 words)
-* - Enhanced accuracy calculation tracking character-level errors
-* - Leaderboard to compare performance with other users
-* - Profile view to check personal statistics
-* - Cross-platform compatibility for Windows and Unix
-* - Console width detection for better display
-* - ASCII art title screen
-* - Color-coded output for better user experience
-* - Input validation for user inputs
-* - Dynamic word list loading from files
-* - Backspace support for correcting mistakes during typing
-* - Clear screen functionality for better readability
-* - User-friendly menu navigation
-* - Detailed error reporting for typing tests
-* - Skill assessment based on typing speed and accuracy
-*
-* Author: Rotimi Dayo
-* Date: 16th of April 2025
-* Module: ACS130 Introduction to Systems Engineering and Software
-*
-*
-*/
-
-#include <stdio.h>           // Standard I/O functions
-#include <stdlib.h>          // Memory allocation, random numbers, etc.
-#include <string.h>          // String manipulation function
-#include <time.h>            // Time-related functions
-#include <ctype.h>           // Character type functions
-
-//Definition of constants
-#define MAX_USERS 100
-#define MAX_NAME_LEN 50
-#define USERS_FILE "users.txt"
-#define MAX_WORDS 1000
-#define MAX_WORD_LEN 20
-#define TEST_WORDS 20
-#define ENDURANCE_ACCURACY_THRESHOLD 85.0
-#define DYNAMIC_COMPLEXITY_THRESHOLD 95.0
-#define ENDURANCE_WPM_THRESHOLD 30.0 // Minimum WPM required to continue
-
-// Cross-platform solution for color and keyboard input
-#ifdef _WIN32
-    #include <conio.h>
-    #include <windows.h>
-    #define CLEAR_SCREEN "cls"
-    #define GREEN 10
-    #define RED 12
-    #define YELLOW 14
-    #define CYAN 11
-    #define DEFAULT 7
-#else
-    #include <unistd.h>
-    #include <termios.h>
-    #define CLEAR_SCREEN "clear"
-    #define GREEN 2
-    #define RED 1
-    #define YELLOW 3
-    #define CYAN 6
-    #define DEFAULT 7
-#endif
-
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <sys/ioctl.h>
-#include <unistd.h>
-#endif
-
-
-//Structure to hold user data
-typedef struct {
-    char name[MAX_NAME_LEN];
-    float bestWPM;
-    float bestAccuracy;
-    int testsCompleted;
-    int enduranceHighScore;
-    float averageAccuracy;
-    int totalCharsTyped;
-    int totalCorrectChars;
-} User;
-
-//Structure to hold typing result
-typedef struct {
-    int totalChars;
-    int correctChars;
-    int mistyped;
-    int missed;
-    int extra;
-    float accuracy;
-    float wpm;
-    float timeTaken;
-    char text[1000];
-} TypingResult;
-
-// Structure to hold application state
-typedef struct {
-    User users[MAX_USERS];
-    int userCount;
-    int currentUserIndex;
-    char wordList[MAX_WORDS][MAX_WORD_LEN];
-    int wordCount;
-    #ifdef _WIN32
-    HANDLE hConsole;
-    #endif
-} AppState;
-
-// Function Prototypes
-void print_ascii_art(const char *filename, AppState *state);
-void setColour(int colour, AppState *state);
-void loadUsersFromFile(AppState *state);
-void saveUsersToFile(AppState *state);
-int findUserIndex(char *username, AppState *state);
-void showMenu(void);
-void enduranceMode(AppState *state);
-void rawSpeedMode(AppState *state);
-void showLeaderboard(User users[], int userCount, int currentUserIndex);
-void showProfile(AppState *state);
-int loadWordsFromFile(char *filename, AppState *state);
-void processTypingResults(TypingResult results[], int count, AppState *state);
-void clearScreen(void);
-int typingTest(char *text, TypingResult *result, AppState *state);
-int getValidIntInput(int min, int max);
-void sortUsersByWPM(User users[], int userCount);
-int getch(void);
-void initializeAppState(AppState *state);
-int getDifficulty(User user);
-float calculateAccuracy(char *target, char *typed, int *mistyped, int *missed, int *extra);
-int getConsoleWidth();
-
-// Cross-platform getch() function
-int getch(void) {
-    #ifdef _WIN32
-        return _getch();
-    #else
-        struct termios oldattr, newattr;
-        int ch;
-        tcgetattr(STDIN_FILENO, &oldattr);
-        newattr = oldattr;
-        newattr.c_lflag &= ~(ICANON | ECHO);
-        tcsetattr(STDIN_FILENO, TCSANOW, &newattr);
-        ch = getchar();
-        tcsetattr(STDIN_FILENO, TCSANOW, &oldattr);
-        return ch;
-    #endif
-}
-
-// Initialize application state
-void initializeAppState(AppState *state) {
-    state->userCount = 0;
-    state->currentUserIndex = -1;
-    state->wordCount = 0;
-    
-    #ifdef _WIN32
-    state->hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    #endif
-}
-
-//Main Function
-int main() {
-    AppState state;
-    initializeAppState(&state);
-    
-    char username[MAX_NAME_LEN];
-    loadUsersFromFile(&state);
-
-    print_ascii_art("title.txt", &state);
-    printf("Enter your username (no spaces): ");
-    
-    // Input validation for username
-    int validInput = 0;
-    do {
-        if (scanf("%49s", username) != 1) {
-            while (getchar() != '\n'); // Clear input buffer
-            printf("Invalid input. Please try again: ");
-        } else {
-            validInput = 1;
-        }
-    } while (!validInput);
-    
-    //Check for existing user
-    int index = findUserIndex(username, &state);
-    if (index == -1) {
-        printf("New user detected. Creating profile for %s.\n", username);
-        if (state.userCount < MAX_USERS) {
-            strcpy(state.users[state.userCount].name, username);
-            state.users[state.userCount].bestWPM = 0.0;
-            state.users[state.userCount].bestAccuracy = 0.0;
-            state.users[state.userCount].testsCompleted = 0;
-            state.users[state.userCount].enduranceHighScore = 0;
-            state.users[state.userCount].averageAccuracy = 0.0;
-            state.users[state.userCount].totalCharsTyped = 0;
-            state.users[state.userCount].totalCorrectChars = 0;
-            state.currentUserIndex = state.userCount;
-            state.userCount++;
-            saveUsersToFile(&state);
-        } else {
-            printf("Error: Maximum number of users reached.\n");
-            return 1;
-        }
-    } else { //Display User profile
-        state.currentUserIndex = index;
-        printf("Welcome back, %s!\n", state.users[state.currentUserIndex].name);
-        printf("Best WPM: %.2f | Best Accuracy: %.2f%% | Tests completed: %d\n",
-               state.users[state.currentUserIndex].bestWPM,
-               state.users[state.currentUserIndex].bestAccuracy,
-               state.users[state.currentUserIndex].testsCompleted);
-        
-        if (state.users[state.currentUserIndex].enduranceHighScore > 0) {
-            printf("Endurance Mode High Score: %d words\n", 
-                   state.users[state.currentUserIndex].enduranceHighScore);
-        }
-    }
-    //Main menu operations
-    int choice;
-    do {
-        showMenu();
-        printf("Enter your choice (1-5): ");
-        choice = getValidIntInput(1, 5);
-        
-        switch (choice) {
-            case 1:
-                enduranceMode(&state);
-                break;
-            case 2:
-                rawSpeedMode(&state);
-                break;
-            case 3:
-                showLeaderboard(state.users, state.userCount, state.currentUserIndex);
-                break;
-            case 4:
-                showProfile(&state);
-                break;
-            case 5:
-                printf("Saving user data and exiting. Goodbye!\n");
-                saveUsersToFile(&state);
-                break;
-            default:
-                printf("Invalid choice. Try again.\n");
-        }
-    } while (choice != 5);
-    
-    return 0;
-}
-
-// Function to get valid integer input within a range
-int getValidIntInput(int min, int max) {
-    int value;
-    char buffer[100];
-    int valid = 0;
-
-    do {
-        if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
-            printf("Error reading input. Please try again: ");
-        } else {
-            // Remove newline if present
-            buffer[strcspn(buffer, "\n")] = 0;
-
-            // Check if input is empty
-            if (strlen(buffer) == 0) {
-                printf("Please enter a number between %d and %d: ", min, max);
-            } else {
-                // Check if input contains only digits
-                int allDigits = 1;
-                for (int i = 0; buffer[i] != '\0' && allDigits; i++) {
-                    if (!isdigit((unsigned char)buffer[i])) {
-                        allDigits = 0;
-                        
-                    }
-                }
-                // Check if input is a valid number
-                if (!allDigits) {
-                    printf("Invalid input. Please enter a number between %d and %d: ", min, max);
-                } else {
-                    value = atoi(buffer);
-                    if (value < min || value > max) {
-                        printf("Number must be between %d and %d. Please try again: ", min, max);
-                    } else {
-                        valid = 1;
-                    }
-                }
-            }
-        }
-    } while (!valid);
-
-    return value;
-}
-// Function to set console text color
-void setColour(int colour, AppState *state) {
-    #ifdef _WIN32
-        SetConsoleTextAttribute(state->hConsole, colour);
-    #else
-        // ANSI escape codes for colors
-        switch(colour) {
-            case GREEN:
-                printf("\033[32m"); break;
-            case RED:
-                printf("\033[31m"); break;
-            case YELLOW:
-                printf("\033[33m"); break;
-            case CYAN:
-                printf("\033[36m"); break;
-            default:
-                printf("\033[0m"); break;
-        }
-    #endif
-}
-
-//User management functions
-void loadUsersFromFile(AppState *state) {
-    FILE *fp = fopen(USERS_FILE, "r");
-    if (fp == NULL) {
-        // File doesn't exist, create it
-        printf("Users file not found. Creating new file.\n");
-        fp = fopen(USERS_FILE, "w");
-        if (fp == NULL) {
-            printf("Error: Could not create users file.\n");
-            return;
-        }
-        fclose(fp);
-        return;
-    }
-    
-    state->userCount = 0;
-    
-    // Read user data from file
-    char line[200];
-    while (fgets(line, sizeof(line), fp) != NULL && state->userCount < MAX_USERS) {
-        // Check if line format matches what we expect (at least basic fields)
-        if (sscanf(line, "%s %f %f %d %d %f %d %d",
-                state->users[state->userCount].name,
-                &state->users[state->userCount].bestWPM,
-                &state->users[state->userCount].bestAccuracy,
-                &state->users[state->userCount].testsCompleted,
-                &state->users[state->userCount].enduranceHighScore,
-                &state->users[state->userCount].averageAccuracy,
-                &state->users[state->userCount].totalCharsTyped,
-                &state->users[state->userCount].totalCorrectChars) >= 4) {
-                
-            // For backward compatibility, initialize new fields if not present
-            if (state->users[state->userCount].totalCharsTyped == 0 && 
-                state->users[state->userCount].testsCompleted > 0) {
-                // Estimate for older files
-                state->users[state->userCount].totalCharsTyped = 200 * state->users[state->userCount].testsCompleted;
-                state->users[state->userCount].totalCorrectChars = state->users[state->userCount].totalCharsTyped * 
-                    (state->users[state->userCount].bestAccuracy / 100.0);
-                state->users[state->userCount].averageAccuracy = state->users[state->userCount].bestAccuracy * 0.9;
-            }
-            
-            state->userCount++;
-        }
-    }
-    
-    fclose(fp);
-    printf("Loaded %d user profiles.\n", state->userCount);
-}
-
-// Save user data to file
-void saveUsersToFile(AppState *state) {
-    FILE *fp = fopen(USERS_FILE, "w");
-    if (fp == NULL) {
-        printf("Error: Could not open users file for writing.\n");
-        return;
-    }
-    
-    for (int i = 0; i < state->userCount; i++) {
-        fprintf(fp, "%s %.2f %.2f %d %d %.2f %d %d\n",
-                state->users[i].name,
-                state->users[i].bestWPM,
-                state->users[i].bestAccuracy,
-                state->users[i].testsCompleted,
-                state->users[i].enduranceHighScore,
-                state->users[i].averageAccuracy,
-                state->users[i].totalCharsTyped,
-                state->users[i].totalCorrectChars);
-    }
-    
-    fclose(fp);
-    printf("User data saved successfully.\n");
-}
-
-// Find user index by username
-int findUserIndex(char *username, AppState *state) {
-    for (int i = 0; i < state->userCount; i++) {
-        if (strcmp(state->users[i].name, username) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-//Main menu display
-void showMenu(void) {
-    printf("\n===== Main Menu =====\n");
-    printf("1. Endurance Mode\n");
-    printf("2. Raw Speed Mode\n");
-    printf("3. Leaderboard\n");
-    printf("4. Profile\n");
-    printf("5. Exit\n");
-}
-
-//Clear screen
-void clearScreen(void) {
-    #ifdef _WIN32
-        system("cls");
-    #else
-        system("clear");
-    #endif
-}
-
-//Word loading function
-int loadWordsFromFile(char *filename, AppState *state) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        printf("Error: Could not open %s\n", filename);
-        return 0;
-    }
-    
-    state->wordCount = 0;
-    while (fscanf(fp, "%19s", state->wordList[state->wordCount]) == 1 && 
-           state->wordCount < MAX_WORDS) {
-        state->wordCount++;
-    }
-    
-    fclose(fp);
-    printf("Successfully loaded %d words from %s.\n", state->wordCount, filename);
-    return 1;
-}
-
-// Determine difficulty level based on user's performance
-int getDifficulty(User user) {
-    // Calculate user skill level
-    float accuracy = 0;
-    
-    // Calculate average accuracy
-    if (user.totalCharsTyped > 0) {
-        accuracy = (float)user.totalCorrectChars / user.totalCharsTyped * 100;
-    } else {
-        accuracy = user.bestAccuracy; // Use best accuracy if no total data
-    }
-    
-    // Higher accuracy means higher challenge
-    if (accuracy >= DYNAMIC_COMPLEXITY_THRESHOLD) {
-        return 3; // Hard
-    } else if (accuracy >= DYNAMIC_COMPLEXITY_THRESHOLD - 10) {
-        return 2; // Medium
-    } else {
-        return 1; // Easy
-    }
-}
-
-// New accuracy calculation for better assessment
-float calculateAccuracy(char *target, char *typed, int *mistyped, int *missed, int *extra) {
-    int targetLen = strlen(target);
-    int typedLen = strlen(typed);
-    int correctChars = 0;
-    int mistypedChars = 0;
-    int missedChars = 0;
-    int extraChars = 0;
-
-    // Initialize output variables
-    if (mistyped) *mistyped = 0;
-    if (missed) *missed = 0;
-    if (extra) *extra = 0;
-
-    // Compare each character
-    int minLen = (targetLen < typedLen) ? targetLen : typedLen;
-
-    for (int i = 0; i < minLen; i++) {
-        if (typed[i] == target[i]) {
-            correctChars++;
-        } else {
-            mistypedChars++;
-        }
-    }
-
-    // Account for missed characters (if typed text is shorter)
-    if (typedLen < targetLen) {
-        missedChars = targetLen - typedLen;
-    }
-
-    // Account for extra characters (if typed text is longer)
-    if (typedLen > targetLen) {
-        extraChars = typedLen - targetLen;
-    }
-
-    // Total errors is the sum of mistyped, missed, and extra characters
-    int totalErrors = mistypedChars + missedChars + extraChars;
-
-    // Accuracy calculation based on errors relative to target length
-    float accuracy = 100.0 * (1.0 - ((float)totalErrors / targetLen));
-
-    // Handle edge cases
-    if (targetLen == 0) {
-        accuracy = 0.0;
-    }
-    if (accuracy < 0) {
-        accuracy = 0.0;
-    }
-
-    // Store the detailed metrics for reporting
-    if (mistyped) *mistyped = mistypedChars;
-    if (missed) *missed = missedChars;
-    if (extra) *extra = extraChars;
-
-    return accuracy;
-}
-
-// Endurance mode function
-void enduranceMode(AppState *state) {
-    printf("\n===== Endurance Mode =====\n");
-    printf("Keep typing until your accuracy falls below %.1f%% or WPM falls below %.1f\n", 
-           ENDURANCE_ACCURACY_THRESHOLD, ENDURANCE_WPM_THRESHOLD);
-    printf("Press ESC at any time to end the test.\n\n");
-
-    // Determine starting difficulty based on user performance
-    int difficulty = getDifficulty(state->users[state->currentUserIndex]);
-
-    char *filename;
-    switch (difficulty) {
-        case 1: 
-            filename = "wordbaseL.txt"; 
-            printf("Starting with LIGHT difficulty based on your profile.\n");
-            break;
-        case 2: 
-            filename = "wordbaseM.txt"; 
-            printf("Starting with MEDIUM difficulty based on your profile.\n");
-            break;
-        case 3: 
-            filename = "wordbaseH.txt"; 
-            printf("Starting with HARD difficulty based on your profile.\n");
-            break;
-        default:
-            printf("Using default difficulty (LIGHT).\n");
-            filename = "wordbaseL.txt";
-    }
-
-    if (!loadWordsFromFile(filename, state)) {
-        printf("Failed to load word list. Returning to main menu.\n");
-        printf("Press any key to continue...");
-        getch();
-        return;
-    }
-
-    // Endurance mode settings
-    int wordsPerRound = 10;
-    int roundsCompleted = 0;
-    float currentAccuracy = 100.0;
-    float currentWPM = 100.0;
-    int totalWordsCompleted = 0;
-    int testCanceled = 0; // Flag to track if the test was canceled
-
-    // Continue rounds until accuracy or WPM drops below thresholds
-    while (currentAccuracy >= ENDURANCE_ACCURACY_THRESHOLD && 
-           currentWPM >= ENDURANCE_WPM_THRESHOLD && 
-           !testCanceled) {
-        // Generate text for this round
-        srand(time(NULL) + roundsCompleted); // Ensure different random sequence each round
-        char roundText[1000] = "";
-        int usedIndexes[MAX_WORDS] = {0};
-
-        for (int i = 0; i < wordsPerRound && i < state->wordCount; i++) {
-            int randomIndex;
-            do {
-                randomIndex = rand() % state->wordCount;
-            } while (usedIndexes[randomIndex] && wordsPerRound < state->wordCount);
-
-            usedIndexes[randomIndex] = 1;
-            strcat(roundText, state->wordList[randomIndex]);
-            if (i < wordsPerRound - 1) {
-                strcat(roundText, " ");
-            }
-        }
-
-        printf("\n===== Round %d =====\n", roundsCompleted + 1);
-        printf("Words completed so far: %d\n", totalWordsCompleted);
-        printf("Current accuracy: %.2f%%\n", currentAccuracy);
-        printf("Current WPM: %.2f\n", currentWPM);
-        printf("Press ESC at any time to end the test.\n\n");
-
-        // Run the typing test for this round
-        TypingResult result;
-        int testStatus = typingTest(roundText, &result, state);
-
-        // Check if the test was canceled
-        if (testStatus == 0) {
-            printf("\nTest canceled. Returning to main menu...\n");
-            testCanceled = 1; // Set the flag to exit the loop
-        } else {
-            // Update stats
-            currentAccuracy = result.accuracy;
-            currentWPM = result.wpm;
-            totalWordsCompleted += wordsPerRound;
-            roundsCompleted++;
-
-            // Display round results
-            printf("\n===== Round %d Results =====\n", roundsCompleted);
-            printf("Time taken: %.2f seconds\n", result.timeTaken);
-            printf("Accuracy: %.2f%%\n", result.accuracy);
-            printf("WPM: %.2f\n", result.wpm);
-            printf("Mistyped chars: %d\n", result.mistyped);
-            printf("Missed chars: %d\n", result.missed);
-            printf("Extra chars: %d\n", result.extra);
-
-            // Check if accuracy or WPM is still above the thresholds
-            if (currentAccuracy < ENDURANCE_ACCURACY_THRESHOLD) {
-                printf("\nAccuracy dropped below %.1f%%. Endurance mode ended.\n", 
-                       ENDURANCE_ACCURACY_THRESHOLD);
-            } else if (currentWPM < ENDURANCE_WPM_THRESHOLD) {
-                printf("\nWPM dropped below %.1f. Endurance mode ended.\n", 
-                       ENDURANCE_WPM_THRESHOLD);
-            } else {
-                printf("\nBoth accuracy and WPM are above thresholds. Continue to next round.\n");
-                printf("Press any key to start next round...");
-                getch();
-            }
-        }
-    }
-
-    // Endurance mode complete
-    printf("\n===== Endurance Mode Complete =====\n");
-    printf("Total words completed: %d\n", totalWordsCompleted);
-    printf("Rounds completed: %d\n", roundsCompleted);
-    printf("Final accuracy: %.2f%%\n", currentAccuracy);
-    printf("Final WPM: %.2f\n", currentWPM);
-
-    // Update user stats
-    if (totalWordsCompleted > state->users[state->currentUserIndex].enduranceHighScore) {
-        printf("New endurance high score! Previous: %d words\n", 
-               state->users[state->currentUserIndex].enduranceHighScore);
-        state->users[state->currentUserIndex].enduranceHighScore = totalWordsCompleted;
-    }
-
-    // Update tests completed
-    state->users[state->currentUserIndex].testsCompleted += roundsCompleted;
-
-    // Save user data
-    saveUsersToFile(state);
-
-    printf("\nPress any key to return to main menu...");
-    getch();
-}
-
-//Print the cool ascii title art
-void print_ascii_art(const char *filename, AppState *state) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("Error opening ASCII art file");
-        return;
-    }
-
-    char line[256];
-    int lineNumber = 0;
-
-    while (fgets(line, sizeof(line), file)) {
-        // Alternate colors for each line
-        if (lineNumber % 3 == 0)
-            setColour(GREEN, state);
-        else if (lineNumber % 3 == 1)
-            setColour(CYAN, state);
-        else
-            setColour(YELLOW, state);
-
-        printf("%s", line);
-        lineNumber++;
-    }
-
-    setColour(DEFAULT, state); // Reset to default
-    fclose(file);
-}
-
-//Raw Speed Mode function
-void rawSpeedMode(AppState *state) {
-    printf("\n===== Raw Speed Mode =====\n");
-    printf("Choose difficulty:\n1. Light (easier words)\n2. Medium (average words)\n3. Hard (difficult words)\nChoice: ");
-    int difficulty = getValidIntInput(1, 3);
-    
-    char *filename;
-    switch (difficulty) {
-        case 1: filename = "wordbaseL.txt"; break;
-        case 2: filename = "wordbaseM.txt"; break;
-        case 3: filename = "wordbaseH.txt"; break;
-        default:
-            printf("Invalid difficulty level. Using Light.\n");
-            filename = "wordbaseL.txt";
-    }
-    
-    if (!loadWordsFromFile(filename, state)) {
-        printf("Error loading %s. Please make sure the file exists.\n", filename);
-        printf("Press any key to continue...");
-        getch();
-        return;
-    }
-    
-    // Number of words to include in test (changing to 15-50 range)
-    printf("How many words for the test? (15-50): ");
-    int numTestWords = getValidIntInput(15, 50);
-    
-    if (numTestWords > state->wordCount) {
-        printf("Not enough words in file. Using all %d available words.\n", state->wordCount);
-        numTestWords = state->wordCount;
-    }
-    
-    // Create test text from random words
-    srand(time(NULL));
-    char targetText[1000] = "";
-    int usedIndexes[MAX_WORDS] = {0}; // To avoid using the same word twice
-    for (int i = 0; i < numTestWords && i < state->wordCount; i++) {
-        int randomIndex;
-        do {
-            randomIndex = rand() % state->wordCount;
-        } while (usedIndexes[randomIndex] && numTestWords < state->wordCount);
-        
-        usedIndexes[randomIndex] = 1;
-        strcat(targetText, state->wordList[randomIndex]);
-        if (i < numTestWords - 1) {
-            strcat(targetText, " ");
-        }
-    }
-    
-    printf("\n===== Raw Speed Test =====\n");
-    printf("Type as fast and accurately as you can!\n");
-    printf("Press ESC at any time to end the test.\n\n");
-    
-    // Run the typing test
-    TypingResult result;
-    typingTest(targetText, &result, state);
-    
-    // Process results
-    TypingResult results[1] = {result};
-    processTypingResults(results, 1, state);
-}
-
-// Typing test function
-int typingTest(char *text, TypingResult *result, AppState *state) {
-    setColour(CYAN, state);
-    printf("%s\n\n", text);
-    setColour(DEFAULT, state);
-    printf("Press any key to start typing...");
-    getch();
-    clearScreen();
-
-    setColour(CYAN, state);
-    printf("%s\n\n", text);
-    setColour(DEFAULT, state);
-    printf("Begin typing:    Press ESC at anytime to Cancel\n");
-
-    char typedText[1000] = "";
-    char mistakeFlags[1000] = {0}; // Flags to count unique mistakes
-    int pos = 0;
-    char ch;
-    clock_t start = clock();
-
-    int totalKeystrokes = 0;
-    int incorrectKeystrokes = 0;
-    int testFinished = 0;
-    int textLength = (int)strlen(text);
-
-    while (!testFinished && pos < textLength) {
-        ch = getch();
-
-        if (ch == 27) { // ESC key
-            printf("\n\nTest cancelled. Returning to menu...\n");
-            return 0; // CANCELLED
-        }
-
-        if ((ch == 8 || ch == 127) && pos > 0) { // Backspace
-            pos--;
-            typedText[pos] = '\0';
-
-            printf("\r"); // Move cursor to the start of the line
-            int consoleWidth = getConsoleWidth();
-            int linesToClear = (pos / consoleWidth) + 1; // Calculate how many lines to clear
-
-            for (int i = 0; i < linesToClear; i++) {
-                printf("\r");
-                for (int j = 0; j < consoleWidth; j++) printf(" "); // Clear the line
-                printf("\r");
-                if (i < linesToClear - 1) printf("\033[A"); // Move up a line if not the last
-            }
-
-            int currentLineLength = 0;
-            for (int i = 0; i <= pos; i++) {
-                if (currentLineLength >= consoleWidth) {
-                    printf("\n"); // Move to the next line if the current line is full
-                    currentLineLength = 0;
-                }
-                // Check if the character is within the bounds of the text
-                if (i < textLength) {
-                    if (typedText[i] == text[i]) {
-                        setColour(GREEN, state);
-                    } else {
-                        setColour(RED, state);
-                        if (!mistakeFlags[i]) {
-                            incorrectKeystrokes++;
-                            mistakeFlags[i] = 1;
-                        }
-                    }
-                } else {
-                    setColour(RED, state);
-                    incorrectKeystrokes++;
-                }
-                printf("%c", typedText[i]);
-                currentLineLength++;
-            }
-            setColour(DEFAULT, state);
-        }
-        else if (isprint(ch) && pos < 999) {
-            typedText[pos] = ch;
-            typedText[pos + 1] = '\0';
-            totalKeystrokes++;
-
-            printf("\r"); // Move cursor to the start of the line
-            int consoleWidth = getConsoleWidth();
-            int linesToClear = (pos / consoleWidth) + 1; // Calculate how many lines to clear
-
-            for (int i = 0; i < linesToClear; i++) {
-                printf("\r");
-                for (int j = 0; j < consoleWidth; j++) printf(" "); // Clear the line
-                printf("\r");
-                if (i < linesToClear - 1) printf("\033[A"); // Move up a line if not the last
-            }
-
-            int currentLineLength = 0;
-            for (int i = 0; i <= pos; i++) {
-                if (currentLineLength >= consoleWidth) {
-                    printf("\n"); // Move to the next line if the current line is full
-                    currentLineLength = 0;
-                }
-
-                if (i < textLength) {
-                    if (typedText[i] == text[i]) {
-                        setColour(GREEN, state);
-                    } else {
-                        setColour(RED, state);
-                        if (!mistakeFlags[i]) {
-                            incorrectKeystrokes++;
-                            mistakeFlags[i] = 1;
-                        }
-                    }
-                } else {
-                    setColour(RED, state);
-                    incorrectKeystrokes++;
-                }
-                printf("%c", typedText[i]);
-                currentLineLength++;
-            }
-            setColour(DEFAULT, state);
-            pos++;
-
-            if (pos >= textLength) {
-                printf("\n\nText completed!\n");
-                testFinished = 1;
-            }
-        }
-    }
-
-    clock_t end = clock();
-    double timeTaken = (double)(end - start) / CLOCKS_PER_SEC;
-
-    result->totalChars = totalKeystrokes;
-    result->correctChars = totalKeystrokes - incorrectKeystrokes;
-    result->accuracy = (totalKeystrokes == 0) ? 0 : (100.0f * result->correctChars / totalKeystrokes);
-    result->wpm = ((float)pos / 5) / (timeTaken / 60.0f);
-    result->timeTaken = timeTaken;
-    strncpy(result->text, text, sizeof(result->text));
-    result->text[sizeof(result->text) - 1] = '\0';
-
-    return 1; // SUCCESS
-}
-
-// Sort users by WPM in descending order
-void sortUsersByWPM(User users[], int userCount) {
-    // Simple bubble sort algorithm
-    for (int i = 0; i < userCount - 1; i++) {
-        for (int j = 0; j < userCount - i - 1; j++) {
-            if (users[j].bestWPM < users[j + 1].bestWPM) {
-                // Swap users
-                User temp = users[j];
-                users[j] = users[j + 1];
-                users[j + 1] = temp;
-            }
-        }
-    }
-}
-
-// Display leaderboard
-// Show top 5 users based on WPM and current user position
-void showLeaderboard(User users[], int userCount, int currentUserIndex) {
-    printf("\n===== Leaderboard =====\n");
-    if (userCount == 0) {
-        printf("No users found.\n");
-        printf("Press any key to continue...");
-        getch();
-        return;
-    }
-    
-    // Create a copy of the users array for sorting
-    User sortedUsers[MAX_USERS];
-    for (int i = 0; i < userCount; i++) {
-        sortedUsers[i] = users[i];
-    }
-    
-    // Sort users by WPM (highest first)
-    sortUsersByWPM(sortedUsers, userCount);
-    
-// Display leaderboard
-printf("Rank | Username             | WPM    | Accuracy | Tests | Endurance\n");
-printf("-----|----------------------|--------|----------|-------|----------\n");
-
-// Find current user's rank
-int currentUserRank = -1;
-int i = 0;
-while (i < userCount && currentUserRank == -1) {
-    if (strcmp(sortedUsers[i].name, users[currentUserIndex].name) == 0) {
-        currentUserRank = i + 1;
-    }
-    i++;
-}
-
-// Display top 5 users
-int displayCount = userCount < 5 ? userCount : 5;
-for (int i = 0; i < displayCount; i++) {
-    printf("%-4d | %-20s | %-6.2f | %-8.2f | %-5d | %-5d\n",
-           i + 1,
-           sortedUsers[i].name,
-           sortedUsers[i].bestWPM,
-           sortedUsers[i].bestAccuracy,
-           sortedUsers[i].testsCompleted,
-           sortedUsers[i].enduranceHighScore);
-}
-
-// If current user is not in top 5, also display their position
-if (currentUserRank > 5) {
-    printf("...\n");
-    printf("%-4d | %-20s | %-6.2f | %-8.2f | %-5d | %-5d (You)\n",
-           currentUserRank,
-           users[currentUserIndex].name,
-           users[currentUserIndex].bestWPM,
-           users[currentUserIndex].bestAccuracy,
-           users[currentUserIndex].testsCompleted,
-           users[currentUserIndex].enduranceHighScore);
-}
-
-printf("\nPress any key to return to menu...");
-getch();
-}
-
-// Display user profile
-void showProfile(AppState *state) {
-    User user = state->users[state->currentUserIndex];
-    printf("\n===== Profile: %s =====\n", user.name);
-    printf("Tests completed: %d\n", user.testsCompleted);
-    printf("Best WPM: %.2f\n", user.bestWPM);
-    printf("Best accuracy: %.2f%%\n", user.bestAccuracy);
-    printf("Average accuracy: %.2f%%\n", user.averageAccuracy);
-    printf("Endurance high score: %d words\n", user.enduranceHighScore);
-    
-    // Calculate skill level based on stats
-    float normalizedWPM = user.bestWPM / 200.0 * 100; // Normalize WPM
-    float skillRating = (normalizedWPM * 0.5) + (user.bestAccuracy * 0.3) + (user.averageAccuracy * 0.2);
-    if (skillRating > 100) skillRating = 100; // Cap at 100
-
-    
-    printf("\nSkill assessment: ");
-    if (skillRating > 100) {
-        setColour(GREEN, state);
-        printf("Expert");
-    } else if (skillRating > 80) {
-        setColour(CYAN, state);
-        printf("Advanced");
-    } else if (skillRating > 60) {
-        setColour(YELLOW, state);
-        printf("Intermediate");
-    } else {
-        setColour(DEFAULT, state);
-        printf("Beginner");
-    }
-    setColour(DEFAULT, state);
-    
-    printf("\n\nPress any key to return to menu...");
-    getch();
-}
-
-// Process typing results and update user stats
-void processTypingResults(TypingResult results[], int count, AppState *state) {
-    User *user = &state->users[state->currentUserIndex];
-    float totalWPM = 0;
-    float totalAccuracy = 0;
-    int totalChars = 0;
-    int totalCorrectChars = 0;
-
-    for (int i = 0; i < count; i++) {
-        totalWPM += results[i].wpm;
-        totalAccuracy += results[i].accuracy;
-        totalChars += results[i].totalChars;
-        totalCorrectChars += results[i].correctChars;
-
-        // Display individual test results
-        printf("\n===== Test %d Results =====\n", i + 1);
-        printf("Time taken: %.2f seconds\n", results[i].timeTaken);
-        printf("Words per minute: %.2f\n", results[i].wpm);
-        printf("Accuracy: %.2f%%\n", results[i].accuracy);
-
-        
-    }
-
-    // Calculate averages
-    float avgWPM = totalWPM / count;
-    float avgAccuracy = totalAccuracy / count;
-
-    // Update user statistics
-    if (avgWPM > user->bestWPM) {
-        printf("\nNew personal best WPM: %.2f (previous: %.2f)\n", avgWPM, user->bestWPM);
-        user->bestWPM = avgWPM;
-    }
-
-    if (avgAccuracy > user->bestAccuracy) {
-        printf("\nNew personal best accuracy: %.2f%% (previous: %.2f%%)\n", avgAccuracy, user->bestAccuracy);
-        user->bestAccuracy = avgAccuracy;
-    }
-
-    // Update running average accuracy
-    user->totalCharsTyped += totalChars;
-    user->totalCorrectChars += totalCorrectChars;
-    user->averageAccuracy = (float)user->totalCorrectChars / user->totalCharsTyped * 100;
-
-    // Increment tests completed
-    user->testsCompleted += count;
-
-    // Save user data
-    saveUsersToFile(state);
-
-    printf("\nPress any key to return to menu...");
-    getch();
-}
-
-// Function to get console width
-int getConsoleWidth() {
-#ifdef _WIN32
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi)) {
-        return csbi.srWindow.Right - csbi.srWindow.Left + 1;
-    }
-#else
-    struct winsize w;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0) {
-        return w.ws_col;
-    }
-#endif
-    return 80; // Default width if unable to determine
+/*
+* LowkeyType - A Typing Test Game
+*
+* This program implements a console-based typing test game with multiple modes:
+* Features include:
+* - User profiles with persistent statistics
+* - Endurance mode that adjusts difficulty based on user performance
+* - Raw Speed mode for timed typing tests (15-50 words)
+* - Race mode against other players through a small race server
+* - Enhanced accuracy calculation tracking character-level errors
+* - Leaderboard to compare performance with other users
+* - Profile view to check personal statistics
+* - Cross-platform compatibility for Windows and Unix
+* - Console width detection for better display
+* - ASCII art title screen
+* - Color-coded output for better user experience
+* - Input validation for user inputs
+* - Dynamic word list loading from files
+* - Backspace support for correcting mistakes during typing
+* - Clear screen functionality for better readability
+* - User-friendly menu navigation
+* - Detailed error reporting for typing tests
+* - Skill assessment based on typing speed and accuracy
+*
+* Author: Rotimi Dayo
+* Date: 16th of April 2025
+* Module: ACS130 Introduction to Systems Engineering and Software
+*
+*
+*/
+
+#define _POSIX_C_SOURCE 200809L // pread, pwrite and getaddrinfo under strict -std=c11 as well
+#define _DARWIN_C_SOURCE // Which would otherwise hide kqueue and the terminal ioctls on macOS
+
+#include <stdio.h>           // Standard I/O functions
+#include <stdlib.h>          // Memory allocation, random numbers, etc.
+#include <string.h>          // String manipulation function
+#include <time.h>            // Time-related functions
+#include <ctype.h>           // Character type functions
+#include <stdarg.h>          // Variable argument lists for framePrintf
+#include <stdint.h>          // Fixed-width integers for on-disk formats
+#include <sys/stat.h>        // File size and modification time
+#include <signal.h>          // Terminal restore and race server shutdown on a signal
+
+// Vector units available to the character compare kernel
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define MATCH_KERNEL_SSE2
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define MATCH_KERNEL_AVX2 // Compiled in always, used only if the CPU has it
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+    #define MATCH_KERNEL_NEON
+#endif
+
+//Definition of constants
+#define MAX_NAME_LEN 50
+#define USERS_FILE "users.txt"
+#define USER_STORE_FILE "users.dat" // Binary store; users.txt is the text import/export format
+#define USER_STORE_MAGIC "LKUS"
+#define USER_STORE_VERSION 1
+#define PERSIST_QUEUE_SIZE 256 // Saves in flight to the persistence worker, a power of two
+#define PERSIST_BATCH_MS 1000 // Longest the batched policy leaves written users unsynced
+#define PERSIST_SYNC_IMMEDIATE 0 // --sync: fsync the user store after every batch of writes,
+#define PERSIST_SYNC_BATCHED 1 // at most once per PERSIST_BATCH_MS,
+#define PERSIST_SYNC_ON_EXIT 2 // or only when the program exits
+#define PERSIST_EVENT_USER 1 // Kinds of PersistEvent
+#define PERSIST_EVENT_HISTORY 2
+#define PERSIST_EVENT_SKILLS 3
+#define PERSIST_EVENT_STOP 4
+#define PERSIST_FAILED_USERS 1 // Bits of PersistQueue.failed
+#define PERSIST_FAILED_HISTORY 2
+#define PERSIST_FAILED_SKILLS 4
+#define HISTORY_DIR "history" // One <username>.hist log per user
+#define HISTORY_PATH_LEN (sizeof(HISTORY_DIR) + 3 * MAX_NAME_LEN + 8) // Longest log path, with every name byte escaped
+#define HISTORY_MAGIC "LKHL"
+#define HISTORY_VERSION 1
+#define HISTORY_RECENT_SIZE 100 // Results kept in the summary for "last N tests"
+#define HISTORY_DAYS 30 // Daily buckets kept in the summary
+#define HISTORY_MODE_ENDURANCE 1
+#define HISTORY_MODE_RAW_SPEED 2
+#define HISTORY_MODE_RACE 3
+#define HISTORY_MODE_TEXT 4 // Stored with difficulty 0
+#define SKILL_MAGIC "LKSK" // history/<username>.skill: per-key and per-bigram counters
+#define SKILL_VERSION 1
+#define SKILL_KEYS 95 // Printable ASCII, space to tilde
+#define SKILL_PAIRS 676 // Letter bigrams, 26 x 26, case folded
+#define SKILL_MAX_LATENCY_MS 2000 // Longer gaps are pauses, not slow keys
+#define ADAPTIVE_BOOST 20.0 // Extra weight of a word whose weakest bigram is at full weakness
+#define ADAPTIVE_RECENT 8 // Words held out of the draw after being picked
+#define DIFFICULTY_COUNT 3 // Light, medium and hard word lists
+#define WORD_INDEX_MAGIC "LKWI" // Identifies a .idx word index sidecar
+#define WORD_INDEX_VERSION 1
+#define ARENA_BLOCK_SIZE 65536 // Default size of a session arena block
+#define DYNAMIC_COMPLEXITY_THRESHOLD 95.0
+#define ENDURANCE_WINDOW_KEYS 100 // Characters the endurance thresholds are judged over
+#define MODE_WORDS_PROFILE 1 // GameMode.wordSource: word list picked from the user's accuracy,
+#define MODE_WORDS_CHOSEN 2 // picked by the player,
+#define MODE_WORDS_FILE 3 // or a passage of a text file instead
+#define MODE_FEATURE_HUD 1 // GameMode.features: live status line, and wrapping again on resize
+#define MODE_FEATURE_RACE 2 // Race standings line and progress reports to the relay
+#define MODE_FEATURE_LINES 4 // ENTER, TAB and filled-in indentation in text with line breaks
+#define MODE_FEATURE_RECORD 8 // Keys go through the --record and --replay stream
+#define MODE_SCORE_BEST 1 // GameMode.scoring: average WPM and accuracy can set a personal best
+#define MODE_SCORE_WORDS 2 // Words in one run can set the endurance high score
+#define ENDURANCE_END_CANCELLED 1 // Why an endurance session ended
+#define ENDURANCE_END_ACCURACY 2
+#define ENDURANCE_END_WPM 3
+#define STREAM_BUFFER_SIZE 4096 // Characters of endurance text held at once
+#define STREAM_MAX_LINE 160 // Longest line of endurance text
+#define STREAM_VISIBLE_LINES 3 // Lines of endurance text on screen
+#define STREAM_LINE_SLOTS 8 // Line starts kept, a power of two above STREAM_VISIBLE_LINES + 1
+#define STREAM_STATUS_ROW 2 // Screen rows used by an endurance session
+#define STREAM_FIRST_ROW 4
+#define TEXT_PATH_LEN 260 // Longest text file name in text mode
+#define TEXT_TAB_WIDTH 4 // Columns between tab stops when a tab becomes spaces
+#define TEXT_WINDOW_LINES 40 // Longest passage picked from a text file
+#define TEXT_CHUNK_LINES 8 // Lines of a passage typed in one test
+#define TEXT_CHUNK_CHARS 1000 // Characters of a passage typed in one test, at most 4 bytes each
+#define TEXT_WINDOW_CHUNKS 8 // Tests a passage is split into at most
+#define FRAME_BUFFER_SIZE 8192 // Bytes collected before a forced flush
+#define KEY_BATCH_SIZE 64 // Keys drained from the terminal in one read
+#define HUD_REFRESH_MS 100 // Status line redraw interval during a test
+#define HUD_WINDOW_KEYS 32 // Keystrokes the live WPM is measured over
+#define KEYSTROKE_RING_SIZE 4096 // Timestamps kept per test, must be a power of two
+#define GLYPH_FIRST 0x80 // Byte codes from here up stand for the non-ASCII characters of a test
+#define GLYPH_TABLE_SIZE 127 // Distinct non-ASCII characters one test can hold
+#define GLYPH_UNKNOWN 0xFF // Typed character that is not in the test text
+#define ALIGN_MAX_WORD 64 // Longest word aligned by edit distance; one bit per character
+#define KEY_RECORDING_MAGIC "LKKR" // Identifies a --record keystroke file
+#define KEY_RECORDING_VERSION 1
+#define BENCH_DIR "lowkey_bench" // Scratch directory used by --bench
+#define BENCH_MIN_NANOS 200000000LL // Shortest timed batch of one benchmark
+#define REPORT_WPM_BUCKET 10 // Width of a --report WPM histogram bucket
+#define REPORT_WPM_BUCKETS 21 // The last bucket holds everything from 200 WPM up
+#define REPORT_BIGRAMS 20 // Most-missed bigrams listed in a report
+#define REPORT_MAX_THREADS 64
+#define TRACE_FILE "lowkey_trace.json" // Written at exit by builds with -DLOWKEY_TRACE
+#define TRACE_EVENTS 65536 // Events kept per thread; later ones are only counted
+#define TRACE_MAX_THREADS 72
+#define TRACE_MAX_NAMES 32 // Distinct span names summarised at exit
+#define RANK_BY_WPM 0
+#define RANK_BY_ACCURACY 1
+#define RANK_BY_ENDURANCE 2
+#define RANK_METRIC_COUNT 3
+#define LEADERBOARD_SIZE 5 // Users shown at the top of the leaderboard
+#define RACE_DEFAULT_PORT "7070"
+#define RACE_ADDRESS_LEN 128 // Longest "host:port" of a race server
+#define RACE_PROTOCOL_VERSION 1
+#define RACE_MAX_CLIENTS 1024 // Connections one relay serves; a racer's id is its slot
+#define RACE_MAX_TEXT 2048 // Longest race text
+#define RACE_HEADER_SIZE 3 // Packet type, then the payload length as 16 bits
+#define RACE_MAX_PACKET (RACE_HEADER_SIZE + 11 + RACE_MAX_TEXT) // A START packet with the longest text
+#define RACE_CLIENT_OUTBOX (2 * RACE_MAX_PACKET) // Room for a START and the small packets behind it
+#define RACE_OUTBOX_LIMIT 262144 // Bytes queued for a client before the relay drops it as too slow
+#define RACE_SEND_MS 100 // A client sends its progress at most this often
+#define RACE_BROADCAST_MS 100 // The relay sends the standings at most this often
+#define RACE_BOARD_SIZE 5 // Leaders included in every standings packet
+#define RACE_BOARD_ENTRY_SIZE 15 // Id, finished flag, position, errors and time
+#define RACE_FINISH_GRACE_MS 60000 // Time the rest get once the first racer has finished
+#define RACE_COUNTDOWN 3 // Seconds from the start packet to the first key
+#define RACE_EVENT_BATCH 64 // Poller events handled per wait
+#define RACE_PACKET_HELLO 1 // Client: protocol version and name
+#define RACE_PACKET_WELCOME 2 // Relay: the client's racer id
+#define RACE_PACKET_JOIN 3 // Relay: id and name of a racer in the lobby
+#define RACE_PACKET_LEAVE 4 // Relay: id of a racer that disconnected
+#define RACE_PACKET_HOST 5 // Relay: id of the racer allowed to start a race
+#define RACE_PACKET_START 6 // Host, then relay to everyone: seed, difficulty, text length and text
+#define RACE_PACKET_PROGRESS 7 // Client: position, errors and milliseconds since its start
+#define RACE_PACKET_FINISH 8 // Client: as PROGRESS, sent once the text is done
+#define RACE_PACKET_BOARD 9 // Relay: standings, the receiver's place and the leaders
+#define RACE_PACKET_REFUSED 10 // Relay: the host's START was not accepted
+#define RACE_BOARD_OVER 1 // BOARD flag: the race has ended
+
+// Cross-platform solution for color and keyboard input
+#ifdef _WIN32
+    #include <conio.h>
+    #include <winsock2.h> // Must come before windows.h
+    #include <ws2tcpip.h>
+    #include <windows.h>
+    #define CLEAR_SCREEN "cls"
+    #define GREEN 10
+    #define RED 12
+    #define YELLOW 14
+    #define CYAN 11
+    #define DEFAULT 7
+#else
+    #include <unistd.h>
+    #include <termios.h>
+    #include <poll.h>
+    #define CLEAR_SCREEN "clear"
+    #define GREEN 2
+    #define RED 1
+    #define YELLOW 3
+    #define CYAN 6
+    #define DEFAULT 7
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <direct.h>
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#else
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <pthread.h>
+#endif
+
+// Readiness poller used by the race relay
+#if defined(__linux__)
+    #include <sys/epoll.h>
+    #define RACE_POLL_EPOLL
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    #include <sys/event.h>
+    #define RACE_POLL_KQUEUE
+#endif
+
+// Hot-path instrumentation, compiled in with -DLOWKEY_TRACE and to nothing otherwise
+// TRACE_BEGIN declares a start stamp that TRACE_END turns into a span
+#ifdef LOWKEY_TRACE
+    #if defined(_MSC_VER)
+        #define TRACE_THREAD_LOCAL __declspec(thread)
+    #else
+        #define TRACE_THREAD_LOCAL _Thread_local
+    #endif
+    #define TRACE_BEGIN(stamp) long long stamp = monotonicNanos()
+    #define TRACE_END(name, stamp, value) traceSpan(name, stamp, value)
+    #define TRACE_KEYS(count) traceKeys(count)
+    #define TRACE_DISPLAYED() traceDisplayed()
+#else
+    #define TRACE_BEGIN(stamp)
+    #define TRACE_END(name, stamp, value) ((void)0)
+    #define TRACE_KEYS(count) ((void)0)
+    #define TRACE_DISPLAYED() ((void)0)
+#endif
+
+// The typing loop is copied into every mode that calls it, with that mode's
+// GameMode known, so the checks for features the mode lacks compile away
+#if defined(__GNUC__) || defined(__clang__)
+    #define MODE_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+    #define MODE_INLINE static __forceinline
+#else
+    #define MODE_INLINE static inline
+#endif
+#ifdef _WIN32
+    #ifdef _MSC_VER
+        #pragma comment(lib, "ws2_32.lib")
+    #endif
+    typedef SOCKET RaceSocket;
+    typedef WSAPOLLFD RacePollFd;
+    #define RACE_INVALID_SOCKET INVALID_SOCKET
+    #define racePollSockets WSAPoll
+#else
+    typedef int RaceSocket;
+    typedef struct pollfd RacePollFd;
+    #define RACE_INVALID_SOCKET (-1)
+    #define racePollSockets poll
+#endif
+
+
+//Structure to hold user data
+typedef struct {
+    char name[MAX_NAME_LEN];
+    float bestWPM;
+    float bestAccuracy;
+    int testsCompleted;
+    int enduranceHighScore;
+    float averageAccuracy;
+    int totalCharsTyped;
+    int totalCorrectChars;
+} User;
+
+//Structure to hold typing result
+typedef struct {
+    int totalChars;
+    int correctChars;
+    int mistyped;
+    int missed;
+    int extra;
+    float accuracy;
+    float wpm;
+    float timeTaken;  // Wall-clock seconds
+    float latencyP50; // Inter-key latency percentiles in milliseconds
+    float latencyP95;
+    float latencyP99;
+    int wordsCompleted; // Words typed up to their last character
+    int wordErrors;     // Words that had at least one mistake
+} TypingResult;
+
+// Structure to hold how typed text differs from its target
+typedef struct {
+    int correct;
+    int mistyped; // Typed in place of a different character
+    int missed;   // In the target but never typed
+    int extra;    // Typed with nothing to match in the target
+} AlignmentCounts;
+
+// Structure to hold the timestamp of every accepted keystroke in a test
+typedef struct {
+    long long timestamps[KEYSTROKE_RING_SIZE]; // Monotonic nanoseconds
+    long long intervals[KEYSTROKE_RING_SIZE];  // Scratch space for percentiles
+    int count;                                 // Keystrokes recorded in total
+} KeystrokeRing;
+
+// Structure to hold terminal output until the current frame is complete
+typedef struct {
+    char data[FRAME_BUFFER_SIZE];
+    size_t length;
+    int ansi;      // Console understands ANSI escape sequences
+    #ifdef _WIN32
+    HANDLE output;
+    int isConsole; // WriteConsoleA for consoles, WriteFile when redirected
+    #endif
+} FrameBuffer;
+
+// Structure to hold the terminal settings while raw input is active
+typedef struct {
+    int active;        // Raw mode is currently enabled
+    int handlersReady; // atexit and signal handlers are installed
+    #ifdef _WIN32
+    HANDLE input;
+    DWORD savedMode;
+    #else
+    struct termios saved;
+    #endif
+} TerminalSession;
+
+// Structure to hold the non-ASCII characters of one test text
+// Each gets a one-byte code from GLYPH_FIRST up, so a test of any text is still
+// one byte per character to the scoring, the layout and the compare kernels
+typedef struct {
+    uint32_t codepoints[GLYPH_TABLE_SIZE];
+    char utf8[GLYPH_TABLE_SIZE][4];
+    unsigned char utf8Length[GLYPH_TABLE_SIZE];
+    unsigned char widths[256]; // Screen cells of every byte code
+    int count;
+    int wide;                  // Some character takes two cells
+} GlyphTable;
+
+// Structure to hold a typed multi-byte character whose bytes are still arriving
+typedef struct {
+    char bytes[4];
+    int length;
+    int needed; // Length of the sequence, 0 when none is pending
+} Utf8Pending;
+
+// Structure to hold what the typing area currently shows on screen
+typedef struct {
+    int width;     // Console width captured when the test starts
+    int height;    // Console height, to tell when the status line scrolled away
+    int cursorRow; // Row of the cursor relative to the top of the typing area
+    int cursorCol; // In screen cells
+    int colour;    // Colour most recently sent to the console
+    const GlyphTable *glyphs; // Set when the text has characters beyond ASCII
+} TypingView;
+
+// Structure to hold one word-wrapped line of test text
+typedef struct {
+    int start;  // Text offset of the first character
+    int length; // Characters, including the space the line breaks after
+    int row;    // Screen row of the target line; its typed text goes on the next row
+} TextLine;
+
+// Structure to hold test text wrapped into screen lines, laid out once per test
+typedef struct {
+    int width;      // Console width the text was wrapped for
+    TextLine *lines;
+    int count;
+    int *lineOf;    // Line holding each text offset, plus the end of the text
+    int *cellOf;    // Screen column of each offset in its line; NULL when every character is one cell
+} TextLayout;
+
+// Structure to hold the running counts behind the status line of a test
+typedef struct {
+    int enabled;          // Needs ANSI cursor save and restore
+    long long start;      // Monotonic time the test started
+    long long nextRefresh;
+    int typed;            // Printable keystrokes
+    int mistakes;         // Positions that were ever typed wrong
+} TypingHud;
+
+// Structure to hold the endurance text around the cursor
+// Words are laid out into lines a few lines ahead of the cursor; text before
+// the cursor's line is dropped, so memory stays fixed however long a session runs
+typedef struct {
+    char text[STREAM_BUFFER_SIZE];
+    char typed[STREAM_BUFFER_SIZE];
+    char mistakes[STREAM_BUFFER_SIZE]; // Positions that were ever typed wrong
+    long long base;                    // Stream offset of text[0]
+    long long length;                  // Stream offset just past the last generated character
+    long long lineStarts[STREAM_LINE_SLOTS];
+    long long lineCount;               // Lines started; the last one is still being filled
+    int lineWidth;
+} StreamText;
+
+// Structure to hold the last ENDURANCE_WINDOW_KEYS typed characters
+typedef struct {
+    long long stamps[ENDURANCE_WINDOW_KEYS];
+    unsigned char hits[ENDURANCE_WINDOW_KEYS]; // 1 where the character was right
+    int count;                                 // Characters seen in total
+    int correct;                               // Right characters inside the window
+} EnduranceWindow;
+
+// Structure to hold the position of one word inside the word arena
+typedef struct {
+    int offset;
+    int length;
+} WordEntry;
+
+// Structure to hold character-class statistics of a word list
+typedef struct {
+    int maxLength;
+    int lowercase;
+    int uppercase;
+    int digits;
+    int punctuation;
+    int nonAscii; // Bytes >= 0x80, i.e. parts of UTF-8 sequences
+} WordListStats;
+
+// Structure to hold a read-only memory mapping of a whole file
+typedef struct {
+    const char *data;
+    size_t size;
+    #ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+    #endif
+} MappedFile;
+
+// Structure to hold a memory-mapped text file for text mode and where its lines start
+// A window is a paragraph or top-level block: it starts on an unindented line
+// after a blank line, or TEXT_WINDOW_LINES after the previous window, and
+// runs up to the next one
+typedef struct {
+    MappedFile map;
+    size_t *lineStarts; // Offset of every line, plus the end of the file
+    int lineCount;
+    int *windowStarts;  // First line of every window
+    int windowCount;
+} TextSource;
+
+// Structure to hold the index of one difficulty's words
+typedef struct {
+    const char *base; // Start of the text the offsets refer to
+    WordEntry *entries;
+    int count;
+    int capacity;
+    WordListStats stats;
+    MappedFile source; // Set when base points into a mapped file
+    uint16_t *pairs;   // Letter bigrams of every word, back to back
+    int *pairStarts;   // First bigram of each word, plus one past the last
+} WordList;
+
+// Structure to hold the header of a .idx word index sidecar
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;     // The index is only used if the word file
+    int64_t sourceModified;  // still has this size and modification time
+    uint32_t wordCount;
+    WordListStats stats;
+} WordIndexHeader;
+
+// Structure to hold every word list, loaded once at startup
+typedef struct {
+    char *arena; // Contents of all word files, back to back
+    size_t arenaUsed;
+    size_t arenaCapacity;
+    WordList lists[DIFFICULTY_COUNT];
+} WordStore;
+
+// Structure to hold the header at the start of the binary user store
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize; // Size of one UserRecord
+    uint32_t reserved;
+} UserStoreHeader;
+
+// Structure to hold one user as stored on disk
+// Every user has a slot with two copies; an update overwrites the older
+// copy, so a torn write can never damage the last good version
+typedef struct {
+    uint32_t checksum; // FNV-1a of everything after this field
+    uint32_t sequence; // Higher is newer; 0 marks an unused copy
+    char name[MAX_NAME_LEN];
+    char padding[2];
+    float bestWPM;
+    float bestAccuracy;
+    int32_t testsCompleted;
+    int32_t enduranceHighScore;
+    float averageAccuracy;
+    int32_t totalCharsTyped;
+    int32_t totalCorrectChars;
+} UserRecord;
+
+// Structure to hold the open binary user store
+typedef struct {
+    #ifdef _WIN32
+    HANDLE file;
+    #else
+    int fd;
+    #endif
+    int open;
+    int slotCount;        // Slots present in the file
+    int *slots;           // Slot holding each user
+    uint32_t *sequences;  // Sequence of each user's newest copy
+    char *dirty;          // Users changed since their last write
+    User *saved;          // Each user as last queued, so a save only sends what changed
+} UserStore;
+
+// Structure to hold one finished test as stored in a history log
+typedef struct {
+    int64_t timestamp; // Seconds since the epoch
+    uint8_t mode;      // HISTORY_MODE_*
+    uint8_t difficulty;
+    uint16_t words;
+    float wpm;
+    float accuracy;
+    int32_t mistyped;
+    int32_t missed;
+    int32_t extra;
+    float duration;    // Seconds
+} HistoryRecord;
+
+// Structure to hold the totals of one day of tests
+typedef struct {
+    int32_t day;       // Days since the epoch (UTC)
+    uint32_t tests;
+    float wpmSum;
+    float accuracySum;
+} HistoryDay;
+
+// Structure to hold the summary block at the start of a history log
+// It is updated with every append, so the profile never reads the records
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;    // Records that follow the summary
+    uint32_t reserved;
+    float recentWpm[HISTORY_RECENT_SIZE];      // Ring indexed by count % size
+    float recentAccuracy[HISTORY_RECENT_SIZE];
+    HistoryDay days[HISTORY_DAYS];             // Indexed by day % HISTORY_DAYS
+} HistorySummary;
+
+// Structure to hold one block of an arena; its memory follows the header
+typedef struct ArenaBlock {
+    struct ArenaBlock *previous;
+    size_t capacity;
+    size_t used;
+} ArenaBlock;
+
+// Structure to hold a bump allocator that is reset between tests
+typedef struct {
+    ArenaBlock *current;
+    size_t blockSize;
+} Arena;
+
+// Structure to hold test text built word by word, with known lengths
+typedef struct {
+    Arena *arena;
+    char *text;       // Always null-terminated
+    int length;
+    int capacity;
+    int *wordStarts;  // Offset of the first character of every word
+    int wordCount;
+    int wordCapacity;
+} TextBuilder;
+
+// Structure to hold xoshiro256** generator state
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+// Structure to hold a seeded sampler drawing distinct word indexes
+// Only the swapped slots of a virtual Fisher-Yates permutation are stored,
+// in a small open-addressing table, so k draws cost O(k) for any list size
+typedef struct {
+    Rng rng;
+    uint64_t seed;   // Seed the sampler was started with, for replays
+    int population;  // Number of words being sampled from
+    int drawn;       // Draws made in the current pass over the population
+    int *slots;      // Permutation positions that have been swapped
+    int *values;     // Word index currently stored at each swapped slot
+    int used;
+    int capacity;    // Power of two, kept at least twice used
+} WordSampler;
+
+// Structure to hold a seeded sampler that favours words with weak bigrams
+// Word weights sit in a Fenwick tree, so a draw and a weight change are O(log n)
+typedef struct {
+    Rng rng;
+    double *weights; // Weight of each word when it is not held out
+    double *tree;    // Fenwick tree over the current weights, 1-based
+    double total;
+    int count;
+    int usable; // Words with a weight, the ones that can be drawn
+    int recent[ADAPTIVE_RECENT]; // Last picks, held out of the draw
+    int recentCount;
+} AdaptiveSampler;
+
+// Structure to hold one user's error and latency counts per key and per letter bigram
+// A counter is halved when it fills up, so old sessions fade out
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint16_t keyAttempts[SKILL_KEYS];
+    uint16_t keyErrors[SKILL_KEYS];
+    uint16_t keyTimed[SKILL_KEYS];    // Attempts with a latency of their own
+    uint32_t keyLatency[SKILL_KEYS];  // Milliseconds, summed over the timed attempts
+    uint16_t pairAttempts[SKILL_PAIRS];
+    uint16_t pairErrors[SKILL_PAIRS];
+    uint16_t pairTimed[SKILL_PAIRS];
+    uint32_t pairLatency[SKILL_PAIRS];
+} SkillTable;
+
+// Structure to hold one save handed to the persistence worker
+typedef struct {
+    int type;                // PERSIST_EVENT_*
+    char name[MAX_NAME_LEN]; // User a history record or skill table belongs to
+    int slot;                // Store slot of a user record
+    long long offset;        // Where in the store the user record goes
+    union {
+        UserRecord user;     // Counters hold what changed since the last save,
+                             // bests the user's bests; merged into the slot on disk
+        HistoryRecord history;
+        SkillTable *skills;  // Heap copy, freed by the worker
+    } data;
+} PersistEvent;
+
+#ifdef _WIN32
+typedef CONDITION_VARIABLE PersistCondition;
+#else
+typedef pthread_cond_t PersistCondition;
+#endif
+
+#ifdef _WIN32
+typedef HANDLE LockHandle;
+#else
+typedef int LockHandle;
+#endif
+
+// Structure to hold the persistence worker and the queue feeding it
+// The UI thread is the only producer and the worker the only consumer: head
+// is written only by the UI thread and tail only by the worker, so the ring
+// itself needs no lock; the mutex is only held to sleep and wake
+typedef struct {
+    PersistEvent events[PERSIST_QUEUE_SIZE];
+    volatile uint32_t head;   // Next event the UI thread fills
+    volatile uint32_t tail;   // Next event the worker takes; it moves once a batch is written
+    volatile uint32_t failed; // PERSIST_FAILED_* bits not yet reported
+    int running;              // The worker thread is up; otherwise saves are written inline
+    int policy;               // PERSIST_SYNC_*
+    UserStore *store;
+    // Owned by the worker once it runs; the UI thread's copies in store are
+    // only read to start it
+    uint32_t *sequences;      // Sequence of each slot's newest copy, indexed by slot
+    unsigned char *unsynced;  // Slot was written since the last fsync
+    int slotCapacity;
+    int unsyncedCount;
+    long long syncDue;        // When the batched policy syncs them, in ms
+    #ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    #else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    #endif
+    PersistCondition work;    // Signalled when events are queued
+    PersistCondition drained; // Signalled when the worker has written a batch
+} PersistQueue;
+
+// Structure to hold one user's place in a leaderboard ordering
+typedef struct {
+    float key; // Copy of the ranked stat, so searches stay in one array
+    int user;
+} RankEntry;
+
+// Structure to hold every user sorted best-first by one stat
+// Ties keep the earlier user first, like the old stable sort did
+typedef struct {
+    RankEntry *entries;
+    int count;
+} RankIndex;
+
+// Structure to hold the users' stats again, one array per stat, so a scan over
+// one stat for every user reads only that stat; names live in a single pool
+// Rows are written whenever a user's stats change, next to users[]
+typedef struct {
+    float *bestWPM;
+    float *bestAccuracy;
+    float *averageAccuracy;
+    float *enduranceHighScore; // As a float, like its rank key
+    int *testsCompleted;
+    int *nameOffsets;          // Where each user's name starts in names
+    char *names;               // Every name, NUL-terminated, in the order users were added
+    size_t namesLength;
+    size_t namesCapacity;
+} UserColumns;
+
+// Structure to hold one pass over a stat column: its range, total, and how many
+// values lie below a limit; min and max are only set once count is nonzero
+typedef struct {
+    float min;
+    float max;
+    double sum;
+    long long below;
+    int count;
+} ColumnScan;
+
+// Structure to hold the keystroke recording being written or replayed
+// A recording is a run of tests: varint seed, varint text length and the
+// text, then key batches of (varint microseconds since the previous batch,
+// varint key count, the keys), ended by a batch with no keys whose time is
+// when the test ended; an endurance stream has an empty text followed by
+// its varint difficulty and SKILL_PAIRS bytes of bigram weakness, and is
+// regenerated from those and the seed
+typedef struct {
+    FILE *record;          // Set by --record
+    MappedFile replay;     // Set by --replay; replay.data is NULL otherwise
+    size_t replayPos;
+    long long testStart;   // Monotonic time the current test started
+    long long lastMicros;  // Offset of the previous batch from testStart
+    long long replayedKeys;
+} KeyStream;
+
+// Structure to hold one racer's place in the race standings
+typedef struct {
+    int id;
+    int finished;
+    uint32_t pos;    // Characters typed
+    uint32_t errors; // Positions typed wrong
+    uint32_t stamp;  // Milliseconds from the racer's start to its last report
+} RaceStanding;
+
+// Structure to hold one readiness event reported by the poller
+typedef struct {
+    int token; // Racer id, or RACE_MAX_CLIENTS for the listening socket
+    int readable;
+    int writable;
+} RaceEvent;
+
+// Structure to hold the readiness poller the race relay waits on
+// epoll on Linux, kqueue on macOS and the BSDs, poll (WSAPoll on Windows) elsewhere
+typedef struct {
+    #if defined(RACE_POLL_EPOLL)
+    int fd;
+    struct epoll_event ready[RACE_EVENT_BATCH];
+    #elif defined(RACE_POLL_KQUEUE)
+    int fd;
+    struct kevent ready[RACE_EVENT_BATCH];
+    #else
+    RacePollFd *fds; // Watched sockets, packed
+    int *tokens;     // Token of each entry in fds
+    int *entryOf;    // Entry in fds of each token, -1 when not watched
+    int count;
+    int rotate;      // Entry the next scan for ready sockets starts at
+    #endif
+    RaceEvent events[RACE_EVENT_BATCH];
+} RacePoller;
+
+// Structure to hold one connection to the race relay; its slot is the racer's id
+typedef struct {
+    RaceSocket socket;       // RACE_INVALID_SOCKET when the slot is free
+    char name[MAX_NAME_LEN]; // Empty until the client has said hello
+    int racing;              // Typing in the current race
+    int finished;
+    uint32_t pos;            // Latest progress the client reported
+    uint32_t errors;
+    uint32_t stamp;
+    unsigned char inbox[RACE_MAX_PACKET]; // Start of a packet still arriving
+    int inboxUsed;
+    unsigned char *outbox;   // Bytes the socket has not taken yet
+    size_t outboxUsed;
+    size_t outboxCapacity;
+    int writeWatched;        // The poller is reporting writability
+    int flushQueued;         // On the relay's flush list
+    int leaving;             // Dropped, and the others have not been told yet
+} RaceConnection;
+
+// Structure to hold the race relay: a lobby, and at most one race at a time
+typedef struct {
+    RacePoller poller;
+    RaceSocket listener;
+    RaceConnection *clients;  // RACE_MAX_CLIENTS slots
+    int connected;            // Clients that have said hello
+    int hostId;               // Client allowed to start a race, -1 when nobody is connected
+    int racing;
+    int changed;              // Progress arrived since the standings were last sent
+    long long firstFinish;    // Monotonic time the first racer finished, 0 before
+    long long nextBroadcast;
+    RaceStanding *standings;  // Scratch for sorting the racers
+    int *flushList;           // Clients with queued output
+    int flushCount;
+    int *leaveList;           // Clients dropped since the others were last told
+    int leaveCount;
+} RaceServer;
+
+// Structure to hold a client's connection to a race relay and the race it is in
+typedef struct {
+    RaceSocket socket;
+    int connected;
+    int id;                       // Our racer id, -1 until welcomed
+    int hostId;
+    char (*names)[MAX_NAME_LEN];  // Racer names by id
+    unsigned char inbox[RACE_MAX_PACKET];
+    int inboxUsed;
+    unsigned char outbox[RACE_CLIENT_OUTBOX];
+    int outboxUsed;
+    int started;                  // A START packet has arrived
+    uint64_t seed;
+    int difficulty;               // Word list the host picked the text from
+    char text[RACE_MAX_TEXT + 1];
+    int textLength;
+    int textChars;                // Characters in the text, which positions count
+    int racers;                   // From the latest standings
+    int place;                    // Our place, 0 before the first standings
+    int over;                     // The final standings have arrived
+    int boardChanged;             // Standings arrived since they were last drawn
+    RaceStanding board[RACE_BOARD_SIZE];
+    int boardCount;
+    long long start;              // Monotonic time our typing started
+    long long nextSend;
+    int sentPos;                  // Progress in the last report
+    int sentErrors;
+} RaceClient;
+
+// Structure to hold application state
+typedef struct {
+    User *users;        // Grows as profiles are added
+    int userCount;
+    int userCapacity;
+    int *userIndex;     // Open-addressing hash of name -> user, -1 when empty
+    int userIndexCapacity;
+    int currentUserIndex;
+    WordStore words;
+    KeystrokeRing keystrokes;
+    GlyphTable glyphs; // Non-ASCII characters of the text being typed
+    uint64_t nextSeed; // Seed for the next generated test
+    uint64_t testSeed; // Seed of the text being typed, kept in recordings
+    KeyStream input;   // Keystroke recording and replay
+    Arena session;     // Test text and per-test buffers, reset for every test
+    UserStore store;
+    RankIndex ranks[RANK_METRIC_COUNT]; // Kept up to date as personal bests change
+    UserColumns columns;                // Stats of users[] by column, for scans over every user
+    SkillTable skills;                  // Current user's per-key and per-bigram counters
+    int ranked;                         // Set once buildRankIndexes has run
+    RaceClient *race;                   // Set while typing in a race
+    PersistQueue persist;               // Saves written by the persistence worker
+    char raceAddress[RACE_ADDRESS_LEN]; // Race server used last, offered as the default
+    char textFile[TEXT_PATH_LEN];       // Text mode file used last, offered as the default
+    #ifdef _WIN32
+    HANDLE hConsole;
+    #endif
+} AppState;
+
+// Structure to hold what sets one game mode apart; every mode is one static const
+// entry, so what it reads in the keystroke loop is a compile-time constant
+typedef struct {
+    const char *name;            // Main menu entry
+    void (*run)(AppState *state);
+    int historyMode;             // HISTORY_MODE_* its tests are logged as
+    int wordSource;              // MODE_WORDS_*
+    int minWords;                // Words the player can ask for in one round
+    int maxWords;
+    float accuracyThreshold;     // A run ends below these over the last ENDURANCE_WINDOW_KEYS characters
+    float wpmThreshold;
+    unsigned features;           // MODE_FEATURE_* its typingTest is built with
+    unsigned scoring;            // MODE_SCORE_*
+} GameMode;
+
+// Structure to hold the inputs of the benchmark being run
+typedef struct {
+    AppState *state;
+    int size;          // Problem size, reported with the result
+    Rng rng;
+    char *target;      // Text for the scoring and rendering benchmarks
+    char *typed;
+    TypingView view;
+    TextLayout layout; // Wrapping of target, in the session arena
+    int pos;
+    double checksum;   // Results are summed here so they cannot be optimised away
+    char fileName[64]; // Word list for the loading benchmarks
+} BenchContext;
+
+typedef void (*BenchOperation)(BenchContext *context);
+
+// Structure to hold the totals of a --report, one copy per worker thread
+typedef struct {
+    long long users; // Users with a readable history log
+    long long modeTests[HISTORY_MODE_TEXT + 1];
+    long long tests[DIFFICULTY_COUNT];
+    double accuracySum[DIFFICULTY_COUNT];
+    double wpmSum[DIFFICULTY_COUNT];
+    long long mistyped[DIFFICULTY_COUNT];
+    long long missed[DIFFICULTY_COUNT];
+    long long extra[DIFFICULTY_COUNT];
+    long long wpmHistogram[DIFFICULTY_COUNT][REPORT_WPM_BUCKETS];
+    uint64_t pairAttempts[SKILL_PAIRS];
+    uint64_t pairErrors[SKILL_PAIRS];
+} ReportTotals;
+
+// Structure to hold one report worker; users are taken from a shared counter
+typedef struct {
+    const AppState *state;
+    volatile uint32_t *nextUser;
+    ReportTotals totals;
+    int started;
+    #ifdef _WIN32
+    HANDLE thread;
+    #else
+    pthread_t thread;
+    #endif
+} ReportWorker;
+
+#ifdef LOWKEY_TRACE
+// Structure to hold one recorded span, or a counter sample when duration is -1
+typedef struct {
+    const char *name;   // A string literal, compared by address
+    long long start;    // monotonicNanos
+    long long duration; // Nanoseconds
+    long long value;    // Shown as the event's argument
+} TraceEvent;
+
+// Structure to hold the events of one thread; only that thread writes to it
+typedef struct {
+    TraceEvent events[TRACE_EVENTS];
+    int count;
+    long long dropped;  // Events after the buffer filled
+    long long keys;     // Keystrokes processed so far, for the counter track
+    int thread;         // Thread id in the trace
+} TraceBuffer;
+
+// Every thread's buffer, registered on its first event and exported at exit
+TraceBuffer *traceBuffers[TRACE_MAX_THREADS];
+volatile uint32_t traceThreadCount;
+long long traceOrigin;
+long long traceInputStamp; // Oldest keys not yet on screen; the UI thread only
+TRACE_THREAD_LOCAL TraceBuffer *traceLocal;
+TRACE_THREAD_LOCAL int traceRefused; // More threads than TRACE_MAX_THREADS
+#endif
+
+// All terminal output is collected here and written out by frameFlush
+FrameBuffer frame;
+
+// Terminal state restored on exit, ESC or a fatal signal
+TerminalSession terminal;
+
+// Compare kernel picked for this CPU by initMatchKernel
+uint64_t (*matchBlock)(const char *a, const char *b, int length);
+
+// ASCII scan kernel picked alongside it
+int (*asciiPrefix)(const char *text, int length);
+
+// Stat column scan kernel, also picked alongside it
+void (*scanColumn)(const float *values, int count, float limit, ColumnScan *scan);
+
+// Set by Ctrl+C to stop the race server
+volatile sig_atomic_t raceStopRequested;
+
+// Function Prototypes
+void print_ascii_art(const char *filename, AppState *state);
+void setColour(int colour, AppState *state);
+void loadUsersFromFile(AppState *state);
+void saveUsersToFile(AppState *state);
+int openUserStore(AppState *state);
+int createUserStore(AppState *state);
+void closeUserStore(UserStore *store);
+void queueUserRecord(AppState *state, int index);
+int writeUserRecord(PersistQueue *queue, int slot, UserRecord *record);
+int appendUserSlot(AppState *state, int index);
+const UserRecord *newestCopy(const UserRecord copies[2]);
+void copyRecordToUser(const UserRecord *record, User *user);
+void mergeUserDelta(UserRecord *into, const UserRecord *delta);
+void markUserDirty(AppState *state, int index);
+void saveDirtyUsers(AppState *state);
+uint32_t recordChecksum(const UserRecord *record);
+int storeReadAt(UserStore *store, long long offset, void *data, size_t length);
+int storeWriteAt(UserStore *store, long long offset, const void *data, size_t length);
+int storeSync(UserStore *store);
+long long storeSize(UserStore *store);
+int lockFileRange(LockHandle file, long long offset, long long length, int lock);
+int startPersistence(AppState *state);
+void stopPersistence(AppState *state);
+void persistPush(PersistQueue *queue, const PersistEvent *event);
+void persistFlush(PersistQueue *queue);
+int persistBatch(PersistQueue *queue);
+PersistEvent *persistLaterEvent(PersistQueue *queue, uint32_t index, uint32_t head);
+int persistSync(PersistQueue *queue);
+int persistReserveSlot(PersistQueue *queue, int slot);
+void persistWorker(PersistQueue *queue);
+#ifdef _WIN32
+DWORD WINAPI persistThread(LPVOID argument);
+#else
+void *persistThread(void *argument);
+#endif
+void persistLock(PersistQueue *queue);
+void persistUnlock(PersistQueue *queue);
+void persistWait(PersistQueue *queue, PersistCondition *condition, long long ms);
+void persistSignal(PersistCondition *condition);
+uint32_t persistLoad(volatile uint32_t *value);
+void persistPublish(volatile uint32_t *value, uint32_t next);
+void persistSetFailed(PersistQueue *queue, uint32_t bits);
+void reportPersistErrors(AppState *state);
+int findUserIndex(char *username, AppState *state);
+int addUser(AppState *state, const char *username);
+int reserveUsers(AppState *state, int capacity);
+int reserveUserColumns(UserColumns *columns, int capacity);
+int appendUserName(UserColumns *columns, const char *name);
+void storeUserColumns(AppState *state, int index);
+const char *columnName(const UserColumns *columns, int index);
+const float *rankColumn(const UserColumns *columns, int metric);
+void clearUsers(AppState *state);
+void freeUsers(AppState *state);
+uint32_t hashName(const char *name);
+const char *parseUserField(const char *p, const char *end, double *value);
+void showMenu(void);
+int chooseDifficulty(const GameMode *mode, AppState *state);
+int chooseWordCount(const GameMode *mode, const char *round);
+void enduranceMode(AppState *state);
+int enduranceStream(AppState *state, int difficulty, const unsigned char *weakness, uint64_t seed,
+                    TypingResult *result);
+void streamAppendWord(StreamText *stream, const char *word, int length);
+void fillStream(StreamText *stream, long long currentLine, const WordList *words, AdaptiveSampler *sampler);
+void streamLine(const StreamText *stream, long long line, long long *start, long long *end);
+void renderStreamWindow(TypingView *view, const StreamText *stream, long long currentLine,
+                        AppState *state);
+void renderStreamStatus(TypingView *view, const EnduranceWindow *window, int words, long long now,
+                        long long start, AppState *state);
+void pushEnduranceKey(EnduranceWindow *window, long long stamp, int correct);
+void enduranceWindowStats(const EnduranceWindow *window, long long now, float *accuracy, float *wpm);
+void rawSpeedMode(AppState *state);
+void raceMode(AppState *state);
+int raceLobby(RaceClient *client, AppState *state);
+int raceHostStart(RaceClient *client, AppState *state);
+int raceTextValid(const char *text, int length);
+void raceResults(RaceClient *client, AppState *state);
+void textMode(AppState *state);
+int openTextSource(const char *fileName, TextSource *source);
+void closeTextSource(TextSource *source);
+int textLineAt(const TextSource *source, size_t offset);
+int appendSnippet(TextBuilder *builder, const char *data, size_t *offset, size_t end);
+uint64_t buildRandomText(AppState *state, const WordList *words, int count, TextBuilder *text);
+int formatRaceLine(const RaceClient *client, char *buffer, int size);
+void renderRaceLine(TypingView *view, RaceClient *client, AppState *state);
+int raceNetInit(void);
+void raceCloseSocket(RaceSocket sock);
+int raceSetNonBlocking(RaceSocket sock);
+int raceWouldBlock(void);
+void racePut16(unsigned char *p, uint32_t value);
+void racePut32(unsigned char *p, uint32_t value);
+void racePut64(unsigned char *p, uint64_t value);
+uint32_t raceGet16(const unsigned char *p);
+uint32_t raceGet32(const unsigned char *p);
+uint64_t raceGet64(const unsigned char *p);
+int raceConnect(RaceClient *client, const char *address, const char *name);
+void raceDisconnect(RaceClient *client);
+int raceSend(RaceClient *client, int type, const unsigned char *payload, int length);
+int raceFlush(RaceClient *client);
+int racePoll(RaceClient *client, int announce);
+void raceClientPacket(RaceClient *client, int type, const unsigned char *payload, int length,
+                      int announce);
+void raceProgress(RaceClient *client, int pos, int errors, long long now, int finished);
+int compareStandings(const void *a, const void *b);
+int pollerOpen(RacePoller *poller);
+int pollerAdd(RacePoller *poller, RaceSocket sock, int token);
+int pollerWatchWrite(RacePoller *poller, RaceSocket sock, int token, int enable);
+void pollerRemove(RacePoller *poller, RaceSocket sock, int token);
+int pollerWait(RacePoller *poller, int timeoutMs);
+void pollerClose(RacePoller *poller);
+void raceStopHandler(int sig);
+int runRaceServer(const char *port);
+int openRaceListener(RaceServer *server, const char *port);
+void serverAccept(RaceServer *server);
+void serverRead(RaceServer *server, int id);
+void serverPacket(RaceServer *server, int id, int type, const unsigned char *payload, int length);
+void serverQueue(RaceServer *server, int id, int type, const unsigned char *payload, int length);
+void serverBroadcast(RaceServer *server, int type, const unsigned char *payload, int length);
+void serverFlush(RaceServer *server);
+void serverDrop(RaceServer *server, int id);
+void serverAnnounceLeaves(RaceServer *server);
+void serverStandings(RaceServer *server, long long now);
+void showLeaderboard(AppState *state);
+float rankKey(const User *user, int metric);
+int rankBefore(const RankEntry *a, const RankEntry *b);
+int compareRankEntries(const void *a, const void *b);
+int rankPosition(const RankIndex *rank, float key, int user);
+int buildRankIndexes(AppState *state);
+void updateUserRanks(AppState *state, int index, const User *before);
+int userRank(AppState *state, int metric, int index);
+void showProfile(AppState *state);
+void userFileName(const char *username, const char *extension, char *buffer, size_t size);
+void historyFileName(const char *username, char *buffer, size_t size);
+void makeHistoryDir(void);
+int readHistorySummary(const char *username, HistorySummary *summary);
+int appendHistory(AppState *state, const TypingResult *result, int mode, int difficulty);
+int writeHistoryRecord(const char *username, const HistoryRecord *record);
+int recentAverages(const HistorySummary *summary, int window, float *wpm, float *accuracy);
+int dailyAverages(const HistorySummary *summary, int32_t today, float *wpm, float *accuracy);
+int runReport(AppState *state, const char *fileName);
+void reportWorker(ReportWorker *worker);
+#ifdef _WIN32
+DWORD WINAPI reportThread(LPVOID argument);
+#else
+void *reportThread(void *argument);
+#endif
+int reportThreadCount(void);
+void reportUser(const User *user, ReportTotals *totals);
+void historyToResult(const HistoryRecord *record, TypingResult *result);
+void addReportResult(ReportTotals *totals, const TypingResult *result, int mode, int difficulty);
+void mergeReportTotals(ReportTotals *into, const ReportTotals *from);
+int mostMissedPairs(const ReportTotals *totals, int *pairs, int count);
+void writeReportCsv(FILE *out, const ReportTotals *totals);
+void writeReportJson(FILE *out, const ReportTotals *totals);
+int loadWordsFromFile(char *filename, WordList *list, WordStore *store);
+void loadWordStore(AppState *state);
+void freeWordStore(WordStore *store);
+const char *getWord(const WordList *list, int index, int *length);
+int mapFile(const char *filename, MappedFile *map);
+void unmapFile(MappedFile *map);
+int reserveWordEntries(WordList *list, int capacity);
+int indexWords(const char *data, size_t start, size_t end, WordList *list);
+int loadMappedWords(char *filename, WordList *list);
+int readWordIndex(const char *indexName, const struct stat *source, WordList *list);
+void writeWordIndex(const char *indexName, const struct stat *source, WordList *list);
+uint64_t splitMix64(uint64_t *state);
+void seedRng(Rng *rng, uint64_t seed);
+uint64_t rngNext(Rng *rng);
+uint32_t rngBounded(Rng *rng, uint32_t bound);
+void initWordSampler(WordSampler *sampler, uint64_t seed);
+void beginSample(WordSampler *sampler, int population);
+int nextSample(WordSampler *sampler);
+int samplerSlot(WordSampler *sampler, int position, int insert);
+void freeWordSampler(WordSampler *sampler);
+int letterIndex(int ch);
+void countSkill(uint16_t *attempts, uint16_t *errors, uint16_t *timed, uint32_t *latency,
+                int correct, uint32_t millis);
+void recordSkill(SkillTable *skills, int previous, int target, int correct, long long gap);
+void skillWeakness(const SkillTable *skills, unsigned char *weakness);
+void skillFileName(const char *username, char *buffer, size_t size);
+void loadSkills(AppState *state);
+int saveSkills(AppState *state);
+int writeSkillFile(const char *username, const SkillTable *skills);
+int indexWordPairs(WordList *list);
+void adjustAdaptiveWeight(AdaptiveSampler *sampler, int index, double delta);
+int initAdaptiveSampler(AdaptiveSampler *sampler, Arena *arena, const WordList *list,
+                        const unsigned char *weakness, uint64_t seed);
+int nextAdaptiveWord(AdaptiveSampler *sampler);
+uint64_t takeTestSeed(AppState *state);
+void initArena(Arena *arena, size_t blockSize);
+void *arenaAlloc(Arena *arena, size_t size);
+void *arenaResize(Arena *arena, void *block, size_t oldSize, size_t newSize);
+void resetArena(Arena *arena);
+void freeArena(Arena *arena);
+void initTextBuilder(TextBuilder *builder, Arena *arena);
+int appendWord(TextBuilder *builder, const char *word, int length);
+int reserveText(TextBuilder *builder, int extra);
+int markWords(TextBuilder *builder, int from);
+int appendText(TextBuilder *builder, const char *text, int length);
+void processTypingResults(const GameMode *mode, TypingResult results[], int count, AppState *state);
+void clearScreen(void);
+MODE_INLINE int typingTest(const GameMode *mode, TextBuilder *target, TypingResult *result, AppState *state);
+int getValidIntInput(int min, int max);
+int getch(void);
+void initializeAppState(AppState *state);
+int getDifficulty(User user);
+float calculateAccuracy(char *target, char *typed, int *mistyped, int *missed, int *extra);
+int wordEditDistance(const char *target, int targetLength, const char *typed, int typedLength);
+void alignWord(const char *target, int targetLength, const char *typed, int typedLength,
+               AlignmentCounts *counts);
+void alignText(const char *target, int targetLength, const char *typed, int typedLength,
+               AlignmentCounts *counts);
+int nextWord(const char *text, int length, int from, int *start, int *end);
+int pairCost(const char *target, int targetLength, const char *typed, int typedLength);
+int getConsoleWidth();
+int getConsoleHeight();
+int fillIndentation(const char *text, int length, int pos, char *typed);
+void initTypingView(TypingView *view);
+void setViewColour(TypingView *view, int colour, AppState *state);
+void moveViewCursor(TypingView *view, int row, int col);
+void renderTyped(TypingView *view, const char *target, const char *typed, int from, int to, int end,
+                 AppState *state);
+void renderTypedWide(TypingView *view, const char *target, const char *typed, int from, int to, int end,
+                     AppState *state);
+int utf8SequenceLength(unsigned char lead);
+int decodeUtf8(const char *data, size_t available, uint32_t *codepoint);
+int encodeUtf8(uint32_t codepoint, char *out);
+int feedUtf8(Utf8Pending *pending, unsigned char byte, uint32_t *codepoint);
+int codepointWidth(uint32_t codepoint);
+void resetGlyphs(GlyphTable *glyphs);
+int glyphCode(GlyphTable *glyphs, uint32_t codepoint, int add);
+int transcodeText(GlyphTable *glyphs, const char *text, int length, char *out, int *positions);
+int layoutText(TextLayout *layout, Arena *arena, const char *text, int length, int width,
+               const GlyphTable *glyphs);
+int layoutWideText(TextLayout *layout, Arena *arena, const char *text, int length, int columns,
+                   const GlyphTable *glyphs);
+int layoutColumn(const TextLayout *layout, int pos);
+void layoutPosition(const TextLayout *layout, int pos, int *row, int *col);
+void drawLayout(TypingView *view, const TextLayout *layout, const char *text, const char *typed, int pos,
+                AppState *state);
+void renderLayoutTyped(TypingView *view, const TextLayout *layout, const char *target, const char *typed,
+                       int from, int to, int end, AppState *state);
+void drawTypingScreen(TypingView *view, const TextLayout *layout, const char *text, const char *typed,
+                      int pos, AppState *state);
+void renderHud(TypingView *view, const TypingHud *hud, const KeystrokeRing *ring, long long now,
+               AppState *state);
+uint64_t matchBlockScalar(const char *a, const char *b, int length);
+#ifdef MATCH_KERNEL_SSE2
+uint64_t matchBlockSse2(const char *a, const char *b, int length);
+#endif
+#ifdef MATCH_KERNEL_AVX2
+uint64_t matchBlockAvx2(const char *a, const char *b, int length);
+#endif
+#ifdef MATCH_KERNEL_NEON
+uint64_t matchBlockNeon(const char *a, const char *b, int length);
+#endif
+int asciiPrefixScalar(const char *text, int length);
+#ifdef MATCH_KERNEL_SSE2
+int asciiPrefixSse2(const char *text, int length);
+#endif
+#ifdef MATCH_KERNEL_AVX2
+int asciiPrefixAvx2(const char *text, int length);
+#endif
+#ifdef MATCH_KERNEL_NEON
+int asciiPrefixNeon(const char *text, int length);
+#endif
+void scanColumnScalar(const float *values, int count, float limit, ColumnScan *scan);
+#ifdef MATCH_KERNEL_SSE2
+void scanColumnSse2(const float *values, int count, float limit, ColumnScan *scan);
+#endif
+#ifdef MATCH_KERNEL_AVX2
+void scanColumnAvx2(const float *values, int count, float limit, ColumnScan *scan);
+#endif
+#ifdef MATCH_KERNEL_NEON
+void scanColumnNeon(const float *values, int count, float limit, ColumnScan *scan);
+#endif
+void mergeColumnScan(ColumnScan *scan, const ColumnScan *part);
+void initMatchKernel(void);
+int popcount64(uint64_t value);
+int lowestBit64(uint64_t value);
+int countMatches(const char *a, const char *b, int length);
+void initFrameBuffer(void);
+void frameAppend(const char *data, size_t length);
+void framePutChar(char ch);
+void frameAppendVisible(const char *data, size_t length);
+void frameAppendGlyphs(const GlyphTable *glyphs, const char *data, size_t length);
+void framePrintf(const char *format, ...);
+void frameFlush(void);
+void frameWrite(const char *data, size_t length);
+void terminalEnterRaw(void);
+void terminalRestore(void);
+int terminalReadKeys(unsigned char *keys, int capacity, int timeoutMs);
+long long monotonicNanos(void);
+#ifdef LOWKEY_TRACE
+void initTrace(void);
+TraceBuffer *traceBuffer(void);
+void traceRecord(const char *name, long long start, long long duration, long long value);
+void traceSpan(const char *name, long long start, long long value);
+void traceKeys(int count);
+void traceDisplayed(void);
+void traceExport(void);
+#endif
+void recordKeystroke(KeystrokeRing *ring, long long timestamp);
+long long keystrokeGap(const KeystrokeRing *ring, long long timestamp);
+void computeLatencyPercentiles(KeystrokeRing *ring, TypingResult *result);
+int compareLongLong(const void *a, const void *b);
+void writeVarint(FILE *file, uint64_t value);
+int readVarint(KeyStream *stream, uint64_t *value);
+int openKeyRecording(KeyStream *stream, const char *fileName);
+int openKeyReplay(KeyStream *stream, const char *fileName);
+void closeKeyStream(KeyStream *stream);
+void beginKeyStream(KeyStream *stream, uint64_t seed, const char *text, int length, long long start);
+int readTestKeys(KeyStream *stream, unsigned char *keys, int capacity, int timeoutMs, long long *stamp);
+void endKeyStream(KeyStream *stream, long long end);
+int nextReplayTest(KeyStream *stream, uint64_t *seed, TextBuilder *text);
+int replayRecording(AppState *state, const char *fileName);
+void runBenchmark(FILE *out, const char *name, BenchOperation operation, BenchContext *context);
+void benchAccuracy(BenchContext *context);
+void benchCountMatches(BenchContext *context);
+void benchRender(BenchContext *context);
+void benchLayout(BenchContext *context);
+void benchLoadWords(BenchContext *context);
+void benchMapWords(BenchContext *context);
+void benchScanWords(BenchContext *context);
+void benchSaveUsers(BenchContext *context);
+void benchLoadUsers(BenchContext *context);
+void benchOpenUserStore(BenchContext *context);
+void benchBuildRanks(BenchContext *context);
+void benchUpdateRank(BenchContext *context);
+void benchScanRows(BenchContext *context);
+void benchScanColumns(BenchContext *context);
+void fillBenchUsers(AppState *state, int count, Rng *rng);
+int writeBenchWords(const char *fileName, int count, Rng *rng);
+int runBenchmarks(AppState *state);
+
+// The game modes, in main menu order; a new mode is a new entry and its run function
+static const GameMode enduranceGame = {
+    "Endurance Mode", enduranceMode, HISTORY_MODE_ENDURANCE, MODE_WORDS_PROFILE, 0, 0,
+    85.0f, 30.0f,
+    0, // Types through enduranceStream, not typingTest
+    MODE_SCORE_WORDS
+};
+static const GameMode rawSpeedGame = {
+    "Raw Speed Mode", rawSpeedMode, HISTORY_MODE_RAW_SPEED, MODE_WORDS_CHOSEN, 15, 50,
+    0.0f, 0.0f,
+    MODE_FEATURE_HUD | MODE_FEATURE_RECORD,
+    MODE_SCORE_BEST
+};
+static const GameMode raceGame = {
+    "Race Mode", raceMode, HISTORY_MODE_RACE, MODE_WORDS_CHOSEN, 15, 50, // Chosen by the host
+    0.0f, 0.0f,
+    MODE_FEATURE_HUD | MODE_FEATURE_RACE | MODE_FEATURE_RECORD,
+    MODE_SCORE_BEST
+};
+static const GameMode textGame = {
+    "Text Mode", textMode, HISTORY_MODE_TEXT, MODE_WORDS_FILE, 0, 0,
+    0.0f, 0.0f,
+    MODE_FEATURE_HUD | MODE_FEATURE_LINES | MODE_FEATURE_RECORD,
+    MODE_SCORE_BEST
+};
+static const GameMode *const gameModes[] = { &enduranceGame, &rawSpeedGame, &raceGame, &textGame };
+#define GAME_MODE_COUNT ((int)(sizeof(gameModes) / sizeof(gameModes[0])))
+
+// Replays run every recorded test, whatever its mode, with what any of them could need
+static const GameMode replayGame = {
+    "Replay", NULL, 0, 0, 0, 0, 0.0f, 0.0f,
+    MODE_FEATURE_HUD | MODE_FEATURE_LINES | MODE_FEATURE_RECORD,
+    0
+};
+
+const char *const difficultyNames[DIFFICULTY_COUNT] = { "LIGHT", "MEDIUM", "HARD" };
+
+// Hand out the seed for a new test; printing it lets the test be replayed
+uint64_t takeTestSeed(AppState *state) {
+    state->testSeed = state->nextSeed;
+    return state->nextSeed++;
+}
+
+// Cross-platform getch() function
+int getch(void) {
+    frameFlush(); // Show everything before waiting for a key
+    unsigned char key;
+    int wasActive = terminal.active;
+
+    terminalEnterRaw();
+    int count = terminalReadKeys(&key, 1, -1);
+    // The rest of a multi-byte character is read too, so it cannot reach the next test as typing
+    if (count == 1) {
+        for (int more = utf8SequenceLength(key) - 1; more > 0; more--) {
+            unsigned char next;
+            if (terminalReadKeys(&next, 1, 50) != 1) {
+                break;
+            }
+        }
+    }
+    if (!wasActive) {
+        terminalRestore();
+    }
+    return (count == 1) ? key : EOF;
+}
+
+#ifndef _WIN32
+// Put the terminal back before the process dies from a signal
+void terminalSignalHandler(int sig) {
+    if (terminal.active) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &terminal.saved);
+        terminal.active = 0;
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+#endif
+
+// Switch the terminal to unbuffered, unechoed input until terminalRestore
+void terminalEnterRaw(void) {
+    if (terminal.active) {
+        return;
+    }
+    if (!terminal.handlersReady) {
+        atexit(terminalRestore);
+        #ifndef _WIN32
+        signal(SIGINT, terminalSignalHandler);
+        signal(SIGTERM, terminalSignalHandler);
+        signal(SIGHUP, terminalSignalHandler);
+        #endif
+        terminal.handlersReady = 1;
+    }
+
+    #ifdef _WIN32
+        terminal.input = GetStdHandle(STD_INPUT_HANDLE);
+        if (GetConsoleMode(terminal.input, &terminal.savedMode)) {
+            SetConsoleMode(terminal.input,
+                           terminal.savedMode & ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT));
+        }
+    #else
+        if (tcgetattr(STDIN_FILENO, &terminal.saved) != 0) {
+            terminal.active = 1; // Not a terminal; reads still work
+            return;
+        }
+        struct termios raw = terminal.saved;
+        raw.c_lflag &= ~(ICANON | ECHO); // Keep ISIG so Ctrl+C still restores
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    #endif
+    terminal.active = 1;
+}
+
+// Restore the settings saved by terminalEnterRaw
+void terminalRestore(void) {
+    if (!terminal.active) {
+        return;
+    }
+    #ifdef _WIN32
+        SetConsoleMode(terminal.input, terminal.savedMode);
+    #else
+        tcsetattr(STDIN_FILENO, TCSANOW, &terminal.saved);
+    #endif
+    terminal.active = 0;
+}
+
+// Wait up to timeoutMs (-1 = forever) and drain every pending key at once
+// Returns the number of keys read, 0 on timeout or -1 at end of input
+int terminalReadKeys(unsigned char *keys, int capacity, int timeoutMs) {
+    #ifdef _WIN32
+        DWORD wait = (timeoutMs < 0) ? INFINITE : (DWORD)timeoutMs;
+        int count = 0;
+        do {
+            if (!_kbhit() &&
+                WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), wait) != WAIT_OBJECT_0) {
+                return 0;
+            }
+            while (count < capacity && _kbhit()) {
+                int ch = _getch();
+                if (ch == 0 || ch == 0xE0) {
+                    _getch(); // Drop arrow and function keys
+                    continue;
+                }
+                keys[count++] = (unsigned char)ch;
+            }
+            // Focus and mouse events wake the wait without producing keys
+        } while (count == 0 && timeoutMs < 0);
+        return count;
+    #else
+        struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+        int ready;
+        do {
+            ready = poll(&input, 1, timeoutMs);
+        } while (ready < 0 && errno == EINTR);
+        if (ready <= 0) {
+            return 0;
+        }
+
+        ssize_t count;
+        do {
+            count = read(STDIN_FILENO, keys, capacity);
+        } while (count < 0 && errno == EINTR);
+        return (count > 0) ? (int)count : -1;
+    #endif
+}
+
+// Initialize application state
+void initializeAppState(AppState *state) {
+    state->users = NULL;
+    state->userCount = 0;
+    state->userCapacity = 0;
+    state->userIndex = NULL;
+    state->userIndexCapacity = 0;
+    memset(&state->store, 0, sizeof(state->store));
+    memset(state->ranks, 0, sizeof(state->ranks));
+    state->ranked = 0;
+    state->currentUserIndex = -1;
+    memset(&state->words, 0, sizeof(state->words));
+    state->nextSeed = (uint64_t)time(NULL) ^ (uint64_t)monotonicNanos();
+    state->testSeed = 0;
+    memset(&state->input, 0, sizeof(state->input));
+    memset(&state->skills, 0, sizeof(state->skills));
+    state->race = NULL;
+    memset(&state->persist, 0, sizeof(state->persist));
+    state->persist.policy = PERSIST_SYNC_BATCHED;
+    snprintf(state->raceAddress, sizeof(state->raceAddress), "localhost:%s", RACE_DEFAULT_PORT);
+    state->textFile[0] = '\0';
+    initArena(&state->session, ARENA_BLOCK_SIZE);
+    initMatchKernel();
+    #ifdef LOWKEY_TRACE
+    initTrace(); // Exported after the frame buffer's last flush
+    #endif
+    
+    #ifdef _WIN32
+    state->hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    #endif
+    initFrameBuffer();
+}
+
+// Set up the output buffer and make sure it is written out on exit
+void initFrameBuffer(void) {
+    frame.length = 0;
+    frame.ansi = 1;
+    #ifdef _WIN32
+        DWORD mode;
+        frame.output = GetStdHandle(STD_OUTPUT_HANDLE);
+        frame.isConsole = GetConsoleMode(frame.output, &mode);
+        // Windows 10+ consoles understand ANSI once VT processing is enabled
+        if (frame.isConsole &&
+            !SetConsoleMode(frame.output, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) {
+            frame.ansi = 0;
+        }
+    #endif
+    atexit(frameFlush);
+}
+
+// Append raw bytes to the frame, flushing first if they do not fit
+void frameAppend(const char *data, size_t length) {
+    if (frame.length + length > FRAME_BUFFER_SIZE) {
+        frameFlush();
+        if (length > FRAME_BUFFER_SIZE) {
+            frameWrite(data, length); // Too large to buffer at all
+            return;
+        }
+    }
+    memcpy(frame.data + frame.length, data, length);
+    frame.length += length;
+}
+
+// Append a single character to the frame
+void framePutChar(char ch) {
+    if (frame.length == FRAME_BUFFER_SIZE) {
+        frameFlush();
+    }
+    frame.data[frame.length++] = ch;
+}
+
+// Append text to the frame with its line breaks drawn as blank cells, so a
+// text line takes exactly one screen cell per character
+void frameAppendVisible(const char *data, size_t length) {
+    const char *newline;
+    while ((newline = memchr(data, '\n', length)) != NULL) {
+        frameAppend(data, newline - data);
+        framePutChar(' ');
+        length -= newline - data + 1;
+        data = newline + 1;
+    }
+    frameAppend(data, length);
+}
+
+// Append test text to the frame, writing each byte code as its UTF-8
+// character; a line break is drawn as a blank cell and a code that is not
+// in the table, such as GLYPH_UNKNOWN, as '?'
+void frameAppendGlyphs(const GlyphTable *glyphs, const char *data, size_t length) {
+    size_t run = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char byte = (unsigned char)data[i];
+        if (byte < 0x80 && byte != '\n') {
+            continue;
+        }
+        frameAppend(data + run, i - run);
+        run = i + 1;
+        if (byte == '\n') {
+            framePutChar(' ');
+        } else if (glyphs != NULL && byte - GLYPH_FIRST < glyphs->count) {
+            frameAppend(glyphs->utf8[byte - GLYPH_FIRST], glyphs->utf8Length[byte - GLYPH_FIRST]);
+        } else {
+            framePutChar('?');
+        }
+    }
+    frameAppend(data + run, length - run);
+}
+
+// printf into the frame buffer
+void framePrintf(const char *format, ...) {
+    size_t space = FRAME_BUFFER_SIZE - frame.length;
+    va_list args;
+
+    va_start(args, format);
+    int needed = vsnprintf(frame.data + frame.length, space, format, args);
+    va_end(args);
+    if (needed < 0) {
+        return;
+    }
+    if ((size_t)needed < space) {
+        frame.length += needed;
+        return;
+    }
+
+    // Did not fit in the space left, so format it again after a flush
+    frameFlush();
+    if (needed < FRAME_BUFFER_SIZE) {
+        va_start(args, format);
+        vsnprintf(frame.data, FRAME_BUFFER_SIZE, format, args);
+        va_end(args);
+        frame.length = needed;
+    } else {
+        char *large = malloc(needed + 1);
+        if (large == NULL) {
+            return;
+        }
+        va_start(args, format);
+        vsnprintf(large, needed + 1, format, args);
+        va_end(args);
+        frameWrite(large, needed);
+        free(large);
+    }
+}
+
+// Write out everything collected for this frame with a single call
+void frameFlush(void) {
+    if (frame.length > 0) {
+        TRACE_BEGIN(writeStart);
+        frameWrite(frame.data, frame.length);
+        TRACE_END("frame_write", writeStart, (long long)frame.length);
+        TRACE_DISPLAYED();
+        frame.length = 0;
+    }
+}
+
+// Write bytes straight to the terminal, retrying on partial writes
+void frameWrite(const char *data, size_t length) {
+    while (length > 0) {
+        #ifdef _WIN32
+            DWORD written = 0;
+            BOOL ok = frame.isConsole
+                ? WriteConsoleA(frame.output, data, (DWORD)length, &written, NULL)
+                : WriteFile(frame.output, data, (DWORD)length, &written, NULL);
+            if (!ok || written == 0) {
+                return;
+            }
+        #else
+            ssize_t written = write(STDOUT_FILENO, data, length);
+            if (written < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+                return;
+            }
+        #endif
+        data += written;
+        length -= written;
+    }
+}
+
+//Main Function
+int main(int argc, char *argv[]) {
+    static AppState state; // Holds the keystroke ring, too big for main's stack frame
+    initializeAppState(&state);
+
+    // Command line options
+    int exportUsers = 0;
+    int importUsers = 0;
+    const char *recordFile = NULL;
+    const char *replayFile = NULL;
+    int bench = 0;
+    const char *servePort = NULL;
+    const char *reportFile = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            state.nextSeed = strtoull(argv[++i], NULL, 10); // Replay a test
+        } else if (strcmp(argv[i], "--export-users") == 0) {
+            exportUsers = 1;
+        } else if (strcmp(argv[i], "--import-users") == 0) {
+            importUsers = 1;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordFile = argv[++i]; // Save every test's keystrokes
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayFile = argv[++i]; // Play a recording back with no keyboard
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportFile = argv[++i]; // Aggregate every user's history, CSV or .json
+        } else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i]; // When saved users are flushed to the disk
+            if (strcmp(policy, "immediate") == 0) {
+                state.persist.policy = PERSIST_SYNC_IMMEDIATE;
+            } else if (strcmp(policy, "batched") == 0) {
+                state.persist.policy = PERSIST_SYNC_BATCHED;
+            } else if (strcmp(policy, "exit") == 0) {
+                state.persist.policy = PERSIST_SYNC_ON_EXIT;
+            } else {
+                framePrintf("Error: --sync takes immediate, batched or exit.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            servePort = RACE_DEFAULT_PORT; // Run a race server instead of the game
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                servePort = argv[++i];
+            }
+        } else {
+            framePrintf("Usage: %s [--seed N] [--export-users] [--import-users]"
+                        " [--record FILE] [--replay FILE] [--bench] [--serve [PORT]]"
+                        " [--sync immediate|batched|exit] [--report FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (bench) {
+        int finished = runBenchmarks(&state);
+        freeUsers(&state);
+        freeArena(&state.session);
+        return finished ? 0 : 1;
+    }
+    if (servePort != NULL) {
+        int served = runRaceServer(servePort);
+        freeArena(&state.session);
+        return served ? 0 : 1;
+    }
+    if (replayFile != NULL) {
+        loadWordStore(&state); // Endurance streams are regenerated from the word lists
+        int replayed = replayRecording(&state, replayFile);
+        freeWordStore(&state.words);
+        freeArena(&state.session);
+        return replayed ? 0 : 1;
+    }
+    
+    char username[MAX_NAME_LEN];
+    if (importUsers) {
+        // Replace the binary store with the contents of users.txt
+        loadUsersFromFile(&state);
+        return createUserStore(&state) ? 0 : 1;
+    }
+    if (!openUserStore(&state)) {
+        return 1;
+    }
+    if (!buildRankIndexes(&state)) {
+        framePrintf("Error: Not enough memory for the leaderboard.\n");
+        closeUserStore(&state.store);
+        freeUsers(&state);
+        return 1;
+    }
+    if (exportUsers) {
+        saveUsersToFile(&state); // Write users.txt from the binary store
+        closeUserStore(&state.store);
+        return 0;
+    }
+    if (reportFile != NULL) {
+        int reported = runReport(&state, reportFile);
+        closeUserStore(&state.store);
+        freeUsers(&state);
+        freeArena(&state.session);
+        return reported ? 0 : 1;
+    }
+    if (recordFile != NULL && !openKeyRecording(&state.input, recordFile)) {
+        closeUserStore(&state.store);
+        freeUsers(&state);
+        return 1;
+    }
+    if (!startPersistence(&state)) {
+        framePrintf("Error: Not enough memory for the user store.\n");
+        closeUserStore(&state.store);
+        closeKeyStream(&state.input);
+        freeUsers(&state);
+        return 1;
+    }
+    loadWordStore(&state);
+
+    print_ascii_art("title.txt", &state);
+    framePrintf("Enter your username (no spaces): ");
+    
+    // Input validation for username
+    int validInput = 0;
+    do {
+        frameFlush();
+        if (scanf("%49s", username) != 1) {
+            while (getchar() != '\n'); // Clear input buffer
+            framePrintf("Invalid input. Please try again: ");
+        } else {
+            validInput = 1;
+        }
+    } while (!validInput);
+    
+    //Check for existing user
+    int index = findUserIndex(username, &state);
+    if (index == -1) {
+        framePrintf("New user detected. Creating profile for %s.\n", username);
+        index = addUser(&state, username);
+        if (index >= 0) {
+            state.currentUserIndex = index;
+            loadSkills(&state);
+            appendUserSlot(&state, state.currentUserIndex); // Without a slot the session is not saved
+        } else {
+            framePrintf("Error: Not enough memory for a new user.\n");
+            stopPersistence(&state);
+            closeUserStore(&state.store);
+            closeKeyStream(&state.input);
+            freeUsers(&state);
+            freeWordStore(&state.words);
+            freeArena(&state.session);
+            return 1;
+        }
+    } else { //Display User profile
+        state.currentUserIndex = index;
+        loadSkills(&state);
+        framePrintf("Welcome back, %s!\n", state.users[state.currentUserIndex].name);
+        framePrintf("Best WPM: %.2f | Best Accuracy: %.2f%% | Tests completed: %d\n",
+               state.users[state.currentUserIndex].bestWPM,
+               state.users[state.currentUserIndex].bestAccuracy,
+               state.users[state.currentUserIndex].testsCompleted);
+        
+        if (state.users[state.currentUserIndex].enduranceHighScore > 0) {
+            framePrintf("Endurance Mode High Score: %d words\n", 
+                   state.users[state.currentUserIndex].enduranceHighScore);
+        }
+    }
+    //Main menu operations
+    // The modes come first, then the leaderboard, the profile and exit
+    int exitChoice = GAME_MODE_COUNT + 3;
+    int choice;
+    do {
+        showMenu();
+        framePrintf("Enter your choice (1-%d): ", exitChoice);
+        choice = getValidIntInput(1, exitChoice);
+        
+        if (choice <= GAME_MODE_COUNT) {
+            gameModes[choice - 1]->run(&state);
+        } else if (choice == GAME_MODE_COUNT + 1) {
+            showLeaderboard(&state);
+        } else if (choice == GAME_MODE_COUNT + 2) {
+            showProfile(&state);
+        } else {
+            framePrintf("Saving user data and exiting. Goodbye!\n");
+            saveDirtyUsers(&state);
+        }
+    } while (choice != exitChoice);
+    
+    stopPersistence(&state); // Writes and syncs whatever is still queued
+    closeUserStore(&state.store);
+    closeKeyStream(&state.input);
+    freeUsers(&state);
+    freeWordStore(&state.words);
+    freeArena(&state.session);
+    return 0;
+}
+
+// Function to get valid integer input within a range
+int getValidIntInput(int min, int max) {
+    int value;
+    char buffer[100];
+    int valid = 0;
+
+    do {
+        frameFlush();
+        if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
+            framePrintf("Error reading input. Please try again: ");
+        } else {
+            // Remove newline if present
+            buffer[strcspn(buffer, "\n")] = 0;
+
+            // Check if input is empty
+            if (strlen(buffer) == 0) {
+                framePrintf("Please enter a number between %d and %d: ", min, max);
+            } else {
+                // Check if input contains only digits
+                int allDigits = 1;
+                for (int i = 0; buffer[i] != '\0' && allDigits; i++) {
+                    if (!isdigit((unsigned char)buffer[i])) {
+                        allDigits = 0;
+                        
+                    }
+                }
+                // Check if input is a valid number
+                if (!allDigits) {
+                    framePrintf("Invalid input. Please enter a number between %d and %d: ", min, max);
+                } else {
+                    value = atoi(buffer);
+                    if (value < min || value > max) {
+                        framePrintf("Number must be between %d and %d. Please try again: ", min, max);
+                    } else {
+                        valid = 1;
+                    }
+                }
+            }
+        }
+    } while (!valid);
+
+    return value;
+}
+// Function to set console text color
+void setColour(int colour, AppState *state) {
+    #ifdef _WIN32
+    if (!frame.ansi) {
+        // Legacy console: attributes apply to text already written
+        frameFlush();
+        SetConsoleTextAttribute(state->hConsole, colour);
+        return;
+    }
+    #else
+    (void)state;
+    #endif
+    // ANSI escape codes for colors
+    switch(colour) {
+        case GREEN:
+            frameAppend("\033[32m", 5); break;
+        case RED:
+            frameAppend("\033[31m", 5); break;
+        case YELLOW:
+            frameAppend("\033[33m", 5); break;
+        case CYAN:
+            frameAppend("\033[36m", 5); break;
+        default:
+            frameAppend("\033[0m", 4); break;
+    }
+}
+
+//User management functions
+// Parses the whole file in memory; lines need at least the first four fields
+void loadUsersFromFile(AppState *state) {
+    TRACE_BEGIN(loadStart);
+    FILE *fp = fopen(USERS_FILE, "rb");
+    if (fp == NULL) {
+        // File doesn't exist, create it
+        framePrintf("Users file not found. Creating new file.\n");
+        fp = fopen(USERS_FILE, "w");
+        if (fp == NULL) {
+            framePrintf("Error: Could not create users file.\n");
+            return;
+        }
+        fclose(fp);
+        return;
+    }
+    
+    clearUsers(state);
+    
+    // Read the file with one call
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = (size > 0) ? malloc(size) : NULL;
+    if (data == NULL) {
+        fclose(fp);
+        framePrintf("Loaded %d user profiles.\n", state->userCount);
+        return;
+    }
+    size = (long)fread(data, 1, size, fp);
+    fclose(fp);
+    
+    // Read user data from file
+    const char *p = data;
+    const char *end = data + size;
+    while (p < end) {
+        const char *lineEnd = memchr(p, '\n', end - p);
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+
+        // Name: the first whitespace-separated token
+        while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        char name[MAX_NAME_LEN];
+        int nameLength = 0;
+        while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') {
+            if (nameLength < MAX_NAME_LEN - 1) {
+                name[nameLength++] = *p;
+            }
+            p++;
+        }
+        name[nameLength] = '\0';
+
+        double fields[7] = {0};
+        int fieldCount = 0;
+        while (fieldCount < 7 && (p = parseUserField(p, lineEnd, &fields[fieldCount])) != NULL) {
+            fieldCount++;
+        }
+
+        // Check if line format matches what we expect (at least basic fields)
+        int index = (nameLength > 0 && fieldCount >= 3) ? findUserIndex(name, state) : -1;
+        if (nameLength > 0 && fieldCount >= 3 && index < 0) {
+            index = addUser(state, name);
+        }
+        if (index >= 0) {
+            User *user = &state->users[index];
+            user->bestWPM = (float)fields[0];
+            user->bestAccuracy = (float)fields[1];
+            user->testsCompleted = (int)fields[2];
+            user->enduranceHighScore = (int)fields[3];
+            user->averageAccuracy = (float)fields[4];
+            user->totalCharsTyped = (int)fields[5];
+            user->totalCorrectChars = (int)fields[6];
+                
+            // For backward compatibility, initialize new fields if not present
+            if (user->totalCharsTyped == 0 && user->testsCompleted > 0) {
+                // Estimate for older files
+                user->totalCharsTyped = 200 * user->testsCompleted;
+                user->totalCorrectChars = user->totalCharsTyped * (user->bestAccuracy / 100.0);
+                user->averageAccuracy = user->bestAccuracy * 0.9;
+            }
+        }
+        p = lineEnd + 1;
+    }
+    
+    free(data);
+    TRACE_END("load_users_text", loadStart, state->userCount);
+    framePrintf("Loaded %d user profiles.\n", state->userCount);
+}
+
+// Parse one number such as 52.99 or 38 from a users.txt line
+// Returns the position after it, or NULL when the line has no more numbers
+const char *parseUserField(const char *p, const char *end, double *value) {
+    static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                          1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p >= end || !((unsigned)(*p - '0') < 10 || *p == '.')) {
+        return NULL;
+    }
+
+    // Integer mantissa and one division, exact for the two decimals we write
+    // (plain comparisons: the ctype macros cost a call per character)
+    long long mantissa = 0;
+    int decimals = 0;
+    while (p < end && (unsigned)(*p - '0') < 10) {
+        mantissa = mantissa * 10 + (*p++ - '0');
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && (unsigned)(*p - '0') < 10) {
+            if (decimals < 15) {
+                mantissa = mantissa * 10 + (*p - '0');
+                decimals++;
+            }
+            p++;
+        }
+    }
+    *value = (negative ? -mantissa : mantissa) / powersOfTen[decimals];
+    return p;
+}
+
+// Save user data to file
+void saveUsersToFile(AppState *state) {
+    TRACE_BEGIN(saveStart);
+    FILE *fp = fopen(USERS_FILE, "w");
+    if (fp == NULL) {
+        framePrintf("Error: Could not open users file for writing.\n");
+        return;
+    }
+    
+    for (int i = 0; i < state->userCount; i++) {
+        fprintf(fp, "%s %.2f %.2f %d %d %.2f %d %d\n",
+                state->users[i].name,
+                state->users[i].bestWPM,
+                state->users[i].bestAccuracy,
+                state->users[i].testsCompleted,
+                state->users[i].enduranceHighScore,
+                state->users[i].averageAccuracy,
+                state->users[i].totalCharsTyped,
+                state->users[i].totalCorrectChars);
+    }
+    
+    fclose(fp);
+    TRACE_END("save_users_text", saveStart, state->userCount);
+    framePrintf("User data saved successfully.\n");
+}
+
+// Open the binary user store, importing users.txt the first time
+int openUserStore(AppState *state) {
+    UserStore *store = &state->store;
+    FILE *probe = fopen(USER_STORE_FILE, "rb");
+    if (probe == NULL) {
+        probe = fopen(USERS_FILE, "r");
+        if (probe != NULL) {
+            fclose(probe);
+            loadUsersFromFile(state);
+            framePrintf("Importing %d user profiles from %s.\n", state->userCount, USERS_FILE);
+        }
+        if (!createUserStore(state)) {
+            return 0;
+        }
+    } else {
+        fclose(probe);
+    }
+
+    #ifdef _WIN32
+        store->file = CreateFileA(USER_STORE_FILE, GENERIC_READ | GENERIC_WRITE,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (store->file == INVALID_HANDLE_VALUE) {
+            framePrintf("Error: Could not open %s.\n", USER_STORE_FILE);
+            return 0;
+        }
+    #else
+        store->fd = open(USER_STORE_FILE, O_RDWR);
+        if (store->fd < 0) {
+            framePrintf("Error: Could not open %s.\n", USER_STORE_FILE);
+            return 0;
+        }
+    #endif
+    store->open = 1;
+    long long size = storeSize(store);
+
+    UserStoreHeader header;
+    if (!storeReadAt(store, 0, &header, sizeof(header)) ||
+        memcmp(header.magic, USER_STORE_MAGIC, 4) != 0 ||
+        header.version != USER_STORE_VERSION ||
+        header.recordSize != sizeof(UserRecord)) {
+        framePrintf("Error: %s is not a user store of this version.\n", USER_STORE_FILE);
+        closeUserStore(store);
+        return 0;
+    }
+
+    // A slot cut short by a crash during an append is ignored
+    long long slotSize = 2 * (long long)sizeof(UserRecord);
+    store->slotCount = (int)((size - (long long)sizeof(header)) / slotSize);
+
+    // Every slot is read with a single call
+    clearUsers(state);
+    UserRecord *records = NULL;
+    if (store->slotCount > 0) {
+        records = malloc(store->slotCount * slotSize);
+        if (records == NULL || !storeReadAt(store, sizeof(header), records, store->slotCount * slotSize) ||
+            !reserveUsers(state, store->slotCount)) {
+            free(records);
+            framePrintf("Error: Could not read %s.\n", USER_STORE_FILE);
+            closeUserStore(store);
+            return 0;
+        }
+    }
+
+    for (int slot = 0; slot < store->slotCount; slot++) {
+        UserRecord *copies = &records[slot * 2];
+
+        const UserRecord *newest = newestCopy(copies);
+        if (newest == NULL) {
+            continue; // No valid copy yet, e.g. an interrupted first write
+        }
+
+        char name[MAX_NAME_LEN];
+        memcpy(name, newest->name, MAX_NAME_LEN);
+        name[MAX_NAME_LEN - 1] = '\0';
+        if (findUserIndex(name, state) >= 0) {
+            continue; // Keep the first slot if a name was ever stored twice
+        }
+        int index = addUser(state, name);
+        if (index < 0) {
+            free(records);
+            framePrintf("Error: Could not read %s.\n", USER_STORE_FILE);
+            closeUserStore(store);
+            return 0;
+        }
+        copyRecordToUser(newest, &state->users[index]);
+        store->slots[index] = slot;
+        store->sequences[index] = newest->sequence;
+        store->saved[index] = state->users[index];
+    }
+    free(records);
+
+    framePrintf("Loaded %d user profiles.\n", state->userCount);
+    return 1;
+}
+
+// Write every user in memory to a fresh store, replacing the old one atomically
+int createUserStore(AppState *state) {
+    char tempName[] = USER_STORE_FILE ".tmp";
+    FILE *fp = fopen(tempName, "wb");
+    if (fp == NULL) {
+        framePrintf("Error: Could not create %s.\n", tempName);
+        return 0;
+    }
+
+    UserStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, USER_STORE_MAGIC, 4);
+    header.version = USER_STORE_VERSION;
+    header.recordSize = sizeof(UserRecord);
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    for (int i = 0; i < state->userCount && ok; i++) {
+        UserRecord copies[2];
+        memset(copies, 0, sizeof(copies));
+        User *user = &state->users[i];
+        copies[0].sequence = 1;
+        snprintf(copies[0].name, sizeof(copies[0].name), "%s", user->name);
+        copies[0].bestWPM = user->bestWPM;
+        copies[0].bestAccuracy = user->bestAccuracy;
+        copies[0].testsCompleted = user->testsCompleted;
+        copies[0].enduranceHighScore = user->enduranceHighScore;
+        copies[0].averageAccuracy = user->averageAccuracy;
+        copies[0].totalCharsTyped = user->totalCharsTyped;
+        copies[0].totalCorrectChars = user->totalCorrectChars;
+        copies[0].checksum = recordChecksum(&copies[0]);
+        ok = fwrite(copies, sizeof(copies), 1, fp) == 1;
+    }
+
+    // Make the new file durable before it replaces the old one
+    ok = ok && fflush(fp) == 0;
+    #ifdef _WIN32
+    ok = ok && _commit(_fileno(fp)) == 0;
+    #else
+    ok = ok && fsync(fileno(fp)) == 0;
+    #endif
+    if (fclose(fp) != 0 || !ok) {
+        remove(tempName);
+        framePrintf("Error: Could not write %s.\n", tempName);
+        return 0;
+    }
+
+    #ifdef _WIN32
+    if (!MoveFileExA(tempName, USER_STORE_FILE, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    #else
+    if (rename(tempName, USER_STORE_FILE) != 0) {
+    #endif
+        remove(tempName);
+        framePrintf("Error: Could not replace %s.\n", USER_STORE_FILE);
+        return 0;
+    }
+    framePrintf("Wrote %d user profiles to %s.\n", state->userCount, USER_STORE_FILE);
+    return 1;
+}
+
+// Close the store file
+void closeUserStore(UserStore *store) {
+    if (!store->open) {
+        return;
+    }
+    #ifdef _WIN32
+        CloseHandle(store->file);
+    #else
+        close(store->fd);
+    #endif
+    store->open = 0;
+}
+
+// Hand what changed in one user since the last save to the persistence worker
+// Other processes may have saved the same user meanwhile, so the worker adds
+// these counters to whatever the slot holds by then
+void queueUserRecord(AppState *state, int index) {
+    User *user = &state->users[index];
+    User *saved = &state->store.saved[index];
+    if (state->store.slots[index] < 0) {
+        return; // Never got a slot, so there is nowhere to save it
+    }
+    PersistEvent event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = PERSIST_EVENT_USER;
+    event.slot = state->store.slots[index];
+    UserRecord *record = &event.data.user;
+    snprintf(record->name, sizeof(record->name), "%s", user->name);
+    record->bestWPM = user->bestWPM;
+    record->bestAccuracy = user->bestAccuracy;
+    record->testsCompleted = user->testsCompleted - saved->testsCompleted;
+    record->enduranceHighScore = user->enduranceHighScore;
+    record->averageAccuracy = user->averageAccuracy;
+    record->totalCharsTyped = user->totalCharsTyped - saved->totalCharsTyped;
+    record->totalCorrectChars = user->totalCorrectChars - saved->totalCorrectChars;
+    *saved = *user;
+    persistPush(&state->persist, &event);
+}
+
+// Merge one user's changes into the older copy of its slot
+// The slot is locked while its copies are read back and rewritten, so saves
+// from other processes are added to rather than overwritten. The copy is only
+// durable after the next persistSync, so the newest copy is synced first
+// unless this process wrote and synced it itself
+int writeUserRecord(PersistQueue *queue, int slot, UserRecord *delta) {
+    if (!persistReserveSlot(queue, slot)) {
+        return 0;
+    }
+    long long slotOffset = sizeof(UserStoreHeader) + (long long)slot * 2 * sizeof(UserRecord);
+    #ifdef _WIN32
+        LockHandle file = queue->store->file;
+    #else
+        LockHandle file = queue->store->fd;
+    #endif
+    if (!lockFileRange(file, slotOffset, 2 * sizeof(UserRecord), 1)) {
+        return 0;
+    }
+
+    UserRecord copies[2];
+    UserRecord record;
+    memset(&record, 0, sizeof(record));
+    int ok = storeReadAt(queue->store, slotOffset, copies, sizeof(copies));
+    const UserRecord *newest = ok ? newestCopy(copies) : NULL;
+    if (newest != NULL) {
+        record = *newest;
+    } else {
+        snprintf(record.name, sizeof(record.name), "%s", delta->name);
+    }
+    if (ok && (queue->unsynced[slot] || record.sequence != queue->sequences[slot])) {
+        ok = persistSync(queue);
+    }
+
+    if (ok) {
+        mergeUserDelta(&record, delta);
+        record.sequence++;
+        record.checksum = recordChecksum(&record);
+        // Odd sequences live in the first copy, even ones in the second
+        long long offset = slotOffset + ((record.sequence & 1) ? 0 : sizeof(UserRecord));
+        ok = storeWriteAt(queue->store, offset, &record, sizeof(record));
+    }
+    lockFileRange(file, slotOffset, 2 * sizeof(UserRecord), 0);
+    if (!ok) {
+        return 0;
+    }
+    queue->sequences[slot] = record.sequence;
+    queue->unsynced[slot] = 1;
+    if (queue->unsyncedCount++ == 0) {
+        queue->syncDue = monotonicNanos() / 1000000 + PERSIST_BATCH_MS;
+    }
+    return 1;
+}
+
+// Add the counters of a saved change and keep the better of each best
+void mergeUserDelta(UserRecord *into, const UserRecord *delta) {
+    into->testsCompleted += delta->testsCompleted;
+    into->totalCharsTyped += delta->totalCharsTyped;
+    into->totalCorrectChars += delta->totalCorrectChars;
+    if (delta->bestWPM > into->bestWPM) {
+        into->bestWPM = delta->bestWPM;
+    }
+    if (delta->bestAccuracy > into->bestAccuracy) {
+        into->bestAccuracy = delta->bestAccuracy;
+    }
+    if (delta->enduranceHighScore > into->enduranceHighScore) {
+        into->enduranceHighScore = delta->enduranceHighScore;
+    }
+    into->averageAccuracy = into->totalCharsTyped > 0
+        ? (float)into->totalCorrectChars / into->totalCharsTyped * 100
+        : delta->averageAccuracy;
+}
+
+// The newest copy of a slot whose checksum is intact, or NULL
+const UserRecord *newestCopy(const UserRecord copies[2]) {
+    const UserRecord *newest = NULL;
+    for (int c = 0; c < 2; c++) {
+        if (copies[c].sequence != 0 && copies[c].checksum == recordChecksum(&copies[c]) &&
+            (newest == NULL || copies[c].sequence > newest->sequence)) {
+            newest = &copies[c];
+        }
+    }
+    return newest;
+}
+
+void copyRecordToUser(const UserRecord *record, User *user) {
+    user->bestWPM = record->bestWPM;
+    user->bestAccuracy = record->bestAccuracy;
+    user->testsCompleted = record->testsCompleted;
+    user->enduranceHighScore = record->enduranceHighScore;
+    user->averageAccuracy = record->averageAccuracy;
+    user->totalCharsTyped = record->totalCharsTyped;
+    user->totalCorrectChars = record->totalCorrectChars;
+}
+
+// Give a newly created user a slot at the end of the file, written whole
+// Other processes append too, so the header is locked while the end is found
+// again; a slot another process has just appended for the same name is reused
+int appendUserSlot(AppState *state, int index) {
+    UserStore *store = &state->store;
+    User *user = &state->users[index];
+    long long slotSize = 2 * (long long)sizeof(UserRecord);
+    #ifdef _WIN32
+        LockHandle file = store->file;
+    #else
+        LockHandle file = store->fd;
+    #endif
+    if (!lockFileRange(file, 0, sizeof(UserStoreHeader), 1)) {
+        framePrintf("Error: Could not lock %s.\n", USER_STORE_FILE);
+        return 0;
+    }
+
+    int slotCount = (int)((storeSize(store) - (long long)sizeof(UserStoreHeader)) / slotSize);
+    UserRecord copies[2];
+    int slot = -1;
+    for (int s = store->slotCount; s < slotCount && slot < 0; s++) {
+        if (!storeReadAt(store, sizeof(UserStoreHeader) + s * slotSize, copies, sizeof(copies))) {
+            continue;
+        }
+        const UserRecord *newest = newestCopy(copies);
+        char name[MAX_NAME_LEN];
+        if (newest != NULL) {
+            memcpy(name, newest->name, MAX_NAME_LEN);
+            name[MAX_NAME_LEN - 1] = '\0';
+            if (strcmp(name, user->name) == 0) {
+                User before = *user;
+                copyRecordToUser(newest, user);
+                storeUserColumns(state, index);
+                updateUserRanks(state, index, &before);
+                store->sequences[index] = newest->sequence;
+                slot = s;
+            }
+        }
+    }
+
+    int ok = 1;
+    if (slot < 0) {
+        memset(copies, 0, sizeof(copies));
+        copies[0].sequence = 1;
+        snprintf(copies[0].name, sizeof(copies[0].name), "%s", user->name);
+        copies[0].checksum = recordChecksum(&copies[0]);
+        ok = storeWriteAt(store, sizeof(UserStoreHeader) + slotCount * slotSize, copies, sizeof(copies)) &&
+             storeSync(store);
+        store->sequences[index] = 1;
+        slot = slotCount;
+        slotCount += ok;
+    }
+    lockFileRange(file, 0, sizeof(UserStoreHeader), 0);
+    store->slotCount = slotCount;
+    if (!ok) {
+        framePrintf("Error: Could not write to %s.\n", USER_STORE_FILE);
+        return 0;
+    }
+    store->slots[index] = slot;
+    store->saved[index] = *user;
+    return 1;
+}
+
+// Remember that a user needs to be written; every change to a user's stats ends here,
+// so their row of the stat columns is brought up to date too
+void markUserDirty(AppState *state, int index) {
+    state->store.dirty[index] = 1;
+    storeUserColumns(state, index);
+}
+
+// Queue only the users that changed; the worker writes them
+void saveDirtyUsers(AppState *state) {
+    for (int i = 0; i < state->userCount; i++) {
+        if (state->store.dirty[i]) {
+            queueUserRecord(state, i);
+            state->store.dirty[i] = 0;
+        }
+    }
+    reportPersistErrors(state);
+}
+
+// FNV-1a over a record, skipping the checksum field itself
+uint32_t recordChecksum(const UserRecord *record) {
+    const unsigned char *bytes = (const unsigned char *)record + sizeof(record->checksum);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(UserRecord) - sizeof(record->checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Positioned read of exactly length bytes
+int storeReadAt(UserStore *store, long long offset, void *data, size_t length) {
+    #ifdef _WIN32
+        OVERLAPPED at;
+        DWORD got = 0;
+        memset(&at, 0, sizeof(at));
+        at.Offset = (DWORD)offset;
+        at.OffsetHigh = (DWORD)(offset >> 32);
+        return ReadFile(store->file, data, (DWORD)length, &got, &at) && got == length;
+    #else
+        char *bytes = data;
+        while (length > 0) {
+            ssize_t got = pread(store->fd, bytes, length, offset);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return 0;
+            }
+            bytes += got;
+            offset += got;
+            length -= got;
+        }
+        return 1;
+    #endif
+}
+
+// Positioned write of exactly length bytes
+int storeWriteAt(UserStore *store, long long offset, const void *data, size_t length) {
+    #ifdef _WIN32
+        OVERLAPPED at;
+        DWORD written = 0;
+        memset(&at, 0, sizeof(at));
+        at.Offset = (DWORD)offset;
+        at.OffsetHigh = (DWORD)(offset >> 32);
+        return WriteFile(store->file, data, (DWORD)length, &written, &at) && written == length;
+    #else
+        const char *bytes = data;
+        while (length > 0) {
+            ssize_t written = pwrite(store->fd, bytes, length, offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return 0;
+            }
+            bytes += written;
+            offset += written;
+            length -= written;
+        }
+        return 1;
+    #endif
+}
+
+// Flush written records to the disk
+int storeSync(UserStore *store) {
+    #ifdef _WIN32
+        return FlushFileBuffers(store->file) != 0;
+    #else
+        return fsync(store->fd) == 0;
+    #endif
+}
+
+long long storeSize(UserStore *store) {
+    #ifdef _WIN32
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(store->file, &fileSize);
+        return fileSize.QuadPart;
+    #else
+        struct stat info;
+        fstat(store->fd, &info);
+        return info.st_size;
+    #endif
+}
+
+// Wait for an exclusive advisory lock on a byte range, or release it
+// Locks are taken on ranges of a file that every process opens for itself,
+// so only writers of the same range wait for each other
+int lockFileRange(LockHandle file, long long offset, long long length, int lock) {
+    #ifdef _WIN32
+        OVERLAPPED at;
+        memset(&at, 0, sizeof(at));
+        at.Offset = (DWORD)offset;
+        at.OffsetHigh = (DWORD)(offset >> 32);
+        if (lock) {
+            return LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, (DWORD)length,
+                              (DWORD)(length >> 32), &at) != 0;
+        }
+        return UnlockFileEx(file, 0, (DWORD)length, (DWORD)(length >> 32), &at) != 0;
+    #else
+        struct flock range;
+        memset(&range, 0, sizeof(range));
+        range.l_type = lock ? F_WRLCK : F_UNLCK;
+        range.l_whence = SEEK_SET;
+        range.l_start = (off_t)offset;
+        range.l_len = (off_t)length;
+        while (fcntl(file, F_SETLKW, &range) != 0) {
+            if (errno != EINTR) {
+                return 0;
+            }
+        }
+        return 1;
+    #endif
+}
+
+// Start the thread that writes users, history and skills in the background
+// Returns 0 only when out of memory; without a thread saves are written inline
+int startPersistence(AppState *state) {
+    PersistQueue *queue = &state->persist;
+    UserStore *store = &state->store;
+    queue->store = store;
+    if (store->slotCount > 0 && !persistReserveSlot(queue, store->slotCount - 1)) {
+        return 0;
+    }
+    for (int i = 0; i < state->userCount; i++) {
+        queue->sequences[store->slots[i]] = store->sequences[i];
+    }
+
+    #ifdef _WIN32
+        InitializeCriticalSection(&queue->lock);
+        InitializeConditionVariable(&queue->work);
+        InitializeConditionVariable(&queue->drained);
+        queue->thread = CreateThread(NULL, 0, persistThread, queue, 0, NULL);
+        queue->running = queue->thread != NULL;
+        if (!queue->running) {
+            DeleteCriticalSection(&queue->lock);
+        }
+    #else
+        pthread_mutex_init(&queue->lock, NULL);
+        pthread_cond_init(&queue->work, NULL);
+        pthread_cond_init(&queue->drained, NULL);
+        queue->running = pthread_create(&queue->thread, NULL, persistThread, queue) == 0;
+        if (!queue->running) {
+            pthread_cond_destroy(&queue->drained);
+            pthread_cond_destroy(&queue->work);
+            pthread_mutex_destroy(&queue->lock);
+        }
+    #endif
+    return 1;
+}
+
+// Write and sync everything still queued, then stop the worker
+void stopPersistence(AppState *state) {
+    PersistQueue *queue = &state->persist;
+    if (queue->store == NULL) {
+        return;
+    }
+    PersistEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = PERSIST_EVENT_STOP;
+    persistPush(queue, &event);
+
+    if (queue->running) {
+        #ifdef _WIN32
+            WaitForSingleObject(queue->thread, INFINITE);
+            CloseHandle(queue->thread);
+            DeleteCriticalSection(&queue->lock);
+        #else
+            pthread_join(queue->thread, NULL);
+            pthread_cond_destroy(&queue->drained);
+            pthread_cond_destroy(&queue->work);
+            pthread_mutex_destroy(&queue->lock);
+        #endif
+        queue->running = 0;
+    }
+    reportPersistErrors(state);
+    free(queue->sequences);
+    free(queue->unsynced);
+    queue->sequences = NULL;
+    queue->unsynced = NULL;
+    queue->slotCapacity = 0;
+    queue->store = NULL;
+}
+
+// Queue one event for the worker; only the UI thread calls this
+// Waits for the worker only when the queue is full
+void persistPush(PersistQueue *queue, const PersistEvent *event) {
+    uint32_t head = queue->head;
+    if (queue->running && head - persistLoad(&queue->tail) == PERSIST_QUEUE_SIZE) {
+        persistLock(queue);
+        while (head - persistLoad(&queue->tail) == PERSIST_QUEUE_SIZE) {
+            persistWait(queue, &queue->drained, -1);
+        }
+        persistUnlock(queue);
+    }
+    queue->events[head & (PERSIST_QUEUE_SIZE - 1)] = *event;
+    persistPublish(&queue->head, head + 1);
+
+    if (!queue->running) {
+        persistBatch(queue);
+        return;
+    }
+    persistLock(queue);
+    persistSignal(&queue->work);
+    persistUnlock(queue);
+}
+
+// Wait until the worker has written everything queued so far
+void persistFlush(PersistQueue *queue) {
+    if (!queue->running) {
+        return;
+    }
+    persistLock(queue);
+    while (persistLoad(&queue->tail) != queue->head) {
+        persistWait(queue, &queue->drained, -1);
+    }
+    persistUnlock(queue);
+}
+
+// Write every event queued so far as one batch; returns 1 once it held STOP
+// A user queued again later in the batch is folded into that later save, and
+// a skill table queued again is skipped, so each is written once per batch.
+// History records are all appended
+int persistBatch(PersistQueue *queue) {
+    uint32_t head = persistLoad(&queue->head);
+    int stop = 0;
+    for (uint32_t i = queue->tail; i != head; i++) {
+        PersistEvent *event = &queue->events[i & (PERSIST_QUEUE_SIZE - 1)];
+        PersistEvent *later = NULL;
+        if (event->type == PERSIST_EVENT_STOP) {
+            stop = 1;
+        } else if ((later = persistLaterEvent(queue, i, head)) != NULL) {
+            if (event->type == PERSIST_EVENT_USER) {
+                mergeUserDelta(&later->data.user, &event->data.user);
+            } else {
+                free(event->data.skills);
+            }
+        } else if (event->type == PERSIST_EVENT_USER) {
+            TRACE_BEGIN(writeStart);
+            if (!writeUserRecord(queue, event->slot, &event->data.user)) {
+                persistSetFailed(queue, PERSIST_FAILED_USERS);
+            }
+            TRACE_END("write_user", writeStart, event->slot);
+        } else if (event->type == PERSIST_EVENT_HISTORY) {
+            TRACE_BEGIN(writeStart);
+            if (!writeHistoryRecord(event->name, &event->data.history)) {
+                persistSetFailed(queue, PERSIST_FAILED_HISTORY);
+            }
+            TRACE_END("write_history", writeStart, 0);
+        } else if (event->type == PERSIST_EVENT_SKILLS) {
+            TRACE_BEGIN(writeStart);
+            if (!writeSkillFile(event->name, event->data.skills)) {
+                persistSetFailed(queue, PERSIST_FAILED_SKILLS);
+            }
+            TRACE_END("write_skills", writeStart, 0);
+            free(event->data.skills);
+        }
+    }
+    // Without a worker there is no later moment to sync at
+    if (queue->unsyncedCount > 0 &&
+        (stop || !queue->running || queue->policy == PERSIST_SYNC_IMMEDIATE)) {
+        persistSync(queue);
+    }
+
+    persistPublish(&queue->tail, head);
+    if (queue->running) {
+        persistLock(queue);
+        persistSignal(&queue->drained);
+        persistUnlock(queue);
+    }
+    return stop;
+}
+
+// The next event in the batch that saves the same user or skill table, or NULL
+PersistEvent *persistLaterEvent(PersistQueue *queue, uint32_t index, uint32_t head) {
+    const PersistEvent *event = &queue->events[index & (PERSIST_QUEUE_SIZE - 1)];
+    if (event->type != PERSIST_EVENT_USER && event->type != PERSIST_EVENT_SKILLS) {
+        return NULL;
+    }
+    for (uint32_t i = index + 1; i != head; i++) {
+        PersistEvent *later = &queue->events[i & (PERSIST_QUEUE_SIZE - 1)];
+        if (later->type == event->type &&
+            (event->type == PERSIST_EVENT_USER ? later->slot == event->slot
+                                               : strcmp(later->name, event->name) == 0)) {
+            return later;
+        }
+    }
+    return NULL;
+}
+
+// Make every user record written so far durable
+int persistSync(PersistQueue *queue) {
+    TRACE_BEGIN(syncStart);
+    int ok = storeSync(queue->store);
+    TRACE_END("sync_users", syncStart, queue->unsyncedCount);
+    if (!ok) {
+        persistSetFailed(queue, PERSIST_FAILED_USERS);
+    }
+    memset(queue->unsynced, 0, (size_t)queue->slotCapacity);
+    queue->unsyncedCount = 0;
+    return ok;
+}
+
+// Grow the worker's per-slot arrays to hold slot; new slots start empty
+int persistReserveSlot(PersistQueue *queue, int slot) {
+    if (slot < queue->slotCapacity) {
+        return 1;
+    }
+    int capacity = queue->slotCapacity > 0 ? queue->slotCapacity : 64;
+    while (capacity <= slot) {
+        capacity *= 2;
+    }
+    uint32_t *sequences = realloc(queue->sequences, (size_t)capacity * sizeof(uint32_t));
+    if (sequences != NULL) {
+        queue->sequences = sequences;
+    }
+    unsigned char *unsynced = realloc(queue->unsynced, (size_t)capacity);
+    if (unsynced != NULL) {
+        queue->unsynced = unsynced;
+    }
+    if (sequences == NULL || unsynced == NULL) {
+        return 0;
+    }
+    memset(queue->sequences + queue->slotCapacity, 0,
+           (size_t)(capacity - queue->slotCapacity) * sizeof(uint32_t));
+    memset(queue->unsynced + queue->slotCapacity, 0, (size_t)(capacity - queue->slotCapacity));
+    queue->slotCapacity = capacity;
+    return 1;
+}
+
+// Sleep until events are queued, write them, and sync as the policy asks
+void persistWorker(PersistQueue *queue) {
+    int stop = 0;
+    while (!stop) {
+        persistLock(queue);
+        while (persistLoad(&queue->head) == queue->tail) {
+            if (queue->unsyncedCount == 0 || queue->policy != PERSIST_SYNC_BATCHED) {
+                persistWait(queue, &queue->work, -1);
+                continue;
+            }
+            long long remaining = queue->syncDue - monotonicNanos() / 1000000;
+            if (remaining <= 0) {
+                break;
+            }
+            persistWait(queue, &queue->work, remaining);
+        }
+        persistUnlock(queue);
+
+        if (queue->unsyncedCount > 0 && queue->policy == PERSIST_SYNC_BATCHED &&
+            monotonicNanos() / 1000000 >= queue->syncDue) {
+            persistSync(queue);
+        }
+        stop = persistBatch(queue);
+    }
+}
+
+#ifdef _WIN32
+DWORD WINAPI persistThread(LPVOID argument) {
+    persistWorker(argument);
+    return 0;
+}
+#else
+void *persistThread(void *argument) {
+    persistWorker(argument);
+    return NULL;
+}
+#endif
+
+void persistLock(PersistQueue *queue) {
+    #ifdef _WIN32
+        EnterCriticalSection(&queue->lock);
+    #else
+        pthread_mutex_lock(&queue->lock);
+    #endif
+}
+
+void persistUnlock(PersistQueue *queue) {
+    #ifdef _WIN32
+        LeaveCriticalSection(&queue->lock);
+    #else
+        pthread_mutex_unlock(&queue->lock);
+    #endif
+}
+
+// Sleep on a condition with the lock held, for at most ms; ms < 0 waits until signalled
+void persistWait(PersistQueue *queue, PersistCondition *condition, long long ms) {
+    #ifdef _WIN32
+        SleepConditionVariableCS(condition, &queue->lock, ms < 0 ? INFINITE : (DWORD)ms);
+    #else
+        if (ms < 0) {
+            pthread_cond_wait(condition, &queue->lock);
+            return;
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += ms / 1000;
+        until.tv_nsec += (ms % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(condition, &queue->lock, &until);
+    #endif
+}
+
+void persistSignal(PersistCondition *condition) {
+    #ifdef _WIN32
+        WakeAllConditionVariable(condition);
+    #else
+        pthread_cond_broadcast(condition);
+    #endif
+}
+
+// Read an index the other thread publishes, seeing everything written before it
+uint32_t persistLoad(volatile uint32_t *value) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+    #else
+        return (uint32_t)InterlockedCompareExchange((volatile LONG *)value, 0, 0);
+    #endif
+}
+
+// Publish an index after the events it covers are written
+void persistPublish(volatile uint32_t *value, uint32_t next) {
+    #if defined(__GNUC__) || defined(__clang__)
+        __atomic_store_n(value, next, __ATOMIC_RELEASE);
+    #else
+        InterlockedExchange((volatile LONG *)value, (LONG)next);
+    #endif
+}
+
+void persistSetFailed(PersistQueue *queue, uint32_t bits) {
+    #if defined(__GNUC__) || defined(__clang__)
+        __atomic_fetch_or(&queue->failed, bits, __ATOMIC_RELAXED);
+    #else
+        InterlockedOr((volatile LONG *)&queue->failed, (LONG)bits);
+    #endif
+}
+
+// Print the saves the worker could not write since the last report
+void reportPersistErrors(AppState *state) {
+    #if defined(__GNUC__) || defined(__clang__)
+        uint32_t failed = __atomic_exchange_n(&state->persist.failed, 0, __ATOMIC_RELAXED);
+    #else
+        uint32_t failed = (uint32_t)InterlockedExchange((volatile LONG *)&state->persist.failed, 0);
+    #endif
+    if (failed & PERSIST_FAILED_USERS) {
+        framePrintf("Error: Could not write to %s.\n", USER_STORE_FILE);
+    }
+    if (failed & PERSIST_FAILED_HISTORY) {
+        framePrintf("Error: Could not write a history log in %s.\n", HISTORY_DIR);
+    }
+    if (failed & PERSIST_FAILED_SKILLS) {
+        framePrintf("Error: Could not write a skill table in %s.\n", HISTORY_DIR);
+    }
+}
+
+// Find user index by username
+int findUserIndex(char *username, AppState *state) {
+    if (state->userIndexCapacity == 0) {
+        return -1;
+    }
+    int mask = state->userIndexCapacity - 1;
+    int h = (int)(hashName(username) & mask);
+    while (state->userIndex[h] >= 0) {
+        int i = state->userIndex[h];
+        if (strcmp(state->users[i].name, username) == 0) {
+            return i;
+        }
+        h = (h + 1) & mask;
+    }
+    return -1;
+}
+
+// FNV-1a hash of a user name
+uint32_t hashName(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+// Make room for capacity users, keeping the hash index at most half full
+int reserveUsers(AppState *state, int capacity) {
+    if (capacity > state->userCapacity) {
+        int newCapacity = state->userCapacity ? state->userCapacity : 64;
+        while (newCapacity < capacity) {
+            newCapacity *= 2;
+        }
+        User *users = realloc(state->users, newCapacity * sizeof(User));
+        if (users != NULL) {
+            state->users = users;
+        }
+        int *slots = realloc(state->store.slots, newCapacity * sizeof(int));
+        if (slots != NULL) {
+            state->store.slots = slots;
+        }
+        uint32_t *sequences = realloc(state->store.sequences, newCapacity * sizeof(uint32_t));
+        if (sequences != NULL) {
+            state->store.sequences = sequences;
+        }
+        char *dirty = realloc(state->store.dirty, newCapacity);
+        if (dirty != NULL) {
+            state->store.dirty = dirty;
+        }
+        User *saved = realloc(state->store.saved, newCapacity * sizeof(User));
+        if (saved != NULL) {
+            state->store.saved = saved;
+        }
+        int ranksGrown = 1;
+        for (int m = 0; m < RANK_METRIC_COUNT; m++) {
+            RankEntry *entries = realloc(state->ranks[m].entries, newCapacity * sizeof(RankEntry));
+            if (entries != NULL) {
+                state->ranks[m].entries = entries;
+            } else {
+                ranksGrown = 0;
+            }
+        }
+        int columnsGrown = reserveUserColumns(&state->columns, newCapacity);
+        if (users == NULL || slots == NULL || sequences == NULL || dirty == NULL || saved == NULL ||
+            !ranksGrown || !columnsGrown) {
+            return 0;
+        }
+        state->userCapacity = newCapacity;
+    }
+
+    if (capacity * 2 > state->userIndexCapacity) {
+        int indexCapacity = state->userIndexCapacity ? state->userIndexCapacity : 128;
+        while (indexCapacity < capacity * 2) {
+            indexCapacity *= 2;
+        }
+        int *userIndex = malloc(indexCapacity * sizeof(int));
+        if (userIndex == NULL) {
+            return 0;
+        }
+        for (int h = 0; h < indexCapacity; h++) {
+            userIndex[h] = -1;
+        }
+        // Rehash every existing user into the larger table
+        for (int i = 0; i < state->userCount; i++) {
+            int h = (int)(hashName(state->users[i].name) & (indexCapacity - 1));
+            while (userIndex[h] >= 0) {
+                h = (h + 1) & (indexCapacity - 1);
+            }
+            userIndex[h] = i;
+        }
+        free(state->userIndex);
+        state->userIndex = userIndex;
+        state->userIndexCapacity = indexCapacity;
+    }
+    return 1;
+}
+
+// Grow every stat column to capacity users; returns 0 if any could not grow
+int reserveUserColumns(UserColumns *columns, int capacity) {
+    int ok = 1;
+    float **floats[] = { &columns->bestWPM, &columns->bestAccuracy, &columns->averageAccuracy,
+                         &columns->enduranceHighScore };
+    for (int c = 0; c < (int)(sizeof(floats) / sizeof(floats[0])); c++) {
+        float *column = realloc(*floats[c], capacity * sizeof(float));
+        if (column != NULL) {
+            *floats[c] = column;
+        } else {
+            ok = 0;
+        }
+    }
+    int **ints[] = { &columns->testsCompleted, &columns->nameOffsets };
+    for (int c = 0; c < (int)(sizeof(ints) / sizeof(ints[0])); c++) {
+        int *column = realloc(*ints[c], capacity * sizeof(int));
+        if (column != NULL) {
+            *ints[c] = column;
+        } else {
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+// Copy a name into the pool; returns its offset, or -1 when out of memory
+int appendUserName(UserColumns *columns, const char *name) {
+    size_t length = strlen(name) + 1;
+    if (columns->namesLength + length > columns->namesCapacity) {
+        size_t capacity = columns->namesCapacity ? columns->namesCapacity : 1024;
+        while (capacity < columns->namesLength + length) {
+            capacity *= 2;
+        }
+        char *names = realloc(columns->names, capacity);
+        if (names == NULL) {
+            return -1;
+        }
+        columns->names = names;
+        columns->namesCapacity = capacity;
+    }
+    int offset = (int)columns->namesLength;
+    memcpy(columns->names + offset, name, length);
+    columns->namesLength += length;
+    return offset;
+}
+
+// Write a user's row of the stat columns from users[]
+void storeUserColumns(AppState *state, int index) {
+    const User *user = &state->users[index];
+    UserColumns *columns = &state->columns;
+    columns->bestWPM[index] = user->bestWPM;
+    columns->bestAccuracy[index] = user->bestAccuracy;
+    columns->averageAccuracy[index] = user->averageAccuracy;
+    columns->enduranceHighScore[index] = (float)user->enduranceHighScore;
+    columns->testsCompleted[index] = user->testsCompleted;
+}
+
+const char *columnName(const UserColumns *columns, int index) {
+    return columns->names + columns->nameOffsets[index];
+}
+
+// Column holding the stat a leaderboard ranks users by, so it matches rankKey
+const float *rankColumn(const UserColumns *columns, int metric) {
+    switch (metric) {
+        case RANK_BY_ACCURACY:
+            return columns->bestAccuracy;
+        case RANK_BY_ENDURANCE:
+            return columns->enduranceHighScore;
+        default:
+            return columns->bestWPM;
+    }
+}
+
+// Add a user with empty stats; returns its index or -1 when out of memory
+int addUser(AppState *state, const char *username) {
+    if (!reserveUsers(state, state->userCount + 1)) {
+        return -1;
+    }
+    int index = state->userCount;
+    User *user = &state->users[index];
+    memset(user, 0, sizeof(User));
+    strncpy(user->name, username, MAX_NAME_LEN - 1);
+    int nameOffset = appendUserName(&state->columns, user->name);
+    if (nameOffset < 0) {
+        return -1;
+    }
+    state->userCount++;
+    state->columns.nameOffsets[index] = nameOffset;
+    storeUserColumns(state, index);
+
+    state->store.slots[index] = -1;
+    state->store.sequences[index] = 0;
+    state->store.dirty[index] = 0;
+    state->store.saved[index] = *user;
+
+    int h = (int)(hashName(user->name) & (state->userIndexCapacity - 1));
+    while (state->userIndex[h] >= 0) {
+        h = (h + 1) & (state->userIndexCapacity - 1);
+    }
+    state->userIndex[h] = index;
+
+    // Once the leaderboard exists, a new user joins it with empty stats
+    if (state->ranked) {
+        for (int m = 0; m < RANK_METRIC_COUNT; m++) {
+            RankIndex *rank = &state->ranks[m];
+            int pos = rankPosition(rank, 0.0f, index);
+            memmove(&rank->entries[pos + 1], &rank->entries[pos],
+                    (rank->count - pos) * sizeof(RankEntry));
+            rank->entries[pos].key = 0.0f;
+            rank->entries[pos].user = index;
+            rank->count++;
+        }
+    }
+    return index;
+}
+
+// Remove every user but keep the memory for reuse
+void clearUsers(AppState *state) {
+    state->userCount = 0;
+    state->columns.namesLength = 0;
+    state->ranked = 0; // Rebuilt by buildRankIndexes once the new users are in
+    for (int m = 0; m < RANK_METRIC_COUNT; m++) {
+        state->ranks[m].count = 0;
+    }
+    for (int h = 0; h < state->userIndexCapacity; h++) {
+        state->userIndex[h] = -1;
+    }
+}
+
+// Release the user table, its hash index and the store bookkeeping
+void freeUsers(AppState *state) {
+    free(state->users);
+    free(state->userIndex);
+    free(state->store.slots);
+    free(state->store.sequences);
+    free(state->store.dirty);
+    free(state->store.saved);
+    for (int m = 0; m < RANK_METRIC_COUNT; m++) {
+        free(state->ranks[m].entries);
+        state->ranks[m].entries = NULL;
+        state->ranks[m].count = 0;
+    }
+    UserColumns *columns = &state->columns;
+    free(columns->bestWPM);
+    free(columns->bestAccuracy);
+    free(columns->averageAccuracy);
+    free(columns->enduranceHighScore);
+    free(columns->testsCompleted);
+    free(columns->nameOffsets);
+    free(columns->names);
+    memset(columns, 0, sizeof(UserColumns));
+    state->ranked = 0;
+    state->users = NULL;
+    state->userIndex = NULL;
+    state->store.slots = NULL;
+    state->store.sequences = NULL;
+    state->store.dirty = NULL;
+    state->store.saved = NULL;
+    state->userCount = state->userCapacity = state->userIndexCapacity = 0;
+}
+
+//Main menu display
+void showMenu(void) {
+    framePrintf("\n===== Main Menu =====\n");
+    for (int m = 0; m < GAME_MODE_COUNT; m++) {
+        framePrintf("%d. %s\n", m + 1, gameModes[m]->name);
+    }
+    framePrintf("%d. Leaderboard\n", GAME_MODE_COUNT + 1);
+    framePrintf("%d. Profile\n", GAME_MODE_COUNT + 2);
+    framePrintf("%d. Exit\n", GAME_MODE_COUNT + 3);
+}
+
+// Pick the word list a round of the mode is drawn from, by asking the player or
+// from their profile; returns a difficulty from 1 to DIFFICULTY_COUNT
+int chooseDifficulty(const GameMode *mode, AppState *state) {
+    if (mode->wordSource == MODE_WORDS_PROFILE) {
+        int difficulty = getDifficulty(state->users[state->currentUserIndex]);
+        framePrintf("Starting with %s difficulty based on your profile.\n", difficultyNames[difficulty - 1]);
+        return difficulty;
+    }
+    framePrintf("Choose difficulty:\n1. Light (easier words)\n2. Medium (average words)\n3. Hard (difficult words)\nChoice: ");
+    return getValidIntInput(1, DIFFICULTY_COUNT);
+}
+
+// Ask how many words a round of the mode should have, within its limits
+int chooseWordCount(const GameMode *mode, const char *round) {
+    framePrintf("How many words for the %s? (%d-%d): ", round, mode->minWords, mode->maxWords);
+    return getValidIntInput(mode->minWords, mode->maxWords);
+}
+
+//Clear screen
+void clearScreen(void) {
+    if (frame.ansi) {
+        // Home, clear screen, clear scrollback
+        frameAppend("\033[H\033[2J\033[3J", 11);
+        return;
+    }
+    frameFlush();
+    system(CLEAR_SCREEN);
+}
+
+//Word loading function
+// Appends the file to the arena and indexes its whitespace-separated words
+// Fallback for when a word file cannot be memory-mapped
+int loadWordsFromFile(char *filename, WordList *list, WordStore *store) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        framePrintf("Error: Could not open %s\n", filename);
+        return 0;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(fp);
+        framePrintf("Error: Could not read %s\n", filename);
+        return 0;
+    }
+
+    // Grow the arena so the whole file fits behind the lists loaded so far
+    if (store->arenaUsed + size > store->arenaCapacity) {
+        size_t capacity = store->arenaCapacity ? store->arenaCapacity : 4096;
+        while (capacity < store->arenaUsed + size) {
+            capacity *= 2;
+        }
+        char *arena = realloc(store->arena, capacity);
+        if (arena == NULL) {
+            fclose(fp);
+            framePrintf("Error: Not enough memory for %s\n", filename);
+            return 0;
+        }
+        store->arena = arena;
+        store->arenaCapacity = capacity;
+    }
+
+    size_t start = store->arenaUsed;
+    size_t length = fread(store->arena + start, 1, size, fp);
+    fclose(fp);
+    store->arenaUsed += length;
+
+    // Index every word as an offset/length pair into the arena
+    if (!indexWords(store->arena, start, store->arenaUsed, list)) {
+        framePrintf("Error: Not enough memory for %s\n", filename);
+        return 0;
+    }
+
+    // The arena may have moved, so every arena-backed list gets the current base
+    for (int d = 0; d < DIFFICULTY_COUNT; d++) {
+        if (store->lists[d].source.data == NULL) {
+            store->lists[d].base = store->arena;
+        }
+    }
+
+    framePrintf("Successfully loaded %d words from %s.\n", list->count, filename);
+    return 1;
+}
+
+// Load all difficulty word lists so modes can switch without file I/O
+void loadWordStore(AppState *state) {
+    char *filenames[DIFFICULTY_COUNT] = { "wordbaseL.txt", "wordbaseM.txt", "wordbaseH.txt" };
+
+    for (int d = 0; d < DIFFICULTY_COUNT; d++) {
+        TRACE_BEGIN(loadStart);
+        if (!loadMappedWords(filenames[d], &state->words.lists[d])) {
+            loadWordsFromFile(filenames[d], &state->words.lists[d], &state->words);
+        }
+        TRACE_END("load_words", loadStart, state->words.lists[d].count);
+        indexWordPairs(&state->words.lists[d]); // Without it words are drawn uniformly
+    }
+}
+
+// Release the arena, mappings and word indexes
+void freeWordStore(WordStore *store) {
+    for (int d = 0; d < DIFFICULTY_COUNT; d++) {
+        free(store->lists[d].entries);
+        free(store->lists[d].pairs);
+        free(store->lists[d].pairStarts);
+        unmapFile(&store->lists[d].source);
+    }
+    free(store->arena);
+    memset(store, 0, sizeof(*store));
+}
+
+// Map a whole file read-only; returns 0 on failure or for an empty file
+int mapFile(const char *filename, MappedFile *map) {
+    memset(map, 0, sizeof(*map));
+    #ifdef _WIN32
+        LARGE_INTEGER size;
+        map->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (map->file == INVALID_HANDLE_VALUE) {
+            return 0;
+        }
+        if (!GetFileSizeEx(map->file, &size) || size.QuadPart == 0) {
+            CloseHandle(map->file);
+            return 0;
+        }
+        map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map->mapping == NULL) {
+            CloseHandle(map->file);
+            return 0;
+        }
+        map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (map->data == NULL) {
+            CloseHandle(map->mapping);
+            CloseHandle(map->file);
+            return 0;
+        }
+        map->size = (size_t)size.QuadPart;
+    #else
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            return 0;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return 0;
+        }
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // The mapping stays valid without the descriptor
+        if (data == MAP_FAILED) {
+            return 0;
+        }
+        map->data = data;
+        map->size = info.st_size;
+    #endif
+    return 1;
+}
+
+// Release a mapping made by mapFile
+void unmapFile(MappedFile *map) {
+    if (map->data == NULL) {
+        return;
+    }
+    #ifdef _WIN32
+        UnmapViewOfFile(map->data);
+        CloseHandle(map->mapping);
+        CloseHandle(map->file);
+    #else
+        munmap((void *)map->data, map->size);
+    #endif
+    memset(map, 0, sizeof(*map));
+}
+
+// Make room for at least capacity word entries
+int reserveWordEntries(WordList *list, int capacity) {
+    if (capacity <= list->capacity) {
+        return 1;
+    }
+    int newCapacity = list->capacity ? list->capacity : 256;
+    while (newCapacity < capacity) {
+        newCapacity *= 2;
+    }
+    WordEntry *entries = realloc(list->entries, newCapacity * sizeof(WordEntry));
+    if (entries == NULL) {
+        return 0;
+    }
+    list->entries = entries;
+    list->capacity = newCapacity;
+    return 1;
+}
+
+// Index the words between start and end in one pass over the bytes
+// Any byte up to and including space separates words, like fscanf's %s
+int indexWords(const char *data, size_t start, size_t end, WordList *list) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t histogram[256] = {0};
+    size_t wordStart = 0;
+    int inWord = 0;
+    size_t i = start;
+
+    list->count = 0;
+    memset(&list->stats, 0, sizeof(list->stats));
+
+    while (i < end) {
+        // Eight bytes at a time: a chunk without any separator byte just
+        // extends the current word, which covers most of the input
+        if (i + 8 <= end) {
+            uint64_t chunk;
+            memcpy(&chunk, bytes + i, 8);
+            uint64_t separators = (chunk - 0x2121212121212121ULL) & ~chunk & 0x8080808080808080ULL;
+            if (separators == 0) {
+                if (!inWord) {
+                    inWord = 1;
+                    wordStart = i;
+                }
+                for (int b = 0; b < 8; b++) {
+                    histogram[bytes[i + b]]++;
+                }
+                i += 8;
+                continue;
+            }
+        }
+
+        histogram[bytes[i]]++;
+        if (bytes[i] <= ' ') {
+            if (inWord) {
+                if (list->count == list->capacity && !reserveWordEntries(list, list->count + 1)) {
+                    return 0;
+                }
+                list->entries[list->count].offset = (int)wordStart;
+                list->entries[list->count].length = (int)(i - wordStart);
+                list->count++;
+                inWord = 0;
+            }
+        } else if (!inWord) {
+            inWord = 1;
+            wordStart = i;
+        }
+        i++;
+    }
+    if (inWord) {
+        if (list->count == list->capacity && !reserveWordEntries(list, list->count + 1)) {
+            return 0;
+        }
+        list->entries[list->count].offset = (int)wordStart;
+        list->entries[list->count].length = (int)(end - wordStart);
+        list->count++;
+    }
+
+    // Fold the byte histogram into character classes
+    for (int c = 0; c < 256; c++) {
+        if (c >= 0x80) {
+            list->stats.nonAscii += histogram[c];
+        } else if (islower(c)) {
+            list->stats.lowercase += histogram[c];
+        } else if (isupper(c)) {
+            list->stats.uppercase += histogram[c];
+        } else if (isdigit(c)) {
+            list->stats.digits += histogram[c];
+        } else if (ispunct(c)) {
+            list->stats.punctuation += histogram[c];
+        }
+    }
+    for (int w = 0; w < list->count; w++) {
+        if (list->entries[w].length > list->stats.maxLength) {
+            list->stats.maxLength = list->entries[w].length;
+        }
+    }
+    return 1;
+}
+
+// Map a word file and index it, using its .idx sidecar when it is current
+int loadMappedWords(char *filename, WordList *list) {
+    char indexName[256];
+    struct stat source;
+
+    if (stat(filename, &source) != 0 || !mapFile(filename, &list->source)) {
+        return 0;
+    }
+    snprintf(indexName, sizeof(indexName), "%s.idx", filename);
+
+    if (!readWordIndex(indexName, &source, list)) {
+        if (!indexWords(list->source.data, 0, list->source.size, list)) {
+            unmapFile(&list->source);
+            return 0;
+        }
+        writeWordIndex(indexName, &source, list); // Next startup skips the scan
+    }
+    list->base = list->source.data;
+
+    framePrintf("Successfully loaded %d words from %s.\n", list->count, filename);
+    return 1;
+}
+
+// Read a sidecar index; returns 0 if it is missing, stale or damaged
+int readWordIndex(const char *indexName, const struct stat *source, WordList *list) {
+    FILE *fp = fopen(indexName, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    WordIndexHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, WORD_INDEX_MAGIC, 4) != 0 ||
+        header.version != WORD_INDEX_VERSION ||
+        header.sourceSize != (uint64_t)source->st_size ||
+        header.sourceModified != (int64_t)source->st_mtime ||
+        header.wordCount > (uint64_t)source->st_size ||
+        !reserveWordEntries(list, (int)header.wordCount) ||
+        fread(list->entries, sizeof(WordEntry), header.wordCount, fp) != header.wordCount) {
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    // Never trust offsets that would read outside the mapping
+    for (uint32_t w = 0; w < header.wordCount; w++) {
+        if (list->entries[w].offset < 0 || list->entries[w].length <= 0 ||
+            (uint64_t)list->entries[w].offset + list->entries[w].length > header.sourceSize) {
+            return 0;
+        }
+    }
+    list->count = (int)header.wordCount;
+    list->stats = header.stats;
+    return 1;
+}
+
+// Write a sidecar index; failure only means the next startup scans again
+void writeWordIndex(const char *indexName, const struct stat *source, WordList *list) {
+    WordIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WORD_INDEX_MAGIC, 4);
+    header.version = WORD_INDEX_VERSION;
+    header.sourceSize = (uint64_t)source->st_size;
+    header.sourceModified = (int64_t)source->st_mtime;
+    header.wordCount = (uint32_t)list->count;
+    header.stats = list->stats;
+
+    FILE *fp = fopen(indexName, "wb");
+    if (fp == NULL) {
+        return;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(list->entries, sizeof(WordEntry), list->count, fp) == (size_t)list->count;
+    if (fclose(fp) != 0 || !ok) {
+        remove(indexName); // Never leave a truncated index behind
+    }
+}
+
+// Get a word (not null-terminated) and its length
+const char *getWord(const WordList *list, int index, int *length) {
+    *length = list->entries[index].length;
+    return list->base + list->entries[index].offset;
+}
+
+// Determine difficulty level based on user's performance
+int getDifficulty(User user) {
+    // Calculate user skill level
+    float accuracy = 0;
+    
+    // Calculate average accuracy
+    if (user.totalCharsTyped > 0) {
+        accuracy = (float)user.totalCorrectChars / user.totalCharsTyped * 100;
+    } else {
+        accuracy = user.bestAccuracy; // Use best accuracy if no total data
+    }
+    
+    // Higher accuracy means higher challenge
+    if (accuracy >= DYNAMIC_COMPLEXITY_THRESHOLD) {
+        return 3; // Hard
+    } else if (accuracy >= DYNAMIC_COMPLEXITY_THRESHOLD - 10) {
+        return 2; // Medium
+    } else {
+        return 1; // Easy
+    }
+}
+
+// New accuracy calculation for better assessment
+float calculateAccuracy(char *target, char *typed, int *mistyped, int *missed, int *extra) {
+    int targetLen = strlen(target);
+    AlignmentCounts counts;
+    alignText(target, targetLen, typed, strlen(typed), &counts);
+
+    // Total errors is the sum of mistyped, missed, and extra characters
+    int totalErrors = counts.mistyped + counts.missed + counts.extra;
+
+    // Accuracy calculation based on errors relative to target length
+    float accuracy = 100.0 * (1.0 - ((float)totalErrors / targetLen));
+
+    // Handle edge cases
+    if (targetLen == 0) {
+        accuracy = 0.0;
+    }
+    if (accuracy < 0) {
+        accuracy = 0.0;
+    }
+
+    // Store the detailed metrics for reporting
+    if (mistyped) *mistyped = counts.mistyped;
+    if (missed) *missed = counts.missed;
+    if (extra) *extra = counts.extra;
+
+    return accuracy;
+}
+
+// Levenshtein distance between a target word and what was typed for it
+// Myers' bit-parallel algorithm keeps a whole column of the edit matrix in
+// one uint64_t, so each typed character costs a handful of word operations
+// Returns -1 for target words longer than ALIGN_MAX_WORD
+int wordEditDistance(const char *target, int targetLength, const char *typed, int typedLength) {
+    if (targetLength == 0) {
+        return typedLength;
+    }
+    if (targetLength > ALIGN_MAX_WORD) {
+        return -1;
+    }
+
+    // Bit i set where target[i] is that character; only the entries that
+    // are used get cleared, which is cheaper than zeroing all 256
+    uint64_t peq[256];
+    for (int j = 0; j < typedLength; j++) {
+        peq[(unsigned char)typed[j]] = 0;
+    }
+    for (int i = 0; i < targetLength; i++) {
+        peq[(unsigned char)target[i]] = 0;
+    }
+    for (int i = 0; i < targetLength; i++) {
+        peq[(unsigned char)target[i]] |= 1ULL << i;
+    }
+
+    uint64_t last = 1ULL << (targetLength - 1);
+    uint64_t pv = ~0ULL; // Vertical +1 deltas
+    uint64_t mv = 0;     // Vertical -1 deltas
+    int score = targetLength;
+    for (int j = 0; j < typedLength; j++) {
+        uint64_t eq = peq[(unsigned char)typed[j]];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        if (ph & last) {
+            score++;
+        } else if (mh & last) {
+            score--;
+        }
+        ph = (ph << 1) | 1; // Row 0 grows by one per typed character
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score;
+}
+
+// Add the edit operations between one target word and the typed word to counts
+void alignWord(const char *target, int targetLength, const char *typed, int typedLength,
+               AlignmentCounts *counts) {
+    if (targetLength == typedLength && memcmp(target, typed, targetLength) == 0) {
+        counts->correct += targetLength;
+        return;
+    }
+    int shorter = (targetLength < typedLength) ? targetLength : typedLength;
+
+    if (targetLength > ALIGN_MAX_WORD || typedLength > ALIGN_MAX_WORD) {
+        // Too long to align; compare position by position
+        int matches = countMatches(target, typed, shorter);
+        counts->correct += matches;
+        counts->mistyped += shorter - matches;
+        counts->missed += targetLength - shorter;
+        counts->extra += typedLength - shorter;
+        return;
+    }
+
+    // When the distance is just the length difference, the word was only
+    // missing or only gaining characters and no traceback is needed
+    int distance = wordEditDistance(target, targetLength, typed, typedLength);
+    if (distance == abs(typedLength - targetLength)) {
+        counts->correct += shorter;
+        counts->missed += targetLength - shorter;
+        counts->extra += typedLength - shorter;
+        return;
+    }
+    // Likewise when it matches the positional mismatches, the word only had wrong characters
+    if (targetLength == typedLength) {
+        int matches = countMatches(target, typed, targetLength);
+        if (distance == targetLength - matches) {
+            counts->correct += matches;
+            counts->mistyped += distance;
+            return;
+        }
+    }
+
+    unsigned char cost[ALIGN_MAX_WORD + 1][ALIGN_MAX_WORD + 1];
+    for (int i = 0; i <= targetLength; i++) {
+        cost[i][0] = (unsigned char)i;
+    }
+    for (int j = 0; j <= typedLength; j++) {
+        cost[0][j] = (unsigned char)j;
+    }
+    for (int i = 1; i <= targetLength; i++) {
+        for (int j = 1; j <= typedLength; j++) {
+            int best = cost[i - 1][j - 1] + (target[i - 1] != typed[j - 1]);
+            if (cost[i - 1][j] + 1 < best) {
+                best = cost[i - 1][j] + 1;
+            }
+            if (cost[i][j - 1] + 1 < best) {
+                best = cost[i][j - 1] + 1;
+            }
+            cost[i][j] = (unsigned char)best;
+        }
+    }
+
+    // Walk back from the end, preferring matches and substitutions
+    int i = targetLength;
+    int j = typedLength;
+    while (i > 0 || j > 0) {
+        if (i > 0 && j > 0 && cost[i][j] == cost[i - 1][j - 1] + (target[i - 1] != typed[j - 1])) {
+            if (target[i - 1] == typed[j - 1]) {
+                counts->correct++;
+            } else {
+                counts->mistyped++;
+            }
+            i--;
+            j--;
+        } else if (i > 0 && cost[i][j] == cost[i - 1][j] + 1) {
+            counts->missed++;
+            i--;
+        } else {
+            counts->extra++;
+            j--;
+        }
+    }
+}
+
+// Find the first word at or after from; returns 0 when there is none,
+// with *start and *end both at the end of the text
+int nextWord(const char *text, int length, int from, int *start, int *end) {
+    while (from < length && (text[from] == ' ' || text[from] == '\n')) {
+        from++;
+    }
+    *start = from;
+    while (from < length && text[from] != ' ' && text[from] != '\n') {
+        from++;
+    }
+    *end = from;
+    return *end > *start;
+}
+
+// Edit cost of pairing two spans, as alignWord would count it
+int pairCost(const char *target, int targetLength, const char *typed, int typedLength) {
+    if (targetLength == typedLength && memcmp(target, typed, targetLength) == 0) {
+        return 0;
+    }
+    int distance = wordEditDistance(target, targetLength, typed, typedLength);
+    if (distance >= 0 && typedLength <= ALIGN_MAX_WORD) {
+        return distance;
+    }
+    int shorter = (targetLength < typedLength) ? targetLength : typedLength;
+    int longer = (targetLength < typedLength) ? typedLength : targetLength;
+    return longer - countMatches(target, typed, shorter);
+}
+
+// Compare typed text with its target word by word
+// Words are paired in order; where a pair differs, merging two target words
+// (a space typed as a letter), merging two typed words (an extra space) or
+// skipping a word is tried too, and the choice that also fits the next pair
+// best wins. A slip therefore only costs the words it happened in
+void alignText(const char *target, int targetLength, const char *typed, int typedLength,
+               AlignmentCounts *counts) {
+    memset(counts, 0, sizeof(*counts));
+    int t[3][2]; // Start and end of the next three target words
+    int y[3][2]; // And of the next three typed words
+    int tCount = 0;
+    int yCount = 0;
+    int tFrom = 0; // Where the unread target text starts
+    int yFrom = 0;
+    int tDone = 0; // End of the last target word that was scored
+    int yDone = 0;
+
+    while (1) {
+        // Keep three words of lookahead on each side
+        while (tCount < 3 && nextWord(target, targetLength, tFrom, &t[tCount][0], &t[tCount][1])) {
+            tFrom = t[tCount++][1];
+        }
+        while (yCount < 3 && nextWord(typed, typedLength, yFrom, &y[yCount][0], &y[yCount][1])) {
+            yFrom = y[yCount++][1];
+        }
+        if (tCount == 0 || yCount == 0) {
+            break;
+        }
+
+        // Options: pair, two target words for one typed, one target for two typed,
+        // target word skipped, typed word extra
+        int useTarget[5] = { 1, 2, 1, 1, 0 };
+        int useTyped[5] = { 1, 1, 2, 0, 1 };
+        int best = 0;
+        int bestCost = -1;
+        for (int option = 0; option < 5; option++) {
+            int ut = useTarget[option];
+            int uy = useTyped[option];
+            if (ut > tCount || uy > yCount) {
+                continue;
+            }
+            int cost;
+            if (ut == 0) {
+                cost = y[0][1] - y[0][0] + 1;
+            } else if (uy == 0) {
+                cost = t[0][1] - t[0][0] + 1;
+            } else {
+                cost = pairCost(target + t[0][0], t[ut - 1][1] - t[0][0],
+                                typed + y[0][0], y[uy - 1][1] - y[0][0]);
+            }
+            if (option == 0 && cost == 0) {
+                bestCost = 0;
+                break; // Exact word, nothing can beat it
+            }
+            // Add how well the words after this choice pair up
+            if (ut < tCount && uy < yCount) {
+                cost += pairCost(target + t[ut][0], t[ut][1] - t[ut][0],
+                                 typed + y[uy][0], y[uy][1] - y[uy][0]);
+            } else if (ut < tCount) {
+                cost += t[ut][1] - t[ut][0];
+            } else if (uy < yCount) {
+                cost += y[uy][1] - y[uy][0];
+            }
+            if (bestCost < 0 || cost < bestCost) {
+                best = option;
+                bestCost = cost;
+            }
+            if (option == 0 && cost <= 1) {
+                break; // Every other choice costs at least one edit
+            }
+        }
+
+        int ut = useTarget[best];
+        int uy = useTyped[best];
+        int targetSpaces = 0;
+        int typedSpaces = 0;
+        if (ut > 0) {
+            targetSpaces = t[0][0] - tDone; // Spaces before the scored words
+            tDone = t[ut - 1][1];
+        }
+        if (uy > 0) {
+            typedSpaces = y[0][0] - yDone;
+            yDone = y[uy - 1][1];
+        }
+        if (ut > 0 && uy > 0) {
+            int matched = (targetSpaces < typedSpaces) ? targetSpaces : typedSpaces;
+            counts->correct += matched;
+            counts->missed += targetSpaces - matched;
+            counts->extra += typedSpaces - matched;
+            alignWord(target + t[0][0], tDone - t[0][0], typed + y[0][0], yDone - y[0][0], counts);
+        } else if (ut > 0) {
+            counts->missed += targetSpaces + (tDone - t[0][0]);
+        } else {
+            counts->extra += typedSpaces + (yDone - y[0][0]);
+        }
+
+        // Drop the words that were used
+        memmove(t, t + ut, (tCount - ut) * sizeof(t[0]));
+        tCount -= ut;
+        memmove(y, y + uy, (yCount - uy) * sizeof(y[0]));
+        yCount -= uy;
+    }
+
+    // Whatever one side has left had nothing to pair with
+    counts->missed += targetLength - tDone;
+    counts->extra += typedLength - yDone;
+}
+
+// Endurance mode function
+void enduranceMode(AppState *state) {
+    framePrintf("\n===== Endurance Mode =====\n");
+    framePrintf("Keep typing until your accuracy falls below %.1f%% or WPM falls below %.1f\n", 
+           enduranceGame.accuracyThreshold, enduranceGame.wpmThreshold);
+    framePrintf("Both are measured over your last %d characters, as you type.\n", ENDURANCE_WINDOW_KEYS);
+    framePrintf("Press ESC at any time to end the test.\n\n");
+
+    // Determine starting difficulty based on user performance
+    int difficulty = chooseDifficulty(&enduranceGame, state);
+
+    WordList *words = &state->words.lists[difficulty - 1];
+    if (words->count == 0) {
+        framePrintf("Failed to load word list. Returning to main menu.\n");
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+
+    // One seed generates the whole stream, so a run can be replayed
+    // Words lean towards the bigrams the user has been slow or wrong on so far
+    uint64_t seed = takeTestSeed(state);
+    framePrintf("Seed: %llu\n", (unsigned long long)seed);
+    unsigned char weakness[SKILL_PAIRS];
+    skillWeakness(&state->skills, weakness);
+
+    resetArena(&state->session);
+    TypingResult result;
+    int reason = enduranceStream(state, difficulty, weakness, seed, &result);
+    if (reason == 0) {
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+
+    if (reason == ENDURANCE_END_ACCURACY) {
+        framePrintf("\nAccuracy dropped below %.1f%%. Endurance mode ended.\n", 
+               enduranceGame.accuracyThreshold);
+    } else if (reason == ENDURANCE_END_WPM) {
+        framePrintf("\nWPM dropped below %.1f. Endurance mode ended.\n", 
+               enduranceGame.wpmThreshold);
+    } else {
+        framePrintf("\nEndurance mode ended.\n");
+    }
+
+    // Endurance mode complete
+    framePrintf("\n===== Endurance Mode Complete =====\n");
+    framePrintf("Total words completed: %d\n", result.wordsCompleted);
+    framePrintf("Time taken: %.2f seconds\n", result.timeTaken);
+    framePrintf("Final accuracy: %.2f%%\n", result.accuracy);
+    framePrintf("Final WPM: %.2f\n", result.wpm);
+    framePrintf("Key latency p50/p95/p99: %.1f / %.1f / %.1f ms\n",
+           result.latencyP50, result.latencyP95, result.latencyP99);
+    framePrintf("Mistyped chars: %d\n", result.mistyped);
+    framePrintf("Missed chars: %d\n", result.missed);
+    framePrintf("Extra chars: %d\n", result.extra);
+    framePrintf("Words with mistakes: %d of %d\n", result.wordErrors, result.wordsCompleted);
+    if (result.totalChars > 0) {
+        appendHistory(state, &result, enduranceGame.historyMode, difficulty);
+        saveSkills(state);
+    }
+
+    // Update user stats
+    if ((enduranceGame.scoring & MODE_SCORE_WORDS) &&
+        result.wordsCompleted > state->users[state->currentUserIndex].enduranceHighScore) {
+        framePrintf("New endurance high score! Previous: %d words\n", 
+               state->users[state->currentUserIndex].enduranceHighScore);
+        User before = state->users[state->currentUserIndex];
+        state->users[state->currentUserIndex].enduranceHighScore = result.wordsCompleted;
+        updateUserRanks(state, state->currentUserIndex, &before);
+    }
+
+    // Update tests completed
+    if (result.totalChars > 0) {
+        state->users[state->currentUserIndex].testsCompleted++;
+    }
+
+    // Save user data
+    markUserDirty(state, state->currentUserIndex);
+    saveDirtyUsers(state);
+
+    framePrintf("\nPress any key to return to main menu...");
+    getch();
+}
+
+// Lay a word out at the end of the stream, starting a new line when it would not fit
+// Every word is followed by its space, so a line always ends on a word boundary
+void streamAppendWord(StreamText *stream, const char *word, int length) {
+    if (length > stream->lineWidth - 1) {
+        length = stream->lineWidth - 1; // A word longer than a line is cut short
+    }
+    long long lineStart = stream->lineStarts[(stream->lineCount - 1) & (STREAM_LINE_SLOTS - 1)];
+    if (stream->length > lineStart && stream->length - lineStart + length + 1 > stream->lineWidth) {
+        stream->lineStarts[stream->lineCount & (STREAM_LINE_SLOTS - 1)] = stream->length;
+        stream->lineCount++;
+    }
+    long long offset = stream->length - stream->base;
+    memcpy(stream->text + offset, word, length);
+    stream->text[offset + length] = ' ';
+    memset(stream->mistakes + offset, 0, length + 1);
+    stream->length += length + 1;
+}
+
+// Generate words until the visible lines below currentLine are complete
+// Text before currentLine can no longer be reached, so it is dropped first
+void fillStream(StreamText *stream, long long currentLine, const WordList *words, AdaptiveSampler *sampler) {
+    long long keep = stream->lineStarts[currentLine & (STREAM_LINE_SLOTS - 1)];
+    if (keep - stream->base > STREAM_BUFFER_SIZE / 2) {
+        size_t shift = (size_t)(keep - stream->base);
+        size_t kept = (size_t)(stream->length - keep);
+        memmove(stream->text, stream->text + shift, kept);
+        memmove(stream->typed, stream->typed + shift, kept);
+        memmove(stream->mistakes, stream->mistakes + shift, kept);
+        stream->base = keep;
+    }
+    while (stream->lineCount <= currentLine + STREAM_VISIBLE_LINES) {
+        int length;
+        const char *word = getWord(words, nextAdaptiveWord(sampler), &length);
+        streamAppendWord(stream, word, length);
+    }
+}
+
+// Start and end of a line that has been fully laid out
+void streamLine(const StreamText *stream, long long line, long long *start, long long *end) {
+    *start = stream->lineStarts[line & (STREAM_LINE_SLOTS - 1)];
+    *end = stream->lineStarts[(line + 1) & (STREAM_LINE_SLOTS - 1)];
+}
+
+// Redraw every visible line with the cursor's line at the top, then park the
+// cursor at the start of its typed row
+void renderStreamWindow(TypingView *view, const StreamText *stream, long long currentLine,
+                        AppState *state) {
+    for (int i = 0; i < STREAM_VISIBLE_LINES; i++) {
+        long long start, end;
+        streamLine(stream, currentLine + i, &start, &end);
+        framePrintf("\033[%d;1H\033[2K", STREAM_FIRST_ROW + 2 * i);
+        setViewColour(view, CYAN, state);
+        frameAppend(stream->text + (start - stream->base), (size_t)(end - start));
+        framePrintf("\033[%d;1H\033[2K", STREAM_FIRST_ROW + 2 * i + 1);
+    }
+    framePrintf("\033[%d;1H", STREAM_FIRST_ROW + 1);
+    view->cursorRow = 0;
+    view->cursorCol = 0;
+}
+
+// Count a typed character into the threshold window, dropping the oldest one
+void pushEnduranceKey(EnduranceWindow *window, long long stamp, int correct) {
+    int slot = window->count % ENDURANCE_WINDOW_KEYS;
+    if (window->count >= ENDURANCE_WINDOW_KEYS) {
+        window->correct -= window->hits[slot];
+    }
+    window->hits[slot] = (unsigned char)correct;
+    window->stamps[slot] = stamp;
+    window->correct += correct;
+    window->count++;
+}
+
+// Accuracy and WPM over the characters in the window, as of now
+// Measuring up to now rather than the last key lets a long pause count against the WPM
+void enduranceWindowStats(const EnduranceWindow *window, long long now, float *accuracy, float *wpm) {
+    int kept = (window->count < ENDURANCE_WINDOW_KEYS) ? window->count : ENDURANCE_WINDOW_KEYS;
+    *accuracy = kept ? 100.0f * window->correct / kept : 100.0f;
+    *wpm = 0;
+    if (kept > 0) {
+        long long oldest = window->stamps[(window->count - kept) % ENDURANCE_WINDOW_KEYS];
+        if (now > oldest) {
+            *wpm = (float)(kept / 5.0 / ((now - oldest) / 6e10));
+        }
+    }
+}
+
+// Redraw the status line of an endurance session, then put the cursor back
+void renderStreamStatus(TypingView *view, const EnduranceWindow *window, int words, long long now,
+                        long long start, AppState *state) {
+    float accuracy, wpm;
+    enduranceWindowStats(window, now, &accuracy, &wpm);
+    int seconds = (int)((now - start) / 1000000000LL);
+
+    char line[128];
+    int length;
+    if (window->count < ENDURANCE_WINDOW_KEYS) {
+        length = snprintf(line, sizeof(line), "Words %d | Warming up %d/%d | Time %d:%02d",
+                          words, window->count, ENDURANCE_WINDOW_KEYS, seconds / 60, seconds % 60);
+    } else {
+        length = snprintf(line, sizeof(line), "Words %d | WPM %.1f | Accuracy %.1f%% | Time %d:%02d",
+                          words, wpm, accuracy, seconds / 60, seconds % 60);
+    }
+    if (length >= view->width) {
+        length = view->width - 1;
+    }
+
+    framePrintf("\0337\033[%d;1H\033[2K", STREAM_STATUS_ROW);
+    setColour(YELLOW, state);
+    frameAppend(line, length);
+    framePrintf("\0338");
+    view->colour = -1;
+}
+
+// Run one streaming endurance session on the given word list
+// Words are generated a few lines ahead of the cursor and the display scrolls
+// a line at a time; the session runs until the accuracy or WPM over the last
+// ENDURANCE_WINDOW_KEYS characters falls below its threshold, or ESC
+// Words are drawn towards the bigrams in weakness, a table from skillWeakness
+// Returns one of the ENDURANCE_END_* reasons, or 0 when there is no memory
+int enduranceStream(AppState *state, int difficulty, const unsigned char *weakness, uint64_t seed,
+                    TypingResult *result) {
+    const WordList *words = &state->words.lists[difficulty - 1];
+    StreamText *stream = arenaAlloc(&state->session, sizeof(StreamText));
+    EnduranceWindow *window = arenaAlloc(&state->session, sizeof(EnduranceWindow));
+    AdaptiveSampler sampler;
+    if (stream == NULL || window == NULL || !initAdaptiveSampler(&sampler, &state->session, words, weakness, seed)) {
+        framePrintf("Error: Not enough memory for the test.\n");
+        return 0;
+    }
+    if (sampler.usable == 0) {
+        framePrintf("Error: Endurance mode needs words without accented or other non-ASCII letters. Please check the word file.\n");
+        return 0;
+    }
+    memset(window, 0, sizeof(EnduranceWindow));
+
+    TypingView view;
+    initTypingView(&view);
+    stream->base = 0;
+    stream->length = 0;
+    stream->lineStarts[0] = 0;
+    stream->lineCount = 1;
+    stream->lineWidth = (view.width - 1 < STREAM_MAX_LINE) ? view.width - 1 : STREAM_MAX_LINE;
+    if (stream->lineWidth < 2) {
+        stream->lineWidth = 2;
+    }
+
+    long long currentLine = 0;
+    fillStream(stream, currentLine, words, &sampler);
+
+    framePrintf("Press any key to start typing...");
+    terminalEnterRaw();
+    if (state->input.replay.data == NULL) {
+        getch();
+    }
+    clearScreen();
+    framePrintf("Endurance Mode    Press ESC at any time to end the test.");
+    renderStreamWindow(&view, stream, currentLine, state);
+
+    long long pos = 0;      // Stream offset of the cursor
+    long long furthest = 0; // Furthest the cursor has been, so words are only counted once
+    long long wordStart = 0;
+    int typedKeys = 0;
+    int mistakes = 0;
+    AlignmentCounts counts;
+    memset(&counts, 0, sizeof(counts));
+    memset(result, 0, sizeof(TypingResult));
+    unsigned char keys[KEY_BATCH_SIZE];
+    KeystrokeRing *ring = &state->keystrokes;
+    ring->count = 0;
+    long long start = monotonicNanos();
+    long long now = start;
+    long long nextRefresh = start;
+
+    // A recording has no text for a stream; the seed, difficulty and weakness table regenerate it
+    beginKeyStream(&state->input, seed, "", 0, start);
+    if (state->input.record != NULL) {
+        writeVarint(state->input.record, (uint64_t)difficulty);
+        fwrite(weakness, 1, SKILL_PAIRS, state->input.record);
+    }
+
+    int reason = 0;
+    int inputEnded = 0;
+    while (!reason) {
+        frameFlush();
+        long long wait = nextRefresh - monotonicNanos();
+        int timeout = (wait > 0) ? (int)((wait + 999999) / 1000000) : 0;
+        int keyCount = readTestKeys(&state->input, keys, KEY_BATCH_SIZE, timeout, &now);
+        if (keyCount < 0) {
+            // Input closed; a replay still checks the thresholds at the recorded end,
+            // in case the session ended during a pause
+            keyCount = 0;
+            inputEnded = 1;
+        }
+        TRACE_KEYS(keyCount);
+        TRACE_BEGIN(renderStart);
+
+        long long lineStart, lineEnd;
+        streamLine(stream, currentLine, &lineStart, &lineEnd);
+        long long low = pos;
+        long long high = pos;
+
+        for (int k = 0; k < keyCount && !reason; k++) {
+            int ch = keys[k];
+
+            if (ch == 27) {
+                if (k + 1 < keyCount && (keys[k + 1] == '[' || keys[k + 1] == 'O')) {
+                    k += 2;
+                    while (k < keyCount && (keys[k] < 0x40 || keys[k] > 0x7E)) {
+                        k++;
+                    }
+                    continue;
+                }
+                reason = ENDURANCE_END_CANCELLED;
+                continue;
+            }
+
+            if ((ch == 8 || ch == 127) && pos > lineStart) { // Lines that scrolled away are final
+                pos--;
+                recordKeystroke(ring, now);
+                if (pos < low) {
+                    low = pos;
+                }
+            }
+            else if (isprint(ch)) {
+                long long offset = pos - stream->base;
+                int correct = (ch == stream->text[offset]);
+                stream->typed[offset] = (char)ch;
+                typedKeys++;
+                recordSkill(&state->skills, offset > 0 ? stream->text[offset - 1] : ' ', stream->text[offset],
+                            correct, keystrokeGap(ring, now));
+                recordKeystroke(ring, now);
+                pushEnduranceKey(window, now, correct);
+                if (!correct && !stream->mistakes[offset]) {
+                    mistakes++;
+                    stream->mistakes[offset] = 1;
+                }
+                pos++;
+                if (pos > high) {
+                    high = pos;
+                }
+
+                if (pos > furthest) {
+                    furthest = pos;
+                    if (stream->text[offset] == ' ') { // Moved past the end of a word
+                        result->wordsCompleted++;
+                        if (memchr(stream->mistakes + (wordStart - stream->base), 1,
+                                   (size_t)(pos - wordStart)) != NULL) {
+                            result->wordErrors++;
+                        }
+                        wordStart = pos;
+                    }
+                }
+
+                if (pos == lineEnd) {
+                    // Finish drawing this line, score it and scroll the next one up
+                    const char *text = stream->text + (lineStart - stream->base);
+                    const char *typed = stream->typed + (lineStart - stream->base);
+                    moveViewCursor(&view, 0, (int)(low - lineStart));
+                    renderTyped(&view, text, typed, (int)(low - lineStart), (int)(pos - lineStart),
+                                (int)(high - lineStart), state);
+                    alignText(text, (int)(lineEnd - lineStart), typed, (int)(lineEnd - lineStart),
+                              &counts);
+                    currentLine++;
+                    fillStream(stream, currentLine, words, &sampler);
+                    renderStreamWindow(&view, stream, currentLine, state);
+                    streamLine(stream, currentLine, &lineStart, &lineEnd);
+                    low = high = pos;
+                }
+            }
+        }
+
+        const char *text = stream->text + (lineStart - stream->base);
+        const char *typed = stream->typed + (lineStart - stream->base);
+        moveViewCursor(&view, 0, (int)(low - lineStart));
+        renderTyped(&view, text, typed, (int)(low - lineStart), (int)(pos - lineStart),
+                    (int)(high - lineStart), state);
+
+        // The thresholds only apply once the window holds a full set of characters
+        if (!reason && window->count >= ENDURANCE_WINDOW_KEYS) {
+            float accuracy, wpm;
+            enduranceWindowStats(window, now, &accuracy, &wpm);
+            if (accuracy < enduranceGame.accuracyThreshold) {
+                reason = ENDURANCE_END_ACCURACY;
+            } else if (wpm < enduranceGame.wpmThreshold) {
+                reason = ENDURANCE_END_WPM;
+            }
+        }
+        if (inputEnded && !reason) {
+            reason = ENDURANCE_END_CANCELLED;
+        }
+        if (now >= nextRefresh || reason) {
+            renderStreamStatus(&view, window, result->wordsCompleted, now, start, state);
+            nextRefresh = now + HUD_REFRESH_MS * 1000000LL;
+        }
+        if (keyCount > 0) {
+            TRACE_END("render_keys", renderStart, keyCount);
+        }
+    }
+
+    // Score what is left of the current line as far as it was typed
+    long long lineStart, lineEnd;
+    streamLine(stream, currentLine, &lineStart, &lineEnd);
+    alignText(stream->text + (lineStart - stream->base), (int)(pos - lineStart),
+              stream->typed + (lineStart - stream->base), (int)(pos - lineStart), &counts);
+
+    // Keys typed after the session ended would otherwise land in the menu
+    if (state->input.replay.data == NULL) {
+        while (terminalReadKeys(keys, KEY_BATCH_SIZE, 0) > 0) {
+        }
+    }
+    setViewColour(&view, DEFAULT, state);
+    framePrintf("\033[%d;1H\n", STREAM_FIRST_ROW + 2 * STREAM_VISIBLE_LINES);
+    terminalRestore();
+    endKeyStream(&state->input, now);
+
+    double timeTaken = (now - start) / 1e9;
+    result->totalChars = typedKeys;
+    result->correctChars = typedKeys - mistakes;
+    result->accuracy = (typedKeys == 0) ? 0 : (100.0f * result->correctChars / typedKeys);
+    result->wpm = (timeTaken > 0) ? (float)(pos / 5.0 / (timeTaken / 60.0)) : 0;
+    result->timeTaken = (float)timeTaken;
+    result->mistyped = counts.mistyped;
+    result->missed = counts.missed;
+    result->extra = counts.extra;
+    computeLatencyPercentiles(ring, result);
+    return reason;
+}
+
+//Print the cool ascii title art
+void print_ascii_art(const char *filename, AppState *state) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        frameFlush(); // Keep the error after anything already shown
+        perror("Error opening ASCII art file");
+        return;
+    }
+
+    char line[256];
+    int lineNumber = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        // Alternate colors for each line
+        if (lineNumber % 3 == 0)
+            setColour(GREEN, state);
+        else if (lineNumber % 3 == 1)
+            setColour(CYAN, state);
+        else
+            setColour(YELLOW, state);
+
+        frameAppend(line, strlen(line));
+        lineNumber++;
+    }
+
+    setColour(DEFAULT, state); // Reset to default
+    fclose(file);
+}
+
+//Raw Speed Mode function
+void rawSpeedMode(AppState *state) {
+    framePrintf("\n===== Raw Speed Mode =====\n");
+    int difficulty = chooseDifficulty(&rawSpeedGame, state);
+    
+    WordList *words = &state->words.lists[difficulty - 1];
+    if (words->count == 0) {
+        framePrintf("Error: No words loaded for this difficulty. Please make sure the word file exists.\n");
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+    
+    // Number of words to include in test
+    int numTestWords = chooseWordCount(&rawSpeedGame, "test");
+    
+    if (numTestWords > words->count) {
+        framePrintf("Not enough words in file. Using all %d available words.\n", words->count);
+        numTestWords = words->count;
+    }
+    
+    // Create test text from random words, never using the same word twice
+    TextBuilder targetText;
+    uint64_t seed = buildRandomText(state, words, numTestWords, &targetText);
+    
+    framePrintf("\n===== Raw Speed Test =====\n");
+    framePrintf("Seed: %llu (run with --seed %llu to replay this text)\n",
+           (unsigned long long)seed, (unsigned long long)seed);
+    framePrintf("Type as fast and accurately as you can!\n");
+    framePrintf("Press ESC at any time to end the test.\n\n");
+    
+    // Run the typing test
+    TypingResult result;
+    if (!typingTest(&rawSpeedGame, &targetText, &result, state)) {
+        framePrintf("Press any key to continue...");
+        getch();
+        return; // Cancelled tests are not scored
+    }
+    
+    // Process results
+    appendHistory(state, &result, rawSpeedGame.historyMode, difficulty);
+    saveSkills(state);
+    TypingResult results[1] = {result};
+    processTypingResults(&rawSpeedGame, results, 1, state);
+}
+
+// Race everyone connected to a relay on one text, showing the standings while typing
+// Results count like a raw speed test towards the user's stats and the leaderboard
+void raceMode(AppState *state) {
+    framePrintf("\n===== Race Mode =====\n");
+    framePrintf("Everybody connected to the same race server types the same text at once.\n");
+    framePrintf("Race server (press ENTER for %s): ", state->raceAddress);
+    frameFlush();
+
+    char address[RACE_ADDRESS_LEN];
+    if (fgets(address, sizeof(address), stdin) == NULL) {
+        return;
+    }
+    address[strcspn(address, "\r\n")] = '\0';
+    if (address[0] != '\0') {
+        snprintf(state->raceAddress, sizeof(state->raceAddress), "%s", address);
+    }
+
+    RaceClient *client = malloc(sizeof(RaceClient));
+    char (*names)[MAX_NAME_LEN] = calloc(RACE_MAX_CLIENTS, MAX_NAME_LEN);
+    if (client == NULL || names == NULL) {
+        framePrintf("Error: Not enough memory for a race.\n");
+        free(client);
+        free(names);
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+    client->names = names;
+    if (!raceNetInit() ||
+        !raceConnect(client, state->raceAddress, state->users[state->currentUserIndex].name)) {
+        free(client->names);
+        free(client);
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+    framePrintf("Connected to %s.\n", state->raceAddress);
+
+    if (!raceLobby(client, state)) {
+        raceDisconnect(client);
+        free(client->names);
+        free(client);
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+
+    // Every client counts down from the start packet, so the race starts together
+    // Keys pressed during the countdown are thrown away
+    unsigned char keys[KEY_BATCH_SIZE];
+    terminalEnterRaw();
+    for (int seconds = RACE_COUNTDOWN; seconds > 0; seconds--) {
+        framePrintf("\rThe race starts in %d...", seconds);
+        frameFlush();
+        long long deadline = monotonicNanos() + 1000000000LL;
+        for (long long now = monotonicNanos(); now < deadline; now = monotonicNanos()) {
+            racePoll(client, 0);
+            if (terminalReadKeys(keys, KEY_BATCH_SIZE, (int)((deadline - now + 999999) / 1000000)) < 0) {
+                break; // Input closed; nothing to wait for
+            }
+        }
+    }
+    terminalRestore();
+
+    // appendWord puts back the single spaces between words
+    resetArena(&state->session);
+    TextBuilder text;
+    initTextBuilder(&text, &state->session);
+    int start, end;
+    for (int from = 0; nextWord(client->text, client->textLength, from, &start, &end); from = end) {
+        if (!appendWord(&text, client->text + start, end - start)) {
+            break; // Out of memory, race on what we have
+        }
+    }
+    state->testSeed = client->seed;
+    framePrintf("\n\n===== Race =====\n");
+    framePrintf("Seed: %llu\n\n", (unsigned long long)client->seed);
+
+    TypingResult result;
+    state->race = client;
+    int finished = typingTest(&raceGame, &text, &result, state);
+    state->race = NULL;
+    if (!finished) {
+        raceDisconnect(client); // Leaving the race is leaving the server
+        free(client->names);
+        free(client);
+        framePrintf("Press any key to continue...");
+        getch();
+        return; // Cancelled races are not scored
+    }
+
+    // Disconnect before the results screen, so the next race does not wait for us
+    int difficulty = client->difficulty;
+    raceResults(client, state);
+    raceDisconnect(client);
+    free(client->names);
+    free(client);
+
+    appendHistory(state, &result, raceGame.historyMode, difficulty);
+    saveSkills(state);
+    TypingResult results[1] = {result};
+    processTypingResults(&raceGame, results, 1, state);
+}
+
+// Wait in the lobby until a race starts; the host starts one with ENTER
+// Returns 1 once a race has started, 0 if the player left or the connection was lost
+int raceLobby(RaceClient *client, AppState *state) {
+    framePrintf("Waiting for the race to start. Press ESC to leave.\n");
+    unsigned char keys[KEY_BATCH_SIZE];
+    terminalEnterRaw();
+    while (!client->started) {
+        frameFlush();
+        if (!racePoll(client, 1)) {
+            terminalRestore();
+            framePrintf("Lost the connection to the race server.\n");
+            return 0;
+        }
+        if (client->started) {
+            break;
+        }
+
+        int count = terminalReadKeys(keys, KEY_BATCH_SIZE, RACE_SEND_MS);
+        if (count < 0) {
+            keys[0] = 27; // Input closed, treat it like ESC
+            count = 1;
+        }
+        for (int k = 0; k < count; k++) {
+            if (keys[k] == 27) {
+                terminalRestore();
+                framePrintf("Left the race.\n");
+                return 0;
+            }
+            if ((keys[k] == '\r' || keys[k] == '\n') && client->hostId == client->id) {
+                terminalRestore();
+                raceHostStart(client, state);
+                terminalEnterRaw();
+                break;
+            }
+        }
+    }
+    terminalRestore();
+    return 1;
+}
+
+// Ask the host for the race settings and send the relay the text to race on
+// Returns 0 if nothing was sent
+int raceHostStart(RaceClient *client, AppState *state) {
+    int difficulty = chooseDifficulty(&raceGame, state);
+    WordList *words = &state->words.lists[difficulty - 1];
+    if (words->count == 0) {
+        framePrintf("Error: No words loaded for this difficulty. Please make sure the word file exists.\n");
+        return 0;
+    }
+    int numTestWords = chooseWordCount(&raceGame, "race");
+
+    TextBuilder text;
+    uint64_t seed = buildRandomText(state, words, numTestWords, &text);
+    if (text.length == 0 || text.length > RACE_MAX_TEXT) {
+        framePrintf("Error: The race text must be 1 to %d characters long.\n", RACE_MAX_TEXT);
+        return 0;
+    }
+    if (!raceTextValid(text.text, text.length)) {
+        framePrintf("Error: The race text has characters the race server does not accept. Please check the word file.\n");
+        return 0;
+    }
+
+    unsigned char payload[11 + RACE_MAX_TEXT];
+    racePut64(payload, seed);
+    payload[8] = (unsigned char)difficulty;
+    racePut16(payload + 9, (uint32_t)text.length);
+    memcpy(payload + 11, text.text, text.length);
+    framePrintf("Starting the race...\n");
+    return raceSend(client, RACE_PACKET_START, payload, 11 + text.length);
+}
+
+// A race text is well-formed UTF-8 with no control characters, which the
+// relay and every racer check the same way
+int raceTextValid(const char *text, int length) {
+    for (int i = 0; i < length;) {
+        uint32_t codepoint;
+        int bytes = decodeUtf8(text + i, (size_t)(length - i), &codepoint);
+        if ((bytes == 1 && (unsigned char)text[i] >= 0x80) || codepoint < 32 ||
+            (codepoint >= 0x7F && codepoint < 0xA0)) {
+            return 0;
+        }
+        i += bytes;
+    }
+    return 1;
+}
+
+// Wait for the final standings, or for a key, then print the standings
+void raceResults(RaceClient *client, AppState *state) {
+    framePrintf("Waiting for the other racers. Press any key to stop waiting...\n");
+    unsigned char keys[KEY_BATCH_SIZE];
+    terminalEnterRaw();
+    while (!client->over && racePoll(client, 0)) {
+        frameFlush();
+        if (terminalReadKeys(keys, KEY_BATCH_SIZE, RACE_SEND_MS) != 0) {
+            break;
+        }
+    }
+    terminalRestore();
+
+    framePrintf("\n===== Race %s =====\n", client->over ? "Results" : "Standings");
+    for (int i = 0; i < client->boardCount; i++) {
+        const RaceStanding *racer = &client->board[i];
+        setColour(racer->id == client->id ? GREEN : DEFAULT, state);
+        if (racer->finished) {
+            framePrintf("%d. %s: %.2f seconds, %u mistakes\n", i + 1, client->names[racer->id],
+                        racer->stamp / 1000.0, (unsigned)racer->errors);
+        } else {
+            framePrintf("%d. %s: %d%% of the text\n", i + 1, client->names[racer->id],
+                        (int)(100.0 * racer->pos / client->textChars));
+        }
+    }
+    setColour(DEFAULT, state);
+    if (client->place > 0) {
+        framePrintf("You placed %d of %d.\n", client->place, client->racers);
+    }
+}
+
+// Type a passage of any text or source file, a few lines per test
+// The file is mapped, never read whole; only the lines being typed are copied
+void textMode(AppState *state) {
+    framePrintf("\n===== Text Mode =====\n");
+    framePrintf("Type a passage of any text or source file, line breaks and indentation included.\n");
+    if (state->textFile[0] != '\0') {
+        framePrintf("Text file (press ENTER for %s): ", state->textFile);
+    } else {
+        framePrintf("Text file: ");
+    }
+    frameFlush();
+
+    char fileName[TEXT_PATH_LEN];
+    if (fgets(fileName, sizeof(fileName), stdin) == NULL) {
+        return;
+    }
+    fileName[strcspn(fileName, "\r\n")] = '\0';
+    if (fileName[0] == '\0') {
+        if (state->textFile[0] == '\0') {
+            return;
+        }
+        snprintf(fileName, sizeof(fileName), "%s", state->textFile);
+    }
+
+    TextSource source;
+    if (!openTextSource(fileName, &source)) {
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+    snprintf(state->textFile, sizeof(state->textFile), "%s", fileName);
+
+    // The seed picks the window, so --seed gives the same passage of the same file
+    uint64_t seed = takeTestSeed(state);
+    Rng rng;
+    seedRng(&rng, seed);
+    int window = (int)rngBounded(&rng, (uint32_t)source.windowCount);
+    int firstLine = source.windowStarts[window];
+    int lastLine = (window + 1 < source.windowCount) ? source.windowStarts[window + 1] : source.lineCount;
+    size_t offset = source.lineStarts[firstLine];
+    size_t end = source.lineStarts[lastLine];
+
+    framePrintf("\n===== Text Test =====\n");
+    framePrintf("Seed: %llu (run with --seed %llu to replay this passage)\n",
+           (unsigned long long)seed, (unsigned long long)seed);
+    framePrintf("%s, lines %d-%d\n", fileName, firstLine + 1, lastLine);
+    framePrintf("Press ENTER at the end of each line; indentation is filled in for you.\n");
+    framePrintf("Press ESC at any time to end the test.\n");
+
+    // Each part is built from the mapping just before it is typed
+    TypingResult results[TEXT_WINDOW_CHUNKS];
+    int count = 0;
+    while (count < TEXT_WINDOW_CHUNKS) {
+        resetArena(&state->session);
+        TextBuilder text;
+        initTextBuilder(&text, &state->session);
+        int partLine = textLineAt(&source, offset);
+        if (!appendSnippet(&text, source.map.data, &offset, end)) {
+            break; // The passage is done, or out of memory
+        }
+        framePrintf("\nLines %d-%d:\n", partLine + 1, textLineAt(&source, offset - 1) + 1);
+        if (!typingTest(&textGame, &text, &results[count], state)) {
+            break; // Cancelled; the parts already typed still count
+        }
+        appendHistory(state, &results[count], textGame.historyMode, 0);
+        count++;
+    }
+    closeTextSource(&source);
+
+    if (count == 0) {
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+    saveSkills(state);
+    processTypingResults(&textGame, results, count, state);
+}
+
+// Map a text file and index where its lines and windows start
+// Returns 0, after saying why, when the file cannot be used
+int openTextSource(const char *fileName, TextSource *source) {
+    memset(source, 0, sizeof(*source));
+    if (!mapFile(fileName, &source->map)) {
+        framePrintf("Error: Could not open %s, or it is empty.\n", fileName);
+        return 0;
+    }
+    const char *data = source->map.data;
+    size_t size = source->map.size;
+    if (memchr(data, '\0', size) != NULL) {
+        framePrintf("Error: %s is not a text file.\n", fileName);
+        closeTextSource(source);
+        return 0;
+    }
+
+    int lines = (data[size - 1] != '\n'); // A last line without a newline
+    for (const char *p = data; (p = memchr(p, '\n', data + size - p)) != NULL; p++) {
+        lines++;
+    }
+    source->lineStarts = malloc(((size_t)lines + 1) * sizeof(size_t));
+    source->windowStarts = malloc((size_t)lines * sizeof(int));
+    if (source->lineStarts == NULL || source->windowStarts == NULL) {
+        framePrintf("Error: Not enough memory for %s.\n", fileName);
+        closeTextSource(source);
+        return 0;
+    }
+
+    size_t at = 0;
+    int previousBlank = 1;
+    int lastWindow = -TEXT_WINDOW_LINES;
+    while (at < size) {
+        const char *newline = memchr(data + at, '\n', size - at);
+        size_t next = newline ? (size_t)(newline - data) + 1 : size;
+        int line = source->lineCount++;
+        source->lineStarts[line] = at;
+
+        int blank = 1;
+        for (size_t i = at; i < next && blank; i++) {
+            blank = isspace((unsigned char)data[i]);
+        }
+        // A closing bracket ends the block before it rather than starting one
+        int opens = (strchr(" \t})]", data[at]) == NULL);
+        if (!blank && ((previousBlank && opens) || line - lastWindow >= TEXT_WINDOW_LINES)) {
+            source->windowStarts[source->windowCount++] = line;
+            lastWindow = line;
+        }
+        previousBlank = blank;
+        at = next;
+    }
+    source->lineStarts[source->lineCount] = size;
+
+    if (source->windowCount == 0) {
+        framePrintf("Error: %s has nothing to type.\n", fileName);
+        closeTextSource(source);
+        return 0;
+    }
+    return 1;
+}
+
+void closeTextSource(TextSource *source) {
+    free(source->lineStarts);
+    free(source->windowStarts);
+    unmapFile(&source->map);
+    memset(source, 0, sizeof(*source));
+}
+
+// Line holding a byte offset of the file, by binary search of the line index
+int textLineAt(const TextSource *source, size_t offset) {
+    int low = 0;
+    int high = source->lineCount - 1;
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (source->lineStarts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// Append file text from *offset up to end, at most TEXT_CHUNK_LINES lines,
+// TEXT_CHUNK_CHARS characters and GLYPH_TABLE_SIZE distinct non-ASCII
+// characters, and move *offset past what was taken
+// Tabs become spaces up to the next tab stop, a malformed UTF-8 byte becomes
+// '?', other unprintable bytes and trailing blanks are dropped, and blank
+// lines are kept single and never start or end the part
+// A line too long for a part of its own is split after its last space that fits
+// Returns the number of bytes appended: 0 at end, or when out of memory
+int appendSnippet(TextBuilder *builder, const char *data, size_t *offset, size_t end) {
+    // A tab can take a line TEXT_TAB_WIDTH - 1 past the limit
+    if (!reserveText(builder, TEXT_CHUNK_CHARS * 4 + TEXT_TAB_WIDTH)) {
+        return 0;
+    }
+    char *out = builder->text;
+    int base = builder->length;
+    int length = base;
+    int chars = 0;
+    uint32_t seen[GLYPH_TABLE_SIZE]; // Distinct non-ASCII characters taken, which one test can hold
+    int seenCount = 0;
+    int lines = 0;
+    int previousBlank = 0;
+    size_t at = *offset;
+
+    while (at < end && lines < TEXT_CHUNK_LINES) {
+        const char *newline = memchr(data + at, '\n', end - at);
+        size_t lineEnd = newline ? (size_t)(newline - data) : end;
+        size_t next = newline ? lineEnd + 1 : end;
+
+        int lineStart = length; // Where the line is taken back from when it does not fit
+        int lineChars = chars;
+        if (length > base) {
+            out[length++] = '\n';
+            chars++;
+        }
+        int textStart = length;
+        int column = 0;
+        int breakLength = -1; // Text length, characters and file offset just after the last space
+        int breakChars = 0;
+        size_t breakSource = at;
+        int full = 0;
+        size_t i;
+        for (i = at; i < lineEnd; i++) {
+            unsigned char ch = (unsigned char)data[i];
+            if (chars >= TEXT_CHUNK_CHARS) {
+                full = 1;
+                break;
+            }
+            if (ch == '\t') {
+                do {
+                    out[length++] = ' ';
+                    chars++;
+                } while (++column % TEXT_TAB_WIDTH != 0);
+            } else if (ch >= 32 && ch < 127) {
+                out[length++] = (char)ch;
+                chars++;
+                column++;
+            } else if (ch >= 0x80) {
+                uint32_t codepoint;
+                int bytes = decodeUtf8(data + i, lineEnd - i, &codepoint);
+                if (bytes == 1) {
+                    out[length++] = '?';
+                    chars++;
+                    column++;
+                    continue;
+                }
+                int known = 0;
+                while (known < seenCount && seen[known] != codepoint) {
+                    known++;
+                }
+                if (known == seenCount) {
+                    if (seenCount == GLYPH_TABLE_SIZE) {
+                        full = 1;
+                        break;
+                    }
+                    seen[seenCount++] = codepoint;
+                }
+                memcpy(out + length, data + i, bytes);
+                length += bytes;
+                chars++;
+                column += codepointWidth(codepoint);
+                i += bytes - 1;
+            } else {
+                continue;
+            }
+            if (ch == ' ' || ch == '\t') {
+                breakLength = length;
+                breakChars = chars;
+                breakSource = i + 1;
+            }
+        }
+        if (full) {
+            if (lines > 0) {
+                length = lineStart; // The line starts the next part instead
+                chars = lineChars;
+                break;
+            }
+            if (breakLength > textStart) {
+                length = breakLength;
+                chars = breakChars;
+                next = breakSource;
+            } else {
+                next = i; // No space to split at, so split the word
+            }
+        }
+        while (length > textStart && out[length - 1] == ' ') {
+            length--;
+            chars--;
+        }
+
+        int blank = (length == textStart);
+        if (blank && (lines == 0 || previousBlank)) {
+            length = lineStart;
+            chars = lineChars;
+        } else {
+            lines++;
+            previousBlank = blank;
+        }
+        at = next;
+        if (full && length > base) {
+            break;
+        }
+    }
+    while (length > base && (out[length - 1] == '\n' || out[length - 1] == ' ')) {
+        length--; // A blank line before the end of the window
+    }
+
+    builder->length = length;
+    out[length] = '\0';
+    *offset = at;
+    if (!markWords(builder, base)) {
+        return 0;
+    }
+    return length - base;
+}
+
+// Fill text with count distinct random words under a new test seed
+// The session arena is reset first; returns the seed
+uint64_t buildRandomText(AppState *state, const WordList *words, int count, TextBuilder *text) {
+    WordSampler sampler;
+    initWordSampler(&sampler, takeTestSeed(state));
+    beginSample(&sampler, words->count);
+    resetArena(&state->session);
+    initTextBuilder(text, &state->session);
+    for (int i = 0; i < count && i < words->count; i++) {
+        int length;
+        const char *word = getWord(words, nextSample(&sampler), &length);
+        if (!appendWord(text, word, length)) {
+            break; // Out of memory, play what we have
+        }
+    }
+    uint64_t seed = sampler.seed;
+    freeWordSampler(&sampler);
+    return seed;
+}
+
+// Build the line of standings shown above the text during a race
+// Returns its length, which is always less than size
+int formatRaceLine(const RaceClient *client, char *buffer, int size) {
+    int length;
+    if (client->place > 0) {
+        length = snprintf(buffer, size, "Race: place %d of %d", client->place, client->racers);
+    } else {
+        length = snprintf(buffer, size, "Race: press ESC to leave");
+    }
+    for (int i = 0; i < client->boardCount && length < size; i++) {
+        const RaceStanding *racer = &client->board[i];
+        const char *name = (racer->id == client->id) ? "you" : client->names[racer->id];
+        if (racer->finished) {
+            length += snprintf(buffer + length, size - length, " | %d. %s done", i + 1, name);
+        } else {
+            length += snprintf(buffer + length, size - length, " | %d. %s %d%%", i + 1, name,
+                               (int)(100.0 * racer->pos / client->textChars));
+        }
+    }
+    return (length < size) ? length : size - 1;
+}
+
+// Redraw the standings on the header line, two rows above the typing area,
+// then put the cursor back
+void renderRaceLine(TypingView *view, RaceClient *client, AppState *state) {
+    client->boardChanged = 0;
+    if (view->cursorRow + 3 > view->height) {
+        return; // The line has scrolled off the top of the console
+    }
+    char line[256];
+    int length = formatRaceLine(client, line, sizeof(line));
+    if (length >= view->width) {
+        length = view->width - 1; // Never wrap into the status line
+    }
+    framePrintf("\0337\033[%dA\r\033[2K", view->cursorRow + 2); // Save cursor, up to the line
+    setColour(DEFAULT, state);
+    frameAppend(line, length);
+    framePrintf("\0338"); // Restore cursor and colour
+    view->colour = -1;
+}
+
+// Start the socket layer once: Windows needs WSAStartup, and on Unix a write
+// to a closed connection has to fail instead of raising SIGPIPE
+int raceNetInit(void) {
+    static int ready = 0;
+    if (ready) {
+        return 1;
+    }
+    #ifdef _WIN32
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+            framePrintf("Error: Could not start networking.\n");
+            return 0;
+        }
+    #else
+        signal(SIGPIPE, SIG_IGN);
+    #endif
+    ready = 1;
+    return 1;
+}
+
+void raceCloseSocket(RaceSocket sock) {
+    #ifdef _WIN32
+        closesocket(sock);
+    #else
+        close(sock);
+    #endif
+}
+
+int raceSetNonBlocking(RaceSocket sock) {
+    #ifdef _WIN32
+        u_long on = 1;
+        return ioctlsocket(sock, FIONBIO, &on) == 0;
+    #else
+        int flags = fcntl(sock, F_GETFL, 0);
+        return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+    #endif
+}
+
+// Whether the last failed send or recv only means "try again later"
+int raceWouldBlock(void) {
+    #ifdef _WIN32
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+    #else
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    #endif
+}
+
+// Packet fields are little-endian whatever the CPU
+void racePut16(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+}
+
+void racePut32(unsigned char *p, uint32_t value) {
+    racePut16(p, value & 0xFFFF);
+    racePut16(p + 2, value >> 16);
+}
+
+void racePut64(unsigned char *p, uint64_t value) {
+    racePut32(p, (uint32_t)value);
+    racePut32(p + 4, (uint32_t)(value >> 32));
+}
+
+uint32_t raceGet16(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+uint32_t raceGet32(const unsigned char *p) {
+    return raceGet16(p) | (raceGet16(p + 2) << 16);
+}
+
+uint64_t raceGet64(const unsigned char *p) {
+    return (uint64_t)raceGet32(p) | ((uint64_t)raceGet32(p + 4) << 32);
+}
+
+// Connect to a relay at "host:port" (the port defaults to RACE_DEFAULT_PORT) and say hello
+int raceConnect(RaceClient *client, const char *address, const char *name) {
+    char host[RACE_ADDRESS_LEN];
+    const char *port = RACE_DEFAULT_PORT;
+    snprintf(host, sizeof(host), "%s", address);
+    char *colon = strrchr(host, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &found) != 0) {
+        framePrintf("Error: Could not find the race server %s.\n", address);
+        return 0;
+    }
+    client->socket = RACE_INVALID_SOCKET;
+    for (struct addrinfo *candidate = found; candidate != NULL; candidate = candidate->ai_next) {
+        RaceSocket sock = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (sock == RACE_INVALID_SOCKET) {
+            continue;
+        }
+        if (connect(sock, candidate->ai_addr, (int)candidate->ai_addrlen) == 0) {
+            client->socket = sock;
+            break;
+        }
+        raceCloseSocket(sock);
+    }
+    freeaddrinfo(found);
+    if (client->socket == RACE_INVALID_SOCKET || !raceSetNonBlocking(client->socket)) {
+        if (client->socket != RACE_INVALID_SOCKET) {
+            raceCloseSocket(client->socket);
+        }
+        framePrintf("Error: Could not connect to the race server %s.\n", address);
+        return 0;
+    }
+    int on = 1; // Progress packets are tiny and should not wait for company
+    setsockopt(client->socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+
+    client->connected = 1;
+    client->id = -1;
+    client->hostId = -1;
+    client->inboxUsed = 0;
+    client->outboxUsed = 0;
+    client->started = 0;
+    client->difficulty = 0;
+    client->textLength = 0;
+    client->racers = 0;
+    client->place = 0;
+    client->over = 0;
+    client->boardChanged = 0;
+    client->boardCount = 0;
+    client->sentPos = -1;
+    client->sentErrors = -1;
+    client->nextSend = 0;
+
+    unsigned char hello[2 + MAX_NAME_LEN];
+    int nameLength = (int)strlen(name);
+    racePut16(hello, RACE_PROTOCOL_VERSION);
+    memcpy(hello + 2, name, nameLength);
+    return raceSend(client, RACE_PACKET_HELLO, hello, 2 + nameLength);
+}
+
+void raceDisconnect(RaceClient *client) {
+    if (client->connected) {
+        raceCloseSocket(client->socket);
+        client->connected = 0;
+    }
+}
+
+// Queue a packet for the relay and send as much as the socket will take
+// Returns 0 once the connection is lost
+int raceSend(RaceClient *client, int type, const unsigned char *payload, int length) {
+    if (!client->connected) {
+        return 0;
+    }
+    if (client->outboxUsed + RACE_HEADER_SIZE + length > RACE_CLIENT_OUTBOX) {
+        return 1; // The relay is not keeping up; this packet is dropped
+    }
+    unsigned char *packet = client->outbox + client->outboxUsed;
+    packet[0] = (unsigned char)type;
+    racePut16(packet + 1, (uint32_t)length);
+    memcpy(packet + RACE_HEADER_SIZE, payload, length);
+    client->outboxUsed += RACE_HEADER_SIZE + length;
+    return raceFlush(client);
+}
+
+// Send what is queued for the relay, without waiting
+// Returns 0 once the connection is lost
+int raceFlush(RaceClient *client) {
+    int sent = 0;
+    while (client->connected && sent < client->outboxUsed) {
+        int wrote = (int)send(client->socket, (const char *)client->outbox + sent,
+                              client->outboxUsed - sent, 0);
+        if (wrote < 0 && raceWouldBlock()) {
+            break;
+        }
+        if (wrote <= 0) {
+            raceDisconnect(client);
+            return 0;
+        }
+        sent += wrote;
+    }
+    memmove(client->outbox, client->outbox + sent, client->outboxUsed - sent);
+    client->outboxUsed -= sent;
+    return client->connected;
+}
+
+// Send what is queued, then read and act on everything the relay has sent, without waiting
+// announce prints lobby events; while typing they are only recorded
+// Returns 0 once the connection is lost
+int racePoll(RaceClient *client, int announce) {
+    if (!raceFlush(client)) {
+        return 0;
+    }
+    while (client->connected) {
+        int got = (int)recv(client->socket, (char *)client->inbox + client->inboxUsed,
+                            RACE_MAX_PACKET - client->inboxUsed, 0);
+        if (got < 0 && raceWouldBlock()) {
+            break;
+        }
+        if (got <= 0) {
+            raceDisconnect(client);
+            break;
+        }
+        client->inboxUsed += got;
+
+        // Act on whole packets; the start of a partial one moves to the front
+        int used = 0;
+        while (client->inboxUsed - used >= RACE_HEADER_SIZE) {
+            int length = (int)raceGet16(client->inbox + used + 1);
+            if (RACE_HEADER_SIZE + length > RACE_MAX_PACKET) {
+                raceDisconnect(client); // Not a relay we understand
+                return 0;
+            }
+            if (client->inboxUsed - used < RACE_HEADER_SIZE + length) {
+                break;
+            }
+            raceClientPacket(client, client->inbox[used], client->inbox + used + RACE_HEADER_SIZE,
+                             length, announce);
+            used += RACE_HEADER_SIZE + length;
+        }
+        memmove(client->inbox, client->inbox + used, client->inboxUsed - used);
+        client->inboxUsed -= used;
+    }
+    return client->connected;
+}
+
+// Act on one packet from the relay
+void raceClientPacket(RaceClient *client, int type, const unsigned char *payload, int length,
+                      int announce) {
+    // WELCOME, JOIN, LEAVE and HOST start with a racer id
+    int id = (length >= 2) ? (int)raceGet16(payload) : -1;
+    if (id >= RACE_MAX_CLIENTS) {
+        id = -1;
+    }
+
+    if (type == RACE_PACKET_WELCOME && id >= 0) {
+        client->id = id;
+    } else if (type == RACE_PACKET_JOIN && id >= 0) {
+        int nameLength = (length - 2 < MAX_NAME_LEN - 1) ? length - 2 : MAX_NAME_LEN - 1;
+        memcpy(client->names[id], payload + 2, nameLength);
+        client->names[id][nameLength] = '\0';
+        if (announce && id != client->id) {
+            framePrintf("%s joined.\n", client->names[id]);
+        }
+    } else if (type == RACE_PACKET_LEAVE && id >= 0) {
+        if (announce) {
+            framePrintf("%s left.\n", client->names[id]); // The name stays for the standings
+        }
+    } else if (type == RACE_PACKET_HOST && id >= 0) {
+        if (announce && id != client->hostId) {
+            if (id == client->id) {
+                framePrintf("You are the host. Press ENTER to start a race.\n");
+            } else {
+                framePrintf("%s is the host and will start the race.\n", client->names[id]);
+            }
+        }
+        client->hostId = id;
+    } else if (type == RACE_PACKET_REFUSED && !client->started) {
+        if (announce) {
+            framePrintf("The race server did not accept the race. Press ENTER to try again.\n");
+        }
+    } else if (type == RACE_PACKET_START && length >= 11 && !client->started) {
+        int textLength = (int)raceGet16(payload + 9);
+        if (textLength > 0 && textLength <= RACE_MAX_TEXT && length >= 11 + textLength &&
+            raceTextValid((const char *)payload + 11, textLength)) {
+            client->seed = raceGet64(payload);
+            client->difficulty = payload[8];
+            memcpy(client->text, payload + 11, textLength);
+            client->text[textLength] = '\0';
+            client->textLength = textLength;
+            client->textChars = 0;
+            for (int i = 0; i < textLength; i++) {
+                client->textChars += ((unsigned char)client->text[i] & 0xC0) != 0x80;
+            }
+            client->started = 1;
+        }
+    } else if (type == RACE_PACKET_BOARD && length >= 6 && client->started) {
+        int shown = payload[5];
+        if (shown > RACE_BOARD_SIZE || length < 6 + shown * RACE_BOARD_ENTRY_SIZE) {
+            return;
+        }
+        client->over = payload[0] & RACE_BOARD_OVER;
+        client->racers = (int)raceGet16(payload + 1);
+        client->place = (int)raceGet16(payload + 3);
+        for (int i = 0; i < shown; i++) {
+            const unsigned char *entry = payload + 6 + i * RACE_BOARD_ENTRY_SIZE;
+            client->board[i].id = (int)raceGet16(entry) % RACE_MAX_CLIENTS;
+            client->board[i].finished = entry[2];
+            client->board[i].pos = raceGet32(entry + 3);
+            client->board[i].errors = raceGet32(entry + 7);
+            client->board[i].stamp = raceGet32(entry + 11);
+        }
+        client->boardCount = shown;
+        client->boardChanged = 1;
+    }
+    // Other packets are skipped, so a newer relay can add its own
+}
+
+// Report our progress to the relay, at most every RACE_SEND_MS and only when it
+// changed; the final report goes out straight away
+void raceProgress(RaceClient *client, int pos, int errors, long long now, int finished) {
+    if (!finished && (now < client->nextSend || client->outboxUsed > 0 ||
+                      (pos == client->sentPos && errors == client->sentErrors))) {
+        return; // Too soon, the last report is still queued, or nothing to say
+    }
+    unsigned char payload[12];
+    racePut32(payload, (uint32_t)pos);
+    racePut32(payload + 4, (uint32_t)errors);
+    racePut32(payload + 8, (uint32_t)((now - client->start) / 1000000));
+    raceSend(client, finished ? RACE_PACKET_FINISH : RACE_PACKET_PROGRESS, payload, sizeof(payload));
+    client->sentPos = pos;
+    client->sentErrors = errors;
+    client->nextSend = now + RACE_SEND_MS * 1000000LL;
+}
+
+// Order racers for the standings: finished racers by finishing time, then the
+// rest by how far they are, fewest errors first on a tie
+int compareStandings(const void *a, const void *b) {
+    const RaceStanding *left = a;
+    const RaceStanding *right = b;
+    if (left->finished != right->finished) {
+        return right->finished - left->finished;
+    }
+    if (!left->finished && left->pos != right->pos) {
+        return (left->pos > right->pos) ? -1 : 1;
+    }
+    if (!left->finished && left->errors != right->errors) {
+        return (left->errors < right->errors) ? -1 : 1;
+    }
+    if (left->stamp != right->stamp) {
+        return (left->stamp < right->stamp) ? -1 : 1;
+    }
+    return left->id - right->id;
+}
+
+// Open the poller with nothing watched
+int pollerOpen(RacePoller *poller) {
+    #if defined(RACE_POLL_EPOLL)
+        poller->fd = epoll_create1(0);
+        return poller->fd >= 0;
+    #elif defined(RACE_POLL_KQUEUE)
+        poller->fd = kqueue();
+        return poller->fd >= 0;
+    #else
+        poller->fds = malloc((RACE_MAX_CLIENTS + 1) * sizeof(RacePollFd));
+        poller->tokens = malloc((RACE_MAX_CLIENTS + 1) * sizeof(int));
+        poller->entryOf = malloc((RACE_MAX_CLIENTS + 1) * sizeof(int));
+        poller->count = 0;
+        poller->rotate = 0;
+        if (poller->fds == NULL || poller->tokens == NULL || poller->entryOf == NULL) {
+            pollerClose(poller);
+            return 0;
+        }
+        for (int i = 0; i <= RACE_MAX_CLIENTS; i++) {
+            poller->entryOf[i] = -1;
+        }
+        return 1;
+    #endif
+}
+
+// Watch a socket for input; token comes back with its events
+int pollerAdd(RacePoller *poller, RaceSocket sock, int token) {
+    #if defined(RACE_POLL_EPOLL)
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = (uint32_t)token;
+        return epoll_ctl(poller->fd, EPOLL_CTL_ADD, sock, &event) == 0;
+    #elif defined(RACE_POLL_KQUEUE)
+        struct kevent change;
+        EV_SET(&change, sock, EVFILT_READ, EV_ADD, 0, 0, (void *)(intptr_t)token);
+        return kevent(poller->fd, &change, 1, NULL, 0, NULL) == 0;
+    #else
+        int entry = poller->count++;
+        poller->fds[entry].fd = sock;
+        poller->fds[entry].events = POLLIN;
+        poller->fds[entry].revents = 0;
+        poller->tokens[entry] = token;
+        poller->entryOf[token] = entry;
+        return 1;
+    #endif
+}
+
+// Start or stop reporting when a socket can take more output
+int pollerWatchWrite(RacePoller *poller, RaceSocket sock, int token, int enable) {
+    #if defined(RACE_POLL_EPOLL)
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+        event.data.u32 = (uint32_t)token;
+        return epoll_ctl(poller->fd, EPOLL_CTL_MOD, sock, &event) == 0;
+    #elif defined(RACE_POLL_KQUEUE)
+        struct kevent change;
+        EV_SET(&change, sock, EVFILT_WRITE, enable ? EV_ADD : EV_DELETE, 0, 0, (void *)(intptr_t)token);
+        return kevent(poller->fd, &change, 1, NULL, 0, NULL) == 0;
+    #else
+        (void)sock;
+        poller->fds[poller->entryOf[token]].events = POLLIN | (enable ? POLLOUT : 0);
+        return 1;
+    #endif
+}
+
+// Stop watching a socket; called before it is closed
+void pollerRemove(RacePoller *poller, RaceSocket sock, int token) {
+    #if defined(RACE_POLL_EPOLL)
+        struct epoll_event event; // Kernels before 2.6.9 insist on one
+        memset(&event, 0, sizeof(event));
+        epoll_ctl(poller->fd, EPOLL_CTL_DEL, sock, &event);
+        (void)token;
+    #elif defined(RACE_POLL_KQUEUE)
+        (void)poller; // Closing the socket drops its filters
+        (void)sock;
+        (void)token;
+    #else
+        (void)sock;
+        int entry = poller->entryOf[token];
+        int last = --poller->count;
+        poller->fds[entry] = poller->fds[last]; // The last entry fills the gap
+        poller->tokens[entry] = poller->tokens[last];
+        poller->entryOf[poller->tokens[entry]] = entry;
+        poller->entryOf[token] = -1;
+    #endif
+}
+
+// Wait up to timeoutMs (-1 = forever) for sockets to become ready
+// The events are left in poller->events; returns how many, 0 on timeout
+int pollerWait(RacePoller *poller, int timeoutMs) {
+    int count = 0;
+    #if defined(RACE_POLL_EPOLL)
+        int ready = epoll_wait(poller->fd, poller->ready, RACE_EVENT_BATCH, timeoutMs);
+        for (int i = 0; i < ready; i++) {
+            uint32_t flags = poller->ready[i].events;
+            poller->events[count].token = (int)poller->ready[i].data.u32;
+            poller->events[count].readable = (flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+            poller->events[count].writable = (flags & EPOLLOUT) != 0;
+            count++;
+        }
+    #elif defined(RACE_POLL_KQUEUE)
+        struct timespec wait = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+        int ready = kevent(poller->fd, NULL, 0, poller->ready, RACE_EVENT_BATCH,
+                           (timeoutMs < 0) ? NULL : &wait);
+        for (int i = 0; i < ready; i++) {
+            const struct kevent *event = &poller->ready[i];
+            poller->events[count].token = (int)(intptr_t)event->udata;
+            poller->events[count].readable = event->filter == EVFILT_READ ||
+                                             (event->flags & (EV_EOF | EV_ERROR)) != 0;
+            poller->events[count].writable = event->filter == EVFILT_WRITE;
+            count++;
+        }
+    #else
+        int ready = racePollSockets(poller->fds, poller->count, timeoutMs);
+        // Scanning starts one entry further each time, so no socket waits forever
+        // behind a full batch
+        for (int n = 0; ready > 0 && n < poller->count && count < RACE_EVENT_BATCH; n++) {
+            int entry = (poller->rotate + n) % poller->count;
+            short flags = poller->fds[entry].revents;
+            if (flags == 0) {
+                continue;
+            }
+            poller->events[count].token = poller->tokens[entry];
+            poller->events[count].readable = (flags & (POLLIN | POLLHUP | POLLERR)) != 0;
+            poller->events[count].writable = (flags & POLLOUT) != 0;
+            count++;
+        }
+        if (poller->count > 0) {
+            poller->rotate = (poller->rotate + 1) % poller->count;
+        }
+    #endif
+    return count;
+}
+
+void pollerClose(RacePoller *poller) {
+    #if defined(RACE_POLL_EPOLL) || defined(RACE_POLL_KQUEUE)
+        if (poller->fd >= 0) {
+            close(poller->fd);
+        }
+    #else
+        free(poller->fds);
+        free(poller->tokens);
+        free(poller->entryOf);
+        poller->fds = NULL;
+        poller->tokens = NULL;
+        poller->entryOf = NULL;
+    #endif
+}
+
+// Ask the race relay loop to stop at its next wake-up
+void raceStopHandler(int sig) {
+    (void)sig;
+    raceStopRequested = 1;
+}
+
+// Run the race relay on port until Ctrl+C
+// Clients wait in a lobby; the host's START begins a race for everyone in it,
+// and the standings go out to the racers at most every RACE_BROADCAST_MS
+int runRaceServer(const char *port) {
+    if (!raceNetInit()) {
+        return 0;
+    }
+    RaceServer server;
+    memset(&server, 0, sizeof(server));
+    server.hostId = -1;
+    server.listener = RACE_INVALID_SOCKET;
+    server.clients = calloc(RACE_MAX_CLIENTS, sizeof(RaceConnection));
+    server.standings = malloc(RACE_MAX_CLIENTS * sizeof(RaceStanding));
+    server.flushList = malloc(RACE_MAX_CLIENTS * sizeof(int));
+    server.leaveList = malloc(RACE_MAX_CLIENTS * sizeof(int));
+    if (server.clients == NULL || server.standings == NULL || server.flushList == NULL ||
+        server.leaveList == NULL) {
+        framePrintf("Error: Not enough memory for the race server.\n");
+        free(server.clients);
+        free(server.standings);
+        free(server.flushList);
+        free(server.leaveList);
+        return 0;
+    }
+    for (int i = 0; i < RACE_MAX_CLIENTS; i++) {
+        server.clients[i].socket = RACE_INVALID_SOCKET;
+    }
+
+    int running = pollerOpen(&server.poller);
+    if (!running) {
+        framePrintf("Error: Could not create the race server's poller.\n");
+    } else {
+        running = openRaceListener(&server, port);
+    }
+    if (running) {
+        framePrintf("Race server listening on port %s. Press Ctrl+C to stop.\n", port);
+        signal(SIGINT, raceStopHandler);
+        signal(SIGTERM, raceStopHandler);
+    }
+
+    while (running && !raceStopRequested) {
+        frameFlush();
+
+        // Between races there is nothing timed; the wait is still capped so
+        // Ctrl+C is noticed where it does not interrupt the wait
+        long long now = monotonicNanos();
+        int timeout = 1000;
+        if (server.racing) {
+            long long wait = server.nextBroadcast - now;
+            timeout = (wait > 0) ? (int)((wait + 999999) / 1000000) : 0;
+        }
+        int count = pollerWait(&server.poller, timeout);
+        for (int i = 0; i < count; i++) {
+            const RaceEvent *event = &server.poller.events[i];
+            if (event->token == RACE_MAX_CLIENTS) {
+                serverAccept(&server);
+                continue;
+            }
+            RaceConnection *client = &server.clients[event->token];
+            if (client->socket == RACE_INVALID_SOCKET) {
+                continue; // Dropped earlier in this batch
+            }
+            if (event->writable && !client->flushQueued) {
+                client->flushQueued = 1;
+                server.flushList[server.flushCount++] = event->token;
+            }
+            if (event->readable) {
+                serverRead(&server, event->token);
+            }
+        }
+
+        now = monotonicNanos();
+        if (server.racing && now >= server.nextBroadcast) {
+            serverStandings(&server, now);
+        }
+        // Sending can drop a client, and telling the others queues more to send
+        do {
+            serverAnnounceLeaves(&server);
+            serverFlush(&server);
+        } while (server.leaveCount > 0);
+    }
+
+    if (raceStopRequested) {
+        framePrintf("\nRace server stopped.\n");
+    }
+    for (int i = 0; i < RACE_MAX_CLIENTS; i++) {
+        if (server.clients[i].socket != RACE_INVALID_SOCKET) {
+            raceCloseSocket(server.clients[i].socket);
+        }
+        free(server.clients[i].outbox);
+    }
+    if (server.listener != RACE_INVALID_SOCKET) {
+        raceCloseSocket(server.listener);
+    }
+    pollerClose(&server.poller);
+    free(server.clients);
+    free(server.standings);
+    free(server.flushList);
+    free(server.leaveList);
+    frameFlush();
+    return running;
+}
+
+// Listen on port on every local address the system offers first
+int openRaceListener(RaceServer *server, const char *port) {
+    struct addrinfo hints;
+    struct addrinfo *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, port, &hints, &found) != 0) {
+        framePrintf("Error: %s is not a port the race server can use.\n", port);
+        return 0;
+    }
+    for (struct addrinfo *candidate = found; candidate != NULL; candidate = candidate->ai_next) {
+        RaceSocket sock = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (sock == RACE_INVALID_SOCKET) {
+            continue;
+        }
+        int on = 1; // Restarting the server must not wait for old connections to time out
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+        if (bind(sock, candidate->ai_addr, (int)candidate->ai_addrlen) == 0 &&
+            listen(sock, SOMAXCONN) == 0 && raceSetNonBlocking(sock)) {
+            server->listener = sock;
+            break;
+        }
+        raceCloseSocket(sock);
+    }
+    freeaddrinfo(found);
+    if (server->listener == RACE_INVALID_SOCKET ||
+        !pollerAdd(&server->poller, server->listener, RACE_MAX_CLIENTS)) {
+        framePrintf("Error: Could not listen on port %s.\n", port);
+        return 0;
+    }
+    return 1;
+}
+
+// Take every pending connection; each gets the lowest free slot as its racer id
+void serverAccept(RaceServer *server) {
+    for (;;) {
+        RaceSocket sock = accept(server->listener, NULL, NULL);
+        if (sock == RACE_INVALID_SOCKET) {
+            return; // Nothing left to accept, or the client gave up already
+        }
+        int id = 0;
+        while (id < RACE_MAX_CLIENTS &&
+               (server->clients[id].socket != RACE_INVALID_SOCKET || server->clients[id].leaving)) {
+            id++;
+        }
+        if (id == RACE_MAX_CLIENTS || !raceSetNonBlocking(sock) || !pollerAdd(&server->poller, sock, id)) {
+            raceCloseSocket(sock); // Full
+            continue;
+        }
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+
+        RaceConnection *client = &server->clients[id];
+        client->socket = sock;
+        client->name[0] = '\0';
+        client->racing = 0;
+        client->finished = 0;
+        client->inboxUsed = 0;
+        client->outboxUsed = 0;
+        client->writeWatched = 0;
+    }
+}
+
+// Read what a client sent and act on every complete packet
+void serverRead(RaceServer *server, int id) {
+    RaceConnection *client = &server->clients[id];
+    while (client->socket != RACE_INVALID_SOCKET) {
+        int got = (int)recv(client->socket, (char *)client->inbox + client->inboxUsed,
+                            RACE_MAX_PACKET - client->inboxUsed, 0);
+        if (got < 0 && raceWouldBlock()) {
+            return;
+        }
+        if (got <= 0) {
+            serverDrop(server, id); // Closed, or reset
+            return;
+        }
+        client->inboxUsed += got;
+
+        // Act on whole packets; the start of a partial one moves to the front
+        int used = 0;
+        while (client->inboxUsed - used >= RACE_HEADER_SIZE) {
+            int length = (int)raceGet16(client->inbox + used + 1);
+            if (RACE_HEADER_SIZE + length > RACE_MAX_PACKET) {
+                serverDrop(server, id); // Not a race client
+                return;
+            }
+            if (client->inboxUsed - used < RACE_HEADER_SIZE + length) {
+                break;
+            }
+            serverPacket(server, id, client->inbox[used], client->inbox + used + RACE_HEADER_SIZE, length);
+            if (client->socket == RACE_INVALID_SOCKET) {
+                return; // The packet got the client dropped
+            }
+            used += RACE_HEADER_SIZE + length;
+        }
+        memmove(client->inbox, client->inbox + used, client->inboxUsed - used);
+        client->inboxUsed -= used;
+    }
+}
+
+// Act on one packet from a client
+void serverPacket(RaceServer *server, int id, int type, const unsigned char *payload, int length) {
+    RaceConnection *client = &server->clients[id];
+    unsigned char reply[2 + MAX_NAME_LEN];
+
+    if (type == RACE_PACKET_HELLO) {
+        int nameLength = length - 2;
+        if (client->name[0] != '\0' || nameLength < 1 || nameLength >= MAX_NAME_LEN ||
+            raceGet16(payload) != RACE_PROTOCOL_VERSION) {
+            serverDrop(server, id);
+            return;
+        }
+        for (int i = 0; i < nameLength; i++) {
+            client->name[i] = isgraph(payload[2 + i]) ? (char)payload[2 + i] : '_';
+        }
+        client->name[nameLength] = '\0';
+        server->connected++;
+        framePrintf("%s joined (%d connected)\n", client->name, server->connected);
+
+        racePut16(reply, (uint32_t)id);
+        serverQueue(server, id, RACE_PACKET_WELCOME, reply, 2);
+        // The newcomer hears of everyone in the lobby, and everyone of the newcomer
+        for (int other = 0; other < RACE_MAX_CLIENTS; other++) {
+            if (other != id && server->clients[other].name[0] != '\0') {
+                int otherLength = (int)strlen(server->clients[other].name);
+                racePut16(reply, (uint32_t)other);
+                memcpy(reply + 2, server->clients[other].name, otherLength);
+                serverQueue(server, id, RACE_PACKET_JOIN, reply, 2 + otherLength);
+            }
+        }
+        racePut16(reply, (uint32_t)id);
+        memcpy(reply + 2, client->name, nameLength);
+        serverBroadcast(server, RACE_PACKET_JOIN, reply, 2 + nameLength);
+
+        if (server->hostId < 0) {
+            server->hostId = id;
+        }
+        racePut16(reply, (uint32_t)server->hostId);
+        serverQueue(server, id, RACE_PACKET_HOST, reply, 2);
+    } else if (client->name[0] == '\0') {
+        serverDrop(server, id); // Something other than a race client
+    } else if (type == RACE_PACKET_START) {
+        int textLength = (length >= 11) ? (int)raceGet16(payload + 9) : 0;
+        if (id != server->hostId || server->racing || textLength < 1 || textLength > RACE_MAX_TEXT ||
+            length != 11 + textLength || !raceTextValid((const char *)payload + 11, textLength)) {
+            // Only the host starts races, one at a time; it is told, so it does not wait for nothing
+            serverQueue(server, id, RACE_PACKET_REFUSED, payload, 0);
+            return;
+        }
+
+        // Everybody in the lobby races
+        int racers = 0;
+        for (int i = 0; i < RACE_MAX_CLIENTS; i++) {
+            RaceConnection *racer = &server->clients[i];
+            racer->racing = (racer->name[0] != '\0');
+            racer->finished = 0;
+            racer->pos = 0;
+            racer->errors = 0;
+            racer->stamp = 0;
+            racers += racer->racing;
+        }
+        server->racing = 1;
+        server->changed = 1;
+        server->firstFinish = 0;
+        server->nextBroadcast = monotonicNanos();
+        serverBroadcast(server, RACE_PACKET_START, payload, length);
+        framePrintf("%s started a race: %d racers, %d characters, seed %llu\n", client->name, racers,
+                    textLength, (unsigned long long)raceGet64(payload));
+    } else if (type == RACE_PACKET_PROGRESS || type == RACE_PACKET_FINISH) {
+        if (!client->racing || client->finished || length < 12) {
+            return; // Late for a race that already ended
+        }
+        client->pos = raceGet32(payload);
+        client->errors = raceGet32(payload + 4);
+        client->stamp = raceGet32(payload + 8);
+        if (type == RACE_PACKET_FINISH) {
+            client->finished = 1;
+            if (server->firstFinish == 0) {
+                server->firstFinish = monotonicNanos();
+            }
+            framePrintf("%s finished in %.2f seconds\n", client->name, client->stamp / 1000.0);
+        }
+        server->changed = 1;
+    }
+    // Other packets are skipped, so newer clients can add their own
+}
+
+// Append a packet to a client's outbox; serverFlush sends it
+void serverQueue(RaceServer *server, int id, int type, const unsigned char *payload, int length) {
+    RaceConnection *client = &server->clients[id];
+    if (client->socket == RACE_INVALID_SOCKET) {
+        return;
+    }
+    size_t needed = client->outboxUsed + RACE_HEADER_SIZE + length;
+    if (needed > RACE_OUTBOX_LIMIT) {
+        serverDrop(server, id); // Not reading; it can rejoin
+        return;
+    }
+    if (needed > client->outboxCapacity) {
+        size_t capacity = client->outboxCapacity ? client->outboxCapacity * 2 : 4096;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        unsigned char *outbox = realloc(client->outbox, capacity);
+        if (outbox == NULL) {
+            serverDrop(server, id);
+            return;
+        }
+        client->outbox = outbox;
+        client->outboxCapacity = capacity;
+    }
+
+    unsigned char *packet = client->outbox + client->outboxUsed;
+    packet[0] = (unsigned char)type;
+    racePut16(packet + 1, (uint32_t)length);
+    memcpy(packet + RACE_HEADER_SIZE, payload, length);
+    client->outboxUsed = needed;
+    if (!client->flushQueued) {
+        client->flushQueued = 1;
+        server->flushList[server->flushCount++] = id;
+    }
+}
+
+// Queue a packet for every client that has said hello
+void serverBroadcast(RaceServer *server, int type, const unsigned char *payload, int length) {
+    for (int id = 0; id < RACE_MAX_CLIENTS; id++) {
+        if (server->clients[id].name[0] != '\0') {
+            serverQueue(server, id, type, payload, length);
+        }
+    }
+}
+
+// Send every queued client what it has waiting; what a socket will not take
+// stays queued, and the poller reports when it can take more
+void serverFlush(RaceServer *server) {
+    for (int i = 0; i < server->flushCount; i++) {
+        int id = server->flushList[i];
+        RaceConnection *client = &server->clients[id];
+        client->flushQueued = 0;
+        if (client->socket == RACE_INVALID_SOCKET) {
+            continue;
+        }
+        size_t sent = 0;
+        int failed = 0;
+        while (sent < client->outboxUsed) {
+            int wrote = (int)send(client->socket, (const char *)client->outbox + sent,
+                                  (int)(client->outboxUsed - sent), 0);
+            if (wrote < 0 && raceWouldBlock()) {
+                break;
+            }
+            if (wrote <= 0) {
+                failed = 1;
+                break;
+            }
+            sent += wrote;
+        }
+        if (failed) {
+            serverDrop(server, id); // Only queues the news; nothing is sent from here
+            continue;
+        }
+        memmove(client->outbox, client->outbox + sent, client->outboxUsed - sent);
+        client->outboxUsed -= sent;
+        int waiting = client->outboxUsed > 0;
+        if (waiting != client->writeWatched &&
+            pollerWatchWrite(&server->poller, client->socket, id, waiting)) {
+            client->writeWatched = waiting;
+        }
+    }
+    server->flushCount = 0;
+}
+
+// Close a client's connection; the others are told by serverAnnounceLeaves,
+// so this is safe to call while packets are being queued or sent
+void serverDrop(RaceServer *server, int id) {
+    RaceConnection *client = &server->clients[id];
+    if (client->socket == RACE_INVALID_SOCKET) {
+        return;
+    }
+    pollerRemove(&server->poller, client->socket, id);
+    raceCloseSocket(client->socket);
+    client->socket = RACE_INVALID_SOCKET;
+    client->inboxUsed = 0;
+    client->outboxUsed = 0;
+    client->writeWatched = 0;
+    if (client->name[0] != '\0') {
+        server->connected--;
+        framePrintf("%s left (%d connected)\n", client->name, server->connected);
+        client->name[0] = '\0';
+        client->leaving = 1; // The slot is not reused before the others hear of it
+        server->leaveList[server->leaveCount++] = id;
+        if (client->racing) {
+            client->racing = 0;
+            server->changed = 1;
+        }
+    }
+}
+
+// Tell everyone about the clients dropped since the last call, and pass the
+// host on to the longest-connected client if the host was one of them
+void serverAnnounceLeaves(RaceServer *server) {
+    unsigned char payload[2];
+    while (server->leaveCount > 0) {
+        int id = server->leaveList[--server->leaveCount];
+        server->clients[id].leaving = 0;
+        racePut16(payload, (uint32_t)id);
+        serverBroadcast(server, RACE_PACKET_LEAVE, payload, 2);
+        if (id == server->hostId) {
+            server->hostId = -1;
+            for (int other = 0; other < RACE_MAX_CLIENTS && server->hostId < 0; other++) {
+                if (server->clients[other].name[0] != '\0') {
+                    server->hostId = other;
+                }
+            }
+            if (server->hostId >= 0) {
+                framePrintf("%s is now the host\n", server->clients[server->hostId].name);
+                racePut16(payload, (uint32_t)server->hostId);
+                serverBroadcast(server, RACE_PACKET_HOST, payload, 2);
+            }
+        }
+    }
+}
+
+// Send every racer the standings and its own place, and end the race once
+// everybody has finished, or the rest have had RACE_FINISH_GRACE_MS since the first
+void serverStandings(RaceServer *server, long long now) {
+    server->nextBroadcast = now + RACE_BROADCAST_MS * 1000000LL;
+    int racers = 0;
+    int finished = 0;
+    for (int id = 0; id < RACE_MAX_CLIENTS; id++) {
+        const RaceConnection *client = &server->clients[id];
+        if (client->racing) {
+            RaceStanding *standing = &server->standings[racers++];
+            standing->id = id;
+            standing->finished = client->finished;
+            standing->pos = client->pos;
+            standing->errors = client->errors;
+            standing->stamp = client->stamp;
+            finished += client->finished;
+        }
+    }
+    int over = (finished == racers) ||
+               (server->firstFinish != 0 && now - server->firstFinish >= RACE_FINISH_GRACE_MS * 1000000LL);
+    if (!server->changed && !over) {
+        return; // Nothing new since the last standings
+    }
+    server->changed = 0;
+    qsort(server->standings, racers, sizeof(RaceStanding), compareStandings);
+
+    // One packet for everyone; only the place differs
+    unsigned char payload[6 + RACE_BOARD_SIZE * RACE_BOARD_ENTRY_SIZE];
+    int shown = (racers < RACE_BOARD_SIZE) ? racers : RACE_BOARD_SIZE;
+    payload[0] = over ? RACE_BOARD_OVER : 0;
+    racePut16(payload + 1, (uint32_t)racers);
+    payload[5] = (unsigned char)shown;
+    for (int i = 0; i < shown; i++) {
+        const RaceStanding *standing = &server->standings[i];
+        unsigned char *entry = payload + 6 + i * RACE_BOARD_ENTRY_SIZE;
+        racePut16(entry, (uint32_t)standing->id);
+        entry[2] = (unsigned char)standing->finished;
+        racePut32(entry + 3, standing->pos);
+        racePut32(entry + 7, standing->errors);
+        racePut32(entry + 11, standing->stamp);
+    }
+    for (int place = 0; place < racers; place++) {
+        racePut16(payload + 3, (uint32_t)(place + 1));
+        serverQueue(server, server->standings[place].id, RACE_PACKET_BOARD, payload,
+                    6 + shown * RACE_BOARD_ENTRY_SIZE);
+    }
+
+    if (over) {
+        if (racers > 0 && server->standings[0].finished) {
+            framePrintf("Race over: %s won in %.2f seconds\n",
+                        server->clients[server->standings[0].id].name, server->standings[0].stamp / 1000.0);
+        } else {
+            framePrintf("Race over: nobody finished\n");
+        }
+        for (int id = 0; id < RACE_MAX_CLIENTS; id++) {
+            server->clients[id].racing = 0;
+        }
+        server->racing = 0;
+    }
+}
+
+// Write an unsigned LEB128 varint: 7 bits per byte, low bits first
+void writeVarint(FILE *file, uint64_t value) {
+    unsigned char bytes[10];
+    int count = 0;
+    do {
+        bytes[count] = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            bytes[count] |= 0x80;
+        }
+        count++;
+    } while (value != 0);
+    fwrite(bytes, 1, count, file);
+}
+
+// Read one varint from the replay; returns 0 at the end of the data
+int readVarint(KeyStream *stream, uint64_t *value) {
+    const unsigned char *data = (const unsigned char *)stream->replay.data;
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (stream->replayPos >= stream->replay.size) {
+            return 0;
+        }
+        unsigned char byte = data[stream->replayPos++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return 1;
+        }
+    }
+    return 0; // Too long to be a varint we wrote
+}
+
+// Start writing every test's keystrokes to fileName
+int openKeyRecording(KeyStream *stream, const char *fileName) {
+    stream->record = fopen(fileName, "wb");
+    if (stream->record == NULL) {
+        framePrintf("Error: Could not create %s.\n", fileName);
+        return 0;
+    }
+    fwrite(KEY_RECORDING_MAGIC, 1, 4, stream->record);
+    writeVarint(stream->record, KEY_RECORDING_VERSION);
+    return 1;
+}
+
+// Start feeding typingTest from a recording instead of the keyboard
+int openKeyReplay(KeyStream *stream, const char *fileName) {
+    uint64_t version;
+    if (!mapFile(fileName, &stream->replay)) {
+        framePrintf("Error: Could not open %s.\n", fileName);
+        return 0;
+    }
+    stream->replayPos = 4;
+    if (stream->replay.size < 4 ||
+        memcmp(stream->replay.data, KEY_RECORDING_MAGIC, 4) != 0 ||
+        !readVarint(stream, &version) || version != KEY_RECORDING_VERSION) {
+        framePrintf("Error: %s is not a keystroke recording.\n", fileName);
+        unmapFile(&stream->replay);
+        return 0;
+    }
+    return 1;
+}
+
+void closeKeyStream(KeyStream *stream) {
+    if (stream->record != NULL) {
+        fclose(stream->record);
+        stream->record = NULL;
+    }
+    unmapFile(&stream->replay);
+}
+
+// Mark the start of a test; a recording stores its seed and text
+void beginKeyStream(KeyStream *stream, uint64_t seed, const char *text, int length, long long start) {
+    stream->testStart = start;
+    stream->lastMicros = 0;
+    if (stream->record != NULL) {
+        writeVarint(stream->record, seed);
+        writeVarint(stream->record, (uint64_t)length);
+        fwrite(text, 1, length, stream->record);
+    }
+}
+
+// The input seam of typingTest: wait up to timeoutMs for the next batch of keys and
+// note when they arrived
+// A replay hands back the recorded batches and times, so scoring matches the original
+// Returns the number of keys, 0 on timeout, or -1 when input ends; at the
+// end of a recorded test stamp is when the original test ended
+int readTestKeys(KeyStream *stream, unsigned char *keys, int capacity, int timeoutMs, long long *stamp) {
+    if (stream->replay.data != NULL) {
+        uint64_t delta, count;
+        size_t batch = stream->replayPos;
+        *stamp = stream->testStart + stream->lastMicros * 1000;
+        if (!readVarint(stream, &delta) || !readVarint(stream, &count)) {
+            return -1;
+        }
+        if (count == 0) {
+            *stamp += (long long)delta * 1000;
+            stream->replayPos = batch; // Left for endKeyStream
+            return -1;
+        }
+        if (count > (uint64_t)capacity || stream->replay.size - stream->replayPos < count) {
+            return -1;
+        }
+        memcpy(keys, stream->replay.data + stream->replayPos, (size_t)count);
+        stream->replayPos += (size_t)count;
+        stream->lastMicros += (long long)delta;
+        stream->replayedKeys += (long long)count;
+        *stamp = stream->testStart + stream->lastMicros * 1000;
+        return (int)count;
+    }
+
+    int count = terminalReadKeys(keys, capacity, timeoutMs);
+    *stamp = monotonicNanos();
+    if (stream->record != NULL && count > 0) {
+        long long micros = (*stamp - stream->testStart) / 1000;
+        writeVarint(stream->record, (uint64_t)(micros - stream->lastMicros));
+        writeVarint(stream->record, (uint64_t)count);
+        fwrite(keys, 1, count, stream->record);
+        stream->lastMicros = micros;
+    }
+    return count;
+}
+
+// Close off the current test: a recording gets its empty end batch, holding
+// the time the test ended; a replay skips whatever the original test read
+// after the point it ended
+void endKeyStream(KeyStream *stream, long long end) {
+    if (stream->record != NULL) {
+        long long micros = (end - stream->testStart) / 1000;
+        writeVarint(stream->record, (uint64_t)(micros > stream->lastMicros ? micros - stream->lastMicros : 0));
+        writeVarint(stream->record, 0);
+        fflush(stream->record);
+    }
+    if (stream->replay.data != NULL) {
+        uint64_t delta, count;
+        while (readVarint(stream, &delta) && readVarint(stream, &count) && count > 0) {
+            if (stream->replay.size - stream->replayPos < count) {
+                stream->replayPos = stream->replay.size;
+                break;
+            }
+            stream->replayPos += (size_t)count;
+        }
+    }
+}
+
+// Read the seed and text of the next recorded test; returns 0 when there are none left
+// An empty text marks an endurance stream, which is regenerated from its seed
+int nextReplayTest(KeyStream *stream, uint64_t *seed, TextBuilder *text) {
+    uint64_t length;
+    if (!readVarint(stream, seed) || !readVarint(stream, &length) ||
+        stream->replay.size - stream->replayPos < length) {
+        return 0;
+    }
+    if (length == 0) {
+        return 1;
+    }
+    // Text mode passages keep their line breaks and indentation
+    if (!appendText(text, stream->replay.data + stream->replayPos, (int)length)) {
+        return 0;
+    }
+    stream->replayPos += (size_t)length;
+    return 1;
+}
+
+// Run every test in a recording through typingTest as fast as it will go
+// The summary goes to stderr so the rendered frames can be sent to /dev/null
+int replayRecording(AppState *state, const char *fileName) {
+    if (!openKeyReplay(&state->input, fileName)) {
+        frameFlush();
+        return 0;
+    }
+
+    int tests = 0;
+    long long elapsed = 0;
+    while (1) {
+        resetArena(&state->session);
+        TextBuilder text;
+        initTextBuilder(&text, &state->session);
+        uint64_t seed;
+        if (!nextReplayTest(&state->input, &seed, &text)) {
+            break;
+        }
+        state->testSeed = seed;
+
+        TypingResult result;
+        int completed;
+        long long started = monotonicNanos();
+        if (text.length == 0) {
+            uint64_t difficulty;
+            if (!readVarint(&state->input, &difficulty) || difficulty < 1 ||
+                difficulty > DIFFICULTY_COUNT || state->words.lists[difficulty - 1].count == 0 ||
+                state->input.replay.size - state->input.replayPos < SKILL_PAIRS) {
+                fprintf(stderr, "Test %d (seed %llu): no word list for the endurance stream\n",
+                        tests + 1, (unsigned long long)seed);
+                break;
+            }
+            const unsigned char *weakness =
+                (const unsigned char *)state->input.replay.data + state->input.replayPos;
+            state->input.replayPos += SKILL_PAIRS;
+            completed = enduranceStream(state, (int)difficulty, weakness, seed, &result) != 0;
+        } else {
+            completed = typingTest(&replayGame, &text, &result, state);
+        }
+        elapsed += monotonicNanos() - started;
+        tests++;
+        frameFlush();
+
+        if (completed) {
+            fprintf(stderr, "Test %d (seed %llu): %.2f WPM, %.2f%% accuracy, %.2f seconds\n",
+                    tests, (unsigned long long)seed, result.wpm, result.accuracy, result.timeTaken);
+        } else {
+            fprintf(stderr, "Test %d (seed %llu): cancelled\n", tests, (unsigned long long)seed);
+        }
+    }
+
+    long long keys = state->input.replayedKeys;
+    fprintf(stderr, "Replayed %d tests, %lld keystrokes in %.3f seconds (%.0f ns per keystroke)\n",
+            tests, keys, elapsed / 1e9, keys ? (double)elapsed / keys : 0.0);
+    closeKeyStream(&state->input);
+    return 1;
+}
+
+// Typing test function, built into each mode with only the features it has
+MODE_INLINE int typingTest(const GameMode *mode, TextBuilder *target, TypingResult *result, AppState *state) {
+    RaceClient *race = (mode->features & MODE_FEATURE_RACE) ? state->race : NULL;
+    int recorded = (mode->features & MODE_FEATURE_RECORD) != 0;
+    const char *text = target->text;
+    int textLength = target->length;
+    const int *wordStarts = target->wordStarts;
+    int wordCount = target->wordCount;
+
+    // ASCII text, the common case, is typed as it is. Any other text gets one
+    // byte code per character first, so every position below is a character
+    GlyphTable *glyphs = NULL;
+    if (asciiPrefix(text, textLength) < textLength) {
+        glyphs = &state->glyphs;
+        resetGlyphs(glyphs);
+        char *coded = arenaAlloc(&state->session, textLength + 1);
+        int *positions = arenaAlloc(&state->session, ((size_t)textLength + 1) * sizeof(int));
+        int *starts = arenaAlloc(&state->session, ((size_t)wordCount + 1) * sizeof(int));
+        if (coded == NULL || positions == NULL || starts == NULL) {
+            framePrintf("Error: Not enough memory for the test.\n");
+            return 0;
+        }
+        textLength = transcodeText(glyphs, text, textLength, coded, positions);
+        int words = 0;
+        for (int w = 0; w < wordCount; w++) {
+            int wordStart = positions[wordStarts[w]];
+            if (wordStart < textLength && (words == 0 || wordStart > starts[words - 1])) {
+                starts[words++] = wordStart;
+            }
+        }
+        text = coded;
+        wordStarts = starts;
+        wordCount = words;
+    }
+
+    // Per-test buffers come from the session arena, sized to the text
+    char *typedText = arenaAlloc(&state->session, textLength + 1);
+    char *mistakeFlags = arenaAlloc(&state->session, textLength + 1); // Flags to count unique mistakes
+    if (typedText == NULL || mistakeFlags == NULL) {
+        framePrintf("Error: Not enough memory for the test.\n");
+        return 0;
+    }
+    typedText[0] = '\0';
+    memset(mistakeFlags, 0, textLength + 1);
+
+    // The text is word-wrapped once; the renderer maps positions through the line table
+    TypingView view;
+    initTypingView(&view);
+    view.glyphs = glyphs;
+    TextLayout layout;
+    if (!layoutText(&layout, &state->session, text, textLength, view.width, glyphs)) {
+        framePrintf("Error: Not enough memory for the test.\n");
+        return 0;
+    }
+
+    setColour(CYAN, state);
+    for (int i = 0; i < layout.count; i++) {
+        frameAppendGlyphs(glyphs, text + layout.lines[i].start, layout.lines[i].length);
+        framePrintf("\n");
+    }
+    setColour(DEFAULT, state);
+    terminalEnterRaw(); // Stays raw until the test ends
+    if (state->input.replay.data == NULL && race == NULL) {
+        framePrintf("\nPress any key to start typing...");
+        getch(); // A replay or a race starts straight away
+    }
+
+    // Text with line breaks also takes ENTER and TAB, and the indentation
+    // that starts each line is filled in, so typing begins at its first character
+    int multiline = (mode->features & MODE_FEATURE_LINES) && memchr(text, '\n', textLength) != NULL;
+    int pos = multiline ? fillIndentation(text, textLength, 0, typedText) : 0;
+    drawTypingScreen(&view, &layout, text, typedText, pos, state);
+
+    unsigned char keys[KEY_BATCH_SIZE];
+    KeystrokeRing *ring = &state->keystrokes;
+    ring->count = 0;
+    long long start = monotonicNanos();
+    long long end = start;
+    long long now;
+    if (recorded) {
+        beginKeyStream(&state->input, state->testSeed, target->text, target->length, start); // As built, in UTF-8
+    }
+    if (race != NULL) {
+        race->start = start; // Progress reports are timed from here
+    }
+
+    TypingHud hud;
+    memset(&hud, 0, sizeof(hud));
+    hud.enabled = (mode->features & MODE_FEATURE_HUD) && frame.ansi;
+    hud.start = start;
+    hud.nextRefresh = start;
+    int testFinished = 0;
+    int testCancelled = 0;
+    Utf8Pending pending;
+    pending.needed = 0;
+
+    while (!testFinished && !testCancelled && pos < textLength) {
+        frameFlush(); // One write per keystroke frame
+
+        // Everything typed since the last frame is applied before one render
+        // Keys in one batch arrived together and share one timestamp
+        // The wait ends in time for the next status line refresh
+        int timeout = -1;
+        if (hud.enabled) {
+            long long wait = hud.nextRefresh - monotonicNanos();
+            timeout = (wait > 0) ? (int)((wait + 999999) / 1000000) : 0;
+        }
+        if (race != NULL && (timeout < 0 || timeout > RACE_SEND_MS)) {
+            timeout = RACE_SEND_MS; // The standings are read between keys
+        }
+        int keyCount;
+        if (recorded) {
+            keyCount = readTestKeys(&state->input, keys, KEY_BATCH_SIZE, timeout, &now);
+        } else {
+            keyCount = terminalReadKeys(keys, KEY_BATCH_SIZE, timeout);
+            now = monotonicNanos();
+        }
+        if (keyCount < 0) {
+            keys[0] = 27; // Input closed, treat it like ESC
+            keyCount = 1;
+        }
+        TRACE_KEYS(keyCount);
+        TRACE_BEGIN(renderStart);
+        int low = pos; // Cells touched by this batch are drawn once at the end
+        int high = pos;
+
+        for (int k = 0; k < keyCount && !testFinished && !testCancelled; k++) {
+            int ch = keys[k];
+            if (ch >= 0x80) {
+                // Part of a multi-byte character, which can be split across batches
+                uint32_t codepoint;
+                if (!feedUtf8(&pending, (unsigned char)ch, &codepoint)) {
+                    continue;
+                }
+                ch = (glyphs != NULL) ? glyphCode(glyphs, codepoint, 0) : GLYPH_UNKNOWN;
+            } else {
+                pending.needed = 0;
+            }
+
+            if (ch == 27) {
+                if (k + 1 < keyCount && (keys[k + 1] == '[' || keys[k + 1] == 'O')) {
+                    // Arrow or function key sequence, not a lone ESC
+                    k += 2;
+                    while (k < keyCount && (keys[k] < 0x40 || keys[k] > 0x7E)) {
+                        k++;
+                    }
+                    continue;
+                }
+                testCancelled = 1; // ESC key
+                continue;
+            }
+
+            if ((ch == 8 || ch == 127) && pos > 0) { // Backspace
+                pos--;
+                typedText[pos] = '\0';
+                recordKeystroke(ring, now);
+                if (pos < low) {
+                    low = pos;
+                }
+            }
+            else if (isprint(ch) || ch >= GLYPH_FIRST || (multiline && (ch == '\r' || ch == '\n' || ch == '\t'))) {
+                // A tab types spaces up to the next tab stop of the target line
+                int repeat = 1;
+                if (ch == '\t') {
+                    int column = pos;
+                    while (column > 0 && text[column - 1] != '\n') {
+                        column--;
+                    }
+                    repeat = TEXT_TAB_WIDTH - (pos - column) % TEXT_TAB_WIDTH;
+                    ch = ' ';
+                } else if (ch == '\r') {
+                    ch = '\n'; // ENTER in raw mode
+                }
+
+                for (int r = 0; r < repeat && pos < textLength; r++) {
+                    typedText[pos] = (char)ch;
+                    typedText[pos + 1] = '\0';
+                    hud.typed++;
+                    recordSkill(&state->skills, pos > 0 ? text[pos - 1] : ' ', text[pos],
+                                typedText[pos] == text[pos], keystrokeGap(ring, now));
+                    if (r == 0) {
+                        recordKeystroke(ring, now);
+                    }
+
+                    // Count each position at most once, no matter how often it is retyped
+                    if (typedText[pos] != text[pos] && !mistakeFlags[pos]) {
+                        hud.mistakes++;
+                        mistakeFlags[pos] = 1;
+                    }
+                    pos++;
+                    if (ch == '\n' && text[pos - 1] == '\n') {
+                        pos = fillIndentation(text, textLength, pos, typedText);
+                    }
+                }
+                if (pos > high) {
+                    high = pos;
+                }
+
+                if (pos >= textLength) {
+                    end = now;
+                    testFinished = 1;
+                }
+            }
+        }
+
+        renderLayoutTyped(&view, &layout, text, typedText, low, pos, high, state);
+        if (hud.enabled && !testFinished && !testCancelled && now >= hud.nextRefresh) {
+            // A resized console gets the text wrapped again, checked at the status line's rate
+            int width = getConsoleWidth();
+            if (state->input.replay.data == NULL && width > 0 && width != layout.width) {
+                view.width = width;
+                view.height = getConsoleHeight();
+                if (layoutText(&layout, &state->session, text, textLength, width, glyphs)) {
+                    drawTypingScreen(&view, &layout, text, typedText, pos, state);
+                } else {
+                    testCancelled = 1;
+                }
+            }
+            renderHud(&view, &hud, ring, now, state);
+            hud.nextRefresh = now + HUD_REFRESH_MS * 1000000LL;
+        }
+        if (race != NULL && !testCancelled) {
+            // A lost connection leaves the race, but the test goes on
+            racePoll(race, 0);
+            raceProgress(race, pos, hud.mistakes, now, testFinished);
+            if (hud.enabled && !testFinished && race->boardChanged) {
+                renderRaceLine(&view, race, state);
+            }
+        }
+        if (keyCount > 0) {
+            TRACE_END("render_keys", renderStart, keyCount);
+        }
+        if (testCancelled || testFinished) {
+            moveViewCursor(&view, layout.count * 2 - 1, 0); // Below the whole typing area
+        }
+        if (testCancelled) {
+            setViewColour(&view, DEFAULT, state);
+            framePrintf("\n\nTest cancelled. Returning to menu...\n");
+            terminalRestore();
+            if (recorded) {
+                endKeyStream(&state->input, now);
+            }
+            return 0; // CANCELLED
+        }
+        if (testFinished) {
+            setViewColour(&view, DEFAULT, state);
+            framePrintf("\n\nText completed!\n");
+        }
+    }
+    setViewColour(&view, DEFAULT, state);
+    terminalRestore();
+    if (recorded) {
+        endKeyStream(&state->input, end);
+    }
+
+    double timeTaken = (end - start) / 1e9;
+
+    result->totalChars = hud.typed;
+    result->correctChars = hud.typed - hud.mistakes;
+    result->accuracy = (hud.typed == 0) ? 0 : (100.0f * result->correctChars / hud.typed);
+    result->wpm = (timeTaken > 0) ? ((float)pos / 5) / (timeTaken / 60.0f) : 0;
+    result->timeTaken = timeTaken;
+    computeLatencyPercentiles(ring, result);
+
+    // What is left on screen, aligned word by word against the target
+    AlignmentCounts counts;
+    alignText(text, textLength, typedText, pos, &counts);
+    result->mistyped = counts.mistyped;
+    result->missed = counts.missed;
+    result->extra = counts.extra;
+
+    // Per-word stats from the recorded word boundaries
+    result->wordsCompleted = 0;
+    result->wordErrors = 0;
+    for (int w = 0; w < wordCount; w++) {
+        int wordEnd = (w + 1 < wordCount) ? wordStarts[w + 1] - 1 : textLength;
+        if (pos >= wordEnd) {
+            result->wordsCompleted++;
+        }
+        for (int i = wordStarts[w]; i < wordEnd && i < pos; i++) {
+            if (mistakeFlags[i]) {
+                result->wordErrors++;
+                break;
+            }
+        }
+    }
+
+    return 1; // SUCCESS
+}
+
+// Fill in the spaces that start a line of text at pos as typed; returns the
+// position of the line's first character
+int fillIndentation(const char *text, int length, int pos, char *typed) {
+    while (pos < length && text[pos] == ' ') {
+        typed[pos++] = ' ';
+    }
+    typed[pos] = '\0';
+    return pos;
+}
+
+// Start tracking an empty typing area at the current cursor position
+void initTypingView(TypingView *view) {
+    view->width = getConsoleWidth();
+    if (view->width <= 0) {
+        view->width = 80;
+    }
+    view->height = getConsoleHeight();
+    if (view->height <= 0) {
+        view->height = 24;
+    }
+    view->cursorRow = 0;
+    view->cursorCol = 0;
+    view->colour = -1; // Unknown, so the first colour is always sent
+    view->glyphs = NULL;
+}
+
+// Only send a colour escape when the colour actually changes
+void setViewColour(TypingView *view, int colour, AppState *state) {
+    if (view->colour != colour) {
+        setColour(colour, state);
+        view->colour = colour;
+    }
+}
+
+// Move the cursor to a row and column of the typing area using relative escapes
+// Nothing is sent when the cursor is already there
+void moveViewCursor(TypingView *view, int row, int col) {
+    if (view->cursorRow == row && view->cursorCol == col) {
+        return;
+    }
+    if (view->cursorRow > row) {
+        framePrintf("\033[%dA", view->cursorRow - row);
+    } else if (view->cursorRow < row) {
+        framePrintf("\033[%dB", row - view->cursorRow);
+    }
+    framePrintf("\r");
+    if (col > 0) {
+        framePrintf("\033[%dC", col);
+    }
+    view->cursorRow = row;
+    view->cursorCol = col;
+}
+
+// Draw typed[from..to) coloured against the target and blank the cells from
+// to up to end, all on the cursor's row; the cursor must already sit on cell
+// from and is left on cell to
+// Each match bitmask is split into runs, so a colour is sent once per run
+void renderTyped(TypingView *view, const char *target, const char *typed, int from, int to, int end,
+                 AppState *state) {
+    if (view->glyphs != NULL && view->glyphs->wide) {
+        renderTypedWide(view, target, typed, from, to, end, state);
+        return;
+    }
+    for (int block = from; block < to; block += 64) {
+        int length = (to - block < 64) ? to - block : 64;
+        uint64_t mask = matchBlock(typed + block, target + block, length);
+        int i = 0;
+        while (i < length) {
+            int match = (int)((mask >> i) & 1);
+            // The run ends at the next bit that differs from this one
+            uint64_t differs = match ? ~(mask >> i) : (mask >> i);
+            int run = differs ? lowestBit64(differs) : 64 - i;
+            if (run > length - i) {
+                run = length - i;
+            }
+            setViewColour(view, match ? GREEN : RED, state);
+            if (match && view->glyphs == NULL) {
+                frameAppendVisible(typed + block + i, run);
+            } else {
+                // Mistakes can hold a typed character from outside the text
+                frameAppendGlyphs(view->glyphs, typed + block + i, run);
+            }
+            i += run;
+        }
+    }
+
+    if (end > to) {
+        for (int cell = to; cell < end; cell++) {
+            framePutChar(' ');
+        }
+        framePrintf("\033[%dD", end - to);
+    }
+    view->cursorCol += to - from;
+}
+
+// renderTyped for text with two-cell characters, one position at a time
+// Every typed character takes the cells of its target character, so the
+// typed row stays lined up under the text
+void renderTypedWide(TypingView *view, const char *target, const char *typed, int from, int to, int end,
+                     AppState *state) {
+    const unsigned char *widths = view->glyphs->widths;
+    for (int i = from; i < to; i++) {
+        int slot = widths[(unsigned char)target[i]];
+        int width = widths[(unsigned char)typed[i]];
+        setViewColour(view, typed[i] == target[i] ? GREEN : RED, state);
+        if (width <= slot) {
+            frameAppendGlyphs(view->glyphs, typed + i, 1);
+        } else {
+            framePutChar('?'); // A wide character typed where a narrow one belongs
+            width = 1;
+        }
+        for (; width < slot; width++) {
+            framePutChar(' ');
+        }
+        view->cursorCol += slot;
+    }
+
+    int blank = 0;
+    for (int i = to; i < end; i++) {
+        blank += widths[(unsigned char)target[i]];
+    }
+    if (blank > 0) {
+        for (int cell = 0; cell < blank; cell++) {
+            framePutChar(' ');
+        }
+        framePrintf("\033[%dD", blank);
+    }
+}
+
+// Word-wrap text into lines of at most width - 1 columns, breaking after a
+// space, so the last column is never written and the terminal never wraps
+// A word longer than a line is split where the line ends, and a line always
+// ends after a newline, which stays on it as a blank cell
+// Text with two-cell characters is wrapped by layoutWideText instead
+// Returns 0 when the arena is out of memory
+int layoutText(TextLayout *layout, Arena *arena, const char *text, int length, int width,
+               const GlyphTable *glyphs) {
+    int columns = (width > 2) ? width - 1 : 1;
+    layout->width = width;
+    layout->count = 0;
+    layout->cellOf = NULL;
+    if (glyphs != NULL && glyphs->wide) {
+        return layoutWideText(layout, arena, text, length, columns, glyphs);
+    }
+    int newlines = 0;
+    for (const char *p = text; (p = memchr(p, '\n', text + length - p)) != NULL; p++) {
+        newlines++;
+    }
+    // Upper bound: every wrap wastes less than a line, and every newline adds at most one
+    int capacity = length / columns * 2 + 2 + newlines;
+    layout->lines = arenaAlloc(arena, (size_t)capacity * sizeof(TextLine));
+    layout->lineOf = arenaAlloc(arena, ((size_t)length + 1) * sizeof(int));
+    if (layout->lines == NULL || layout->lineOf == NULL) {
+        return 0;
+    }
+
+    int lineStart = 0;
+    do {
+        int lineEnd = lineStart + columns;
+        const char *newline = newlines ? memchr(text + lineStart, '\n',
+                                                (lineEnd < length ? lineEnd : length) - lineStart) : NULL;
+        if (newline != NULL) {
+            lineEnd = (int)(newline - text) + 1;
+        } else if (lineEnd >= length) {
+            lineEnd = length;
+        } else {
+            int brk = lineEnd;
+            while (brk > lineStart && text[brk - 1] != ' ') {
+                brk--;
+            }
+            if (brk > lineStart) {
+                lineEnd = brk;
+            }
+        }
+        if (layout->count == capacity) {
+            return 0; // Cannot happen with the bound above
+        }
+        TextLine *line = &layout->lines[layout->count];
+        line->start = lineStart;
+        line->length = lineEnd - lineStart;
+        line->row = layout->count * 2;
+        for (int i = lineStart; i < lineEnd; i++) {
+            layout->lineOf[i] = layout->count;
+        }
+        layout->count++;
+        lineStart = lineEnd;
+    } while (lineStart < length);
+    layout->lineOf[length] = layout->count - 1; // The cursor after the last character
+    return 1;
+}
+
+// layoutText for text with two-cell characters: lines are filled by screen
+// cells rather than characters, and the column of every offset is kept
+int layoutWideText(TextLayout *layout, Arena *arena, const char *text, int length, int columns,
+                   const GlyphTable *glyphs) {
+    int capacity = length + 1; // Every line holds at least one character
+    layout->lines = arenaAlloc(arena, (size_t)capacity * sizeof(TextLine));
+    layout->lineOf = arenaAlloc(arena, ((size_t)length + 1) * sizeof(int));
+    layout->cellOf = arenaAlloc(arena, ((size_t)length + 1) * sizeof(int));
+    if (layout->lines == NULL || layout->lineOf == NULL || layout->cellOf == NULL) {
+        return 0;
+    }
+
+    int lineStart = 0;
+    int cells = 0;
+    do {
+        int i = lineStart;
+        int brk = lineStart; // Just after the last space that fits
+        cells = 0;
+        while (i < length) {
+            int width = glyphs->widths[(unsigned char)text[i]];
+            if (cells + width > columns && i > lineStart) {
+                break;
+            }
+            layout->cellOf[i] = cells;
+            cells += width;
+            i++;
+            if (text[i - 1] == '\n') {
+                break;
+            }
+            if (text[i - 1] == ' ') {
+                brk = i;
+            }
+        }
+        int lineEnd = i;
+        if (i < length && text[i - 1] != '\n' && brk > lineStart) {
+            lineEnd = brk;
+        }
+        TextLine *line = &layout->lines[layout->count];
+        line->start = lineStart;
+        line->length = lineEnd - lineStart;
+        line->row = layout->count * 2;
+        for (int j = lineStart; j < lineEnd; j++) {
+            layout->lineOf[j] = layout->count;
+        }
+        layout->count++;
+        lineStart = lineEnd;
+    } while (lineStart < length);
+    layout->lineOf[length] = layout->count - 1;
+    layout->cellOf[length] = cells; // The cursor after the last character
+    return 1;
+}
+
+// Screen column of text offset pos in its line
+int layoutColumn(const TextLayout *layout, int pos) {
+    if (layout->cellOf != NULL) {
+        return layout->cellOf[pos];
+    }
+    return pos - layout->lines[layout->lineOf[pos]].start;
+}
+
+// Screen row and column of the cursor when it sits before text offset pos
+void layoutPosition(const TextLayout *layout, int pos, int *row, int *col) {
+    const TextLine *line = &layout->lines[layout->lineOf[pos]];
+    *row = line->row + 1; // Typed text goes on the row under its target line
+    *col = layoutColumn(layout, pos);
+}
+
+// Print every target line with its typed text so far underneath, starting
+// at the cursor, and leave the cursor at pos
+void drawLayout(TypingView *view, const TextLayout *layout, const char *text, const char *typed, int pos,
+                AppState *state) {
+    for (int i = 0; i < layout->count; i++) {
+        const TextLine *line = &layout->lines[i];
+        setViewColour(view, CYAN, state);
+        frameAppendGlyphs(view->glyphs, text + line->start, line->length);
+        framePrintf("\n");
+        if (pos > line->start) {
+            int typedTo = (pos < line->start + line->length) ? pos : line->start + line->length;
+            renderTyped(view, text + line->start, typed + line->start, 0, typedTo - line->start,
+                        0, state);
+        }
+        framePrintf("\n");
+    }
+    view->cursorRow = layout->count * 2;
+    view->cursorCol = 0;
+    int row, col;
+    layoutPosition(layout, pos, &row, &col);
+    moveViewCursor(view, row, col);
+}
+
+// Draw typed[from..to) and blank [to..end) through the layout, one line at a
+// time, and leave the cursor at to
+void renderLayoutTyped(TypingView *view, const TextLayout *layout, const char *target, const char *typed,
+                       int from, int to, int end, AppState *state) {
+    int last = (end > to) ? end : to;
+    for (int l = layout->lineOf[from]; l < layout->count; l++) {
+        const TextLine *line = &layout->lines[l];
+        int lineEnd = line->start + line->length;
+        int first = (from > line->start) ? from : line->start;
+        int segmentTo = (to < first) ? first : (to > lineEnd ? lineEnd : to);
+        int segmentEnd = (last > lineEnd) ? lineEnd : last;
+        moveViewCursor(view, line->row + 1, layoutColumn(layout, first));
+        renderTyped(view, target + line->start, typed + line->start, first - line->start,
+                    segmentTo - line->start, segmentEnd - line->start, state);
+        if (last <= lineEnd) {
+            break;
+        }
+    }
+    int row, col;
+    layoutPosition(layout, to, &row, &col);
+    moveViewCursor(view, row, col);
+}
+
+// Clear the console and draw the whole typing screen: header (or race standings),
+// status line and the laid-out text with everything typed so far; the cursor is left at pos
+void drawTypingScreen(TypingView *view, const TextLayout *layout, const char *text, const char *typed,
+                      int pos, AppState *state) {
+    clearScreen();
+    setViewColour(view, DEFAULT, state);
+    if (state->race != NULL) {
+        char line[256]; // A race shows its standings in place of the header
+        int length = formatRaceLine(state->race, line, sizeof(line));
+        frameAppend(line, (length < view->width) ? length : view->width - 1);
+        framePrintf("\n");
+    } else {
+        framePrintf("Begin typing:    Press ESC at anytime to Cancel\n");
+    }
+    if (frame.ansi) {
+        framePrintf("\n"); // Status line
+    }
+    drawLayout(view, layout, text, typed, pos, state);
+}
+
+// Redraw the status line just above the typing area, then put the cursor back
+// Everything shown comes from running counters and the keystroke ring
+void renderHud(TypingView *view, const TypingHud *hud, const KeystrokeRing *ring, long long now,
+               AppState *state) {
+    if (view->cursorRow + 2 > view->height) {
+        return; // The line has scrolled off the top of the console
+    }
+
+    // Pace over the last HUD_WINDOW_KEYS keystrokes; it drops while the typist pauses
+    double windowWpm = 0;
+    int window = (ring->count < HUD_WINDOW_KEYS) ? ring->count : HUD_WINDOW_KEYS;
+    if (window >= 2) {
+        long long oldest = ring->timestamps[(ring->count - window) & (KEYSTROKE_RING_SIZE - 1)];
+        if (now > oldest) {
+            windowWpm = (window - 1) / 5.0 / ((now - oldest) / 6e10);
+        }
+    }
+    double minutes = (now - hud->start) / 6e10;
+    double rawWpm = (minutes > 0) ? hud->typed / 5.0 / minutes : 0;
+    double accuracy = (hud->typed > 0) ? 100.0 * (hud->typed - hud->mistakes) / hud->typed : 100.0;
+    int seconds = (int)((now - hud->start) / 1000000000LL);
+
+    char line[128];
+    int length = snprintf(line, sizeof(line), "WPM %.1f | Raw %.1f | Accuracy %.1f%% | Time %d:%02d",
+                          windowWpm, rawWpm, accuracy, seconds / 60, seconds % 60);
+    if (length >= view->width) {
+        length = view->width - 1; // Never wrap into the typing area
+    }
+
+    framePrintf("\0337\033[%dA\r\033[2K", view->cursorRow + 1); // Save cursor, up to the line
+    setColour(YELLOW, state);
+    frameAppend(line, length);
+    framePrintf("\0338"); // Restore cursor and colour
+    view->colour = -1;    // Resend the typing colour in case the restore did not
+}
+
+// Bytes in the UTF-8 sequence a lead byte starts, or 0 when it cannot start one
+int utf8SequenceLength(unsigned char lead) {
+    if (lead < 0x80) {
+        return 1;
+    }
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        return 2;
+    }
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        return 3;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        return 4;
+    }
+    return 0; // A continuation byte, or a lead no valid character has
+}
+
+// Decode the character at data; returns the bytes it takes
+// A malformed, overlong or cut-off sequence gives U+FFFD and takes one byte
+int decodeUtf8(const char *data, size_t available, uint32_t *codepoint) {
+    const unsigned char *p = (const unsigned char *)data;
+    int length = utf8SequenceLength(p[0]);
+    if (length == 1) {
+        *codepoint = p[0];
+        return 1;
+    }
+    *codepoint = 0xFFFD;
+    if (length == 0 || (size_t)length > available) {
+        return 1;
+    }
+    uint32_t value = p[0] & (0x7F >> length);
+    for (int i = 1; i < length; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 1;
+        }
+        value = (value << 6) | (p[i] & 0x3F);
+    }
+    static const uint32_t smallest[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    if (value < smallest[length] || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) {
+        return 1;
+    }
+    *codepoint = value;
+    return length;
+}
+
+// Write a character as UTF-8; returns the bytes written, at most 4
+int encodeUtf8(uint32_t codepoint, char *out) {
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+// Take one byte of typed input at or above 0x80; returns 1 with the
+// character once its sequence is complete, 0 while more bytes are due
+// A stray continuation byte gives U+FFFD; a sequence that breaks off is dropped
+int feedUtf8(Utf8Pending *pending, unsigned char byte, uint32_t *codepoint) {
+    if (pending->needed > 0 && (byte & 0xC0) != 0x80) {
+        pending->needed = 0; // Not a continuation, so this byte starts a new character
+    }
+    if (pending->needed == 0) {
+        int length = utf8SequenceLength(byte);
+        if (length < 2) {
+            *codepoint = 0xFFFD;
+            return 1;
+        }
+        pending->bytes[0] = (char)byte;
+        pending->length = 1;
+        pending->needed = length;
+        return 0;
+    }
+    pending->bytes[pending->length++] = (char)byte;
+    if (pending->length < pending->needed) {
+        return 0;
+    }
+    pending->needed = 0;
+    decodeUtf8(pending->bytes, pending->length, codepoint);
+    return 1;
+}
+
+// Screen cells a character takes: 0 for combining marks and other
+// zero-width characters, 2 for East Asian wide and fullwidth forms and
+// emoji, 1 for everything else
+int codepointWidth(uint32_t codepoint) {
+    static const uint32_t zero[][2] = {
+        { 0x0080, 0x009F }, { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+        { 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A },
+        { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x20D0, 0x20FF },
+        { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF },
+    };
+    static const uint32_t wide[][2] = {
+        { 0x1100, 0x115F }, { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF },
+        { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+        { 0xFE30, 0xFE4F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x1F300, 0x1F64F },
+        { 0x1F900, 0x1F9FF }, { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD },
+    };
+    for (size_t i = 0; i < sizeof(zero) / sizeof(zero[0]); i++) {
+        if (codepoint >= zero[i][0] && codepoint <= zero[i][1]) {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < sizeof(wide) / sizeof(wide[0]); i++) {
+        if (codepoint >= wide[i][0] && codepoint <= wide[i][1]) {
+            return 2;
+        }
+    }
+    return 1;
+}
+
+// Empty the table, leaving every byte code one cell wide
+void resetGlyphs(GlyphTable *glyphs) {
+    glyphs->count = 0;
+    glyphs->wide = 0;
+    memset(glyphs->widths, 1, sizeof(glyphs->widths));
+}
+
+// Byte code of a character: ASCII stands for itself, anything else gets its
+// table entry, added when add is set
+// Returns GLYPH_UNKNOWN for a character not in the table, or -1 when add finds it full
+int glyphCode(GlyphTable *glyphs, uint32_t codepoint, int add) {
+    if (codepoint < 0x80) {
+        return (int)codepoint;
+    }
+    for (int i = 0; i < glyphs->count; i++) {
+        if (glyphs->codepoints[i] == codepoint) {
+            return GLYPH_FIRST + i;
+        }
+    }
+    if (!add) {
+        return GLYPH_UNKNOWN;
+    }
+    if (glyphs->count == GLYPH_TABLE_SIZE) {
+        return -1;
+    }
+    int index = glyphs->count++;
+    int width = codepointWidth(codepoint);
+    glyphs->codepoints[index] = codepoint;
+    glyphs->utf8Length[index] = (unsigned char)encodeUtf8(codepoint, glyphs->utf8[index]);
+    glyphs->widths[GLYPH_FIRST + index] = (unsigned char)width;
+    glyphs->wide |= (width == 2);
+    return GLYPH_FIRST + index;
+}
+
+// Turn UTF-8 text into one byte code per character, adding its non-ASCII
+// characters to the table; positions gets the character offset of every
+// byte offset, plus the end
+// A malformed byte becomes '?', and zero-width characters are left out, as
+// no cell of their own can show them. When the table fills up the text ends
+// at the last space before the character that did not fit
+// Returns the number of characters
+int transcodeText(GlyphTable *glyphs, const char *text, int length, char *out, int *positions) {
+    int count = 0;
+    int i = 0;
+    while (i < length) {
+        positions[i] = count;
+        if ((unsigned char)text[i] < 0x80) {
+            out[count++] = text[i++];
+            continue;
+        }
+        uint32_t codepoint;
+        int bytes = decodeUtf8(text + i, length - i, &codepoint);
+        for (int b = 1; b < bytes; b++) {
+            positions[i + b] = count;
+        }
+        if (bytes == 1) {
+            out[count++] = '?';
+        } else if (codepointWidth(codepoint) > 0) {
+            int code = glyphCode(glyphs, codepoint, 1);
+            if (code < 0) {
+                while (count > 0 && out[count - 1] != ' ' && out[count - 1] != '\n') {
+                    count--;
+                }
+                while (count > 0 && (out[count - 1] == ' ' || out[count - 1] == '\n')) {
+                    count--;
+                }
+                for (; i < length; i++) {
+                    positions[i] = count;
+                }
+                break;
+            }
+            out[count++] = (char)code;
+        }
+        i += bytes;
+    }
+    positions[length] = count;
+    out[count] = '\0';
+    return count;
+}
+
+// Bit i of the result is set where a[i] == b[i]; length is at most 64
+// Plain C version, used where no vector unit is known
+uint64_t matchBlockScalar(const char *a, const char *b, int length) {
+    uint64_t mask = 0;
+    for (int i = 0; i < length; i++) {
+        mask |= (uint64_t)(a[i] == b[i]) << i;
+    }
+    return mask;
+}
+
+#ifdef MATCH_KERNEL_SSE2
+// 16 characters per compare; every x86-64 CPU has SSE2
+uint64_t matchBlockSse2(const char *a, const char *b, int length) {
+    uint64_t mask = 0;
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) << i;
+    }
+    if (i < length) {
+        mask |= matchBlockScalar(a + i, b + i, length - i) << i;
+    }
+    return mask;
+}
+#endif
+
+#ifdef MATCH_KERNEL_AVX2
+// 32 characters per compare; only picked when the CPU reports AVX2
+__attribute__((target("avx2")))
+uint64_t matchBlockAvx2(const char *a, const char *b, int length) {
+    uint64_t mask = 0;
+    int i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) << i;
+    }
+    if (i < length) {
+        mask |= matchBlockScalar(a + i, b + i, length - i) << i;
+    }
+    return mask;
+}
+#endif
+
+#ifdef MATCH_KERNEL_NEON
+// 16 characters per compare; NEON has no movemask, so each lane is weighted
+// by its bit and the halves are summed into one byte each
+uint64_t matchBlockNeon(const char *a, const char *b, int length) {
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t weight = vld1q_u8(weights);
+    uint64_t mask = 0;
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t equal = vceqq_u8(vld1q_u8((const uint8_t *)(a + i)), vld1q_u8((const uint8_t *)(b + i)));
+        uint8x16_t bits = vandq_u8(equal, weight);
+        uint64_t lanes = (uint64_t)vaddv_u8(vget_low_u8(bits)) | ((uint64_t)vaddv_u8(vget_high_u8(bits)) << 8);
+        mask |= lanes << i;
+    }
+    if (i < length) {
+        mask |= matchBlockScalar(a + i, b + i, length - i) << i;
+    }
+    return mask;
+}
+#endif
+
+// Number of bytes before the first one with its top bit set, i.e. the
+// length of the leading ASCII run; 8 bytes per test in plain C
+int asciiPrefixScalar(const char *text, int length) {
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        if (word & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+    while (i < length && (unsigned char)text[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef MATCH_KERNEL_SSE2
+// movemask gathers the top bit of 16 bytes at once
+int asciiPrefixSse2(const char *text, int length) {
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(text + i)));
+        if (high != 0) {
+            return i + lowestBit64((uint64_t)high);
+        }
+    }
+    return i + asciiPrefixScalar(text + i, length - i);
+}
+#endif
+
+#ifdef MATCH_KERNEL_AVX2
+__attribute__((target("avx2")))
+int asciiPrefixAvx2(const char *text, int length) {
+    int i = 0;
+    for (; i + 32 <= length; i += 32) {
+        uint32_t high = (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(text + i)));
+        if (high != 0) {
+            return i + lowestBit64(high);
+        }
+    }
+    return i + asciiPrefixScalar(text + i, length - i);
+}
+#endif
+
+#ifdef MATCH_KERNEL_NEON
+// The largest byte of a block tells whether any has its top bit set
+int asciiPrefixNeon(const char *text, int length) {
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        if (vmaxvq_u8(vld1q_u8((const uint8_t *)(text + i))) >= 0x80) {
+            break;
+        }
+    }
+    return i + asciiPrefixScalar(text + i, length - i);
+}
+#endif
+
+// Fold values into a running scan, one at a time
+void scanColumnScalar(const float *values, int count, float limit, ColumnScan *scan) {
+    for (int i = 0; i < count; i++) {
+        float value = values[i];
+        if (scan->count == 0) {
+            scan->min = scan->max = value;
+        } else if (value < scan->min) {
+            scan->min = value;
+        } else if (value > scan->max) {
+            scan->max = value;
+        }
+        scan->sum += value;
+        scan->below += value < limit;
+        scan->count++;
+    }
+}
+
+// Fold the scan of another part of a column into scan
+void mergeColumnScan(ColumnScan *scan, const ColumnScan *part) {
+    if (part->count == 0) {
+        return;
+    }
+    if (scan->count == 0 || part->min < scan->min) {
+        scan->min = part->min;
+    }
+    if (scan->count == 0 || part->max > scan->max) {
+        scan->max = part->max;
+    }
+    scan->sum += part->sum;
+    scan->below += part->below;
+    scan->count += part->count;
+}
+
+#ifdef MATCH_KERNEL_SSE2
+// Four lanes of minimum, maximum and count; the sum is kept in doubles
+// A compare gives -1 in a true lane, so subtracting it counts
+void scanColumnSse2(const float *values, int count, float limit, ColumnScan *scan) {
+    int i = 0;
+    if (count >= 4) {
+        __m128 low = _mm_loadu_ps(values);
+        __m128 high = low;
+        __m128d sumLow = _mm_setzero_pd();
+        __m128d sumHigh = _mm_setzero_pd();
+        __m128i below = _mm_setzero_si128();
+        __m128 bound = _mm_set1_ps(limit);
+        for (; i + 4 <= count; i += 4) {
+            __m128 v = _mm_loadu_ps(values + i);
+            low = _mm_min_ps(low, v);
+            high = _mm_max_ps(high, v);
+            sumLow = _mm_add_pd(sumLow, _mm_cvtps_pd(v));
+            sumHigh = _mm_add_pd(sumHigh, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+            below = _mm_sub_epi32(below, _mm_castps_si128(_mm_cmplt_ps(v, bound)));
+        }
+        float lows[4], highs[4];
+        double sums[4];
+        int32_t belows[4];
+        _mm_storeu_ps(lows, low);
+        _mm_storeu_ps(highs, high);
+        _mm_storeu_pd(sums, sumLow);
+        _mm_storeu_pd(sums + 2, sumHigh);
+        _mm_storeu_si128((__m128i *)belows, below);
+        ColumnScan part = { lows[0], highs[0], 0.0, 0, i };
+        for (int lane = 0; lane < 4; lane++) {
+            part.min = (lows[lane] < part.min) ? lows[lane] : part.min;
+            part.max = (highs[lane] > part.max) ? highs[lane] : part.max;
+            part.sum += sums[lane];
+            part.below += belows[lane];
+        }
+        mergeColumnScan(scan, &part);
+    }
+    scanColumnScalar(values + i, count - i, limit, scan);
+}
+#endif
+
+#ifdef MATCH_KERNEL_AVX2
+__attribute__((target("avx2")))
+void scanColumnAvx2(const float *values, int count, float limit, ColumnScan *scan) {
+    int i = 0;
+    if (count >= 8) {
+        __m256 low = _mm256_loadu_ps(values);
+        __m256 high = low;
+        __m256d sumLow = _mm256_setzero_pd();
+        __m256d sumHigh = _mm256_setzero_pd();
+        __m256i below = _mm256_setzero_si256();
+        __m256 bound = _mm256_set1_ps(limit);
+        for (; i + 8 <= count; i += 8) {
+            __m256 v = _mm256_loadu_ps(values + i);
+            low = _mm256_min_ps(low, v);
+            high = _mm256_max_ps(high, v);
+            sumLow = _mm256_add_pd(sumLow, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+            sumHigh = _mm256_add_pd(sumHigh, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+            below = _mm256_sub_epi32(below, _mm256_castps_si256(_mm256_cmp_ps(v, bound, _CMP_LT_OQ)));
+        }
+        // Halved to four lanes, and the upper halves cleared, before any scalar code runs
+        __m256d sums = _mm256_add_pd(sumLow, sumHigh);
+        float lows[4], highs[4];
+        double halves[4];
+        int32_t belows[4];
+        _mm_storeu_ps(lows, _mm_min_ps(_mm256_castps256_ps128(low), _mm256_extractf128_ps(low, 1)));
+        _mm_storeu_ps(highs, _mm_max_ps(_mm256_castps256_ps128(high), _mm256_extractf128_ps(high, 1)));
+        _mm256_storeu_pd(halves, sums);
+        _mm_storeu_si128((__m128i *)belows, _mm_add_epi32(_mm256_castsi256_si128(below),
+                                                           _mm256_extracti128_si256(below, 1)));
+        _mm256_zeroupper();
+        ColumnScan part = { lows[0], highs[0], 0.0, 0, i };
+        for (int lane = 0; lane < 4; lane++) {
+            part.min = (lows[lane] < part.min) ? lows[lane] : part.min;
+            part.max = (highs[lane] > part.max) ? highs[lane] : part.max;
+            part.sum += halves[lane];
+            part.below += belows[lane];
+        }
+        mergeColumnScan(scan, &part);
+    }
+    scanColumnScalar(values + i, count - i, limit, scan);
+}
+#endif
+
+#ifdef MATCH_KERNEL_NEON
+void scanColumnNeon(const float *values, int count, float limit, ColumnScan *scan) {
+    int i = 0;
+    if (count >= 4) {
+        float32x4_t low = vld1q_f32(values);
+        float32x4_t high = low;
+        float64x2_t sumLow = vdupq_n_f64(0.0);
+        float64x2_t sumHigh = vdupq_n_f64(0.0);
+        uint32x4_t below = vdupq_n_u32(0);
+        float32x4_t bound = vdupq_n_f32(limit);
+        for (; i + 4 <= count; i += 4) {
+            float32x4_t v = vld1q_f32(values + i);
+            low = vminq_f32(low, v);
+            high = vmaxq_f32(high, v);
+            sumLow = vaddq_f64(sumLow, vcvt_f64_f32(vget_low_f32(v)));
+            sumHigh = vaddq_f64(sumHigh, vcvt_high_f64_f32(v));
+            below = vsubq_u32(below, vcltq_f32(v, bound));
+        }
+        ColumnScan part = { vminvq_f32(low), vmaxvq_f32(high), vaddvq_f64(vaddq_f64(sumLow, sumHigh)),
+                            vaddvq_u32(below), i };
+        mergeColumnScan(scan, &part);
+    }
+    scanColumnScalar(values + i, count - i, limit, scan);
+}
+#endif
+
+// Pick the widest compare, ASCII scan and column scan kernels this CPU supports
+void initMatchKernel(void) {
+    matchBlock = matchBlockScalar;
+    asciiPrefix = asciiPrefixScalar;
+    scanColumn = scanColumnScalar;
+    #ifdef MATCH_KERNEL_SSE2
+        matchBlock = matchBlockSse2;
+        asciiPrefix = asciiPrefixSse2;
+        scanColumn = scanColumnSse2;
+    #endif
+    #ifdef MATCH_KERNEL_NEON
+        matchBlock = matchBlockNeon;
+        asciiPrefix = asciiPrefixNeon;
+        scanColumn = scanColumnNeon;
+    #endif
+    #ifdef MATCH_KERNEL_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            matchBlock = matchBlockAvx2;
+            asciiPrefix = asciiPrefixAvx2;
+            scanColumn = scanColumnAvx2;
+        }
+    #endif
+}
+
+int popcount64(uint64_t value) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(value);
+    #else
+        value = value - ((value >> 1) & 0x5555555555555555ULL);
+        value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+        value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        return (int)((value * 0x0101010101010101ULL) >> 56);
+    #endif
+}
+
+// Index of the lowest set bit; value must not be 0
+int lowestBit64(uint64_t value) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(value);
+    #else
+        int bit = 0;
+        while (!(value & 1)) {
+            value >>= 1;
+            bit++;
+        }
+        return bit;
+    #endif
+}
+
+// Number of positions where a and b hold the same character
+int countMatches(const char *a, const char *b, int length) {
+    int matches = 0;
+    for (int i = 0; i < length; i += 64) {
+        int block = (length - i < 64) ? length - i : 64;
+        matches += popcount64(matchBlock(a + i, b + i, block));
+    }
+    return matches;
+}
+
+// Monotonic wall-clock time in nanoseconds, unaffected by CPU time or clock changes
+long long monotonicNanos(void) {
+    #ifdef _WIN32
+        static LARGE_INTEGER frequency;
+        LARGE_INTEGER now;
+        if (frequency.QuadPart == 0) {
+            QueryPerformanceFrequency(&frequency);
+        }
+        QueryPerformanceCounter(&now);
+        // Split the conversion so the multiplication cannot overflow
+        return (now.QuadPart / frequency.QuadPart) * 1000000000LL +
+               (now.QuadPart % frequency.QuadPart) * 1000000000LL / frequency.QuadPart;
+    #else
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+    #endif
+}
+
+#ifdef LOWKEY_TRACE
+// Start the trace clock and export the buffers when the program exits
+void initTrace(void) {
+    traceOrigin = monotonicNanos();
+    atexit(traceExport);
+}
+
+// This thread's buffer, created and registered by its first event
+TraceBuffer *traceBuffer(void) {
+    if (traceLocal != NULL || traceRefused) {
+        return traceLocal;
+    }
+    #if defined(__GNUC__) || defined(__clang__)
+        uint32_t thread = __atomic_fetch_add(&traceThreadCount, 1, __ATOMIC_RELAXED);
+    #else
+        uint32_t thread = (uint32_t)InterlockedIncrement((volatile LONG *)&traceThreadCount) - 1;
+    #endif
+    TraceBuffer *buffer = thread < TRACE_MAX_THREADS ? calloc(1, sizeof(TraceBuffer)) : NULL;
+    if (buffer == NULL) {
+        traceRefused = 1;
+        return NULL;
+    }
+    buffer->thread = (int)thread;
+    #if defined(__GNUC__) || defined(__clang__)
+        __atomic_store_n(&traceBuffers[thread], buffer, __ATOMIC_RELEASE);
+    #else
+        InterlockedExchangePointer((PVOID volatile *)&traceBuffers[thread], buffer);
+    #endif
+    traceLocal = buffer;
+    return buffer;
+}
+
+void traceRecord(const char *name, long long start, long long duration, long long value) {
+    TraceBuffer *buffer = traceBuffer();
+    if (buffer == NULL) {
+        return;
+    }
+    if (buffer->count == TRACE_EVENTS) {
+        buffer->dropped++;
+        return;
+    }
+    TraceEvent *event = &buffer->events[buffer->count++];
+    event->name = name;
+    event->start = start;
+    event->duration = duration;
+    event->value = value;
+}
+
+// Record a span from start until now
+void traceSpan(const char *name, long long start, long long value) {
+    traceRecord(name, start, monotonicNanos() - start, value);
+}
+
+// Count a batch of keys and remember when the oldest undisplayed one arrived
+void traceKeys(int count) {
+    if (count <= 0) {
+        return;
+    }
+    long long now = monotonicNanos();
+    TraceBuffer *buffer = traceBuffer();
+    if (buffer != NULL) {
+        buffer->keys += count;
+        traceRecord("keystrokes", now, -1, buffer->keys);
+    }
+    if (traceInputStamp == 0) {
+        traceInputStamp = now;
+    }
+}
+
+// The frame just written shows every key read since the last one
+void traceDisplayed(void) {
+    if (traceInputStamp != 0) {
+        traceSpan("input_to_display", traceInputStamp, 0);
+        traceInputStamp = 0;
+    }
+}
+
+// Write every buffer as Chrome trace events, and summarise the spans on stderr
+void traceExport(void) {
+    FILE *out = fopen(TRACE_FILE, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error: Could not create %s.\n", TRACE_FILE);
+        return;
+    }
+    const char *names[TRACE_MAX_NAMES];
+    long long counts[TRACE_MAX_NAMES], totals[TRACE_MAX_NAMES], longest[TRACE_MAX_NAMES];
+    long long slow[TRACE_MAX_NAMES]; // Spans of 1 ms or more
+    int nameCount = 0;
+    long long events = 0, dropped = 0;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    uint32_t threads = traceThreadCount < TRACE_MAX_THREADS ? traceThreadCount : TRACE_MAX_THREADS;
+    for (uint32_t t = 0; t < threads; t++) {
+        const TraceBuffer *buffer = traceBuffers[t];
+        if (buffer == NULL) {
+            continue;
+        }
+        dropped += buffer->dropped;
+        for (int i = 0; i < buffer->count; i++) {
+            const TraceEvent *event = &buffer->events[i];
+            double ts = (event->start - traceOrigin) / 1000.0; // Microseconds
+            if (event->duration < 0) {
+                fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f,"
+                             " \"args\": {\"value\": %lld}}",
+                        events++ ? "," : "", event->name, buffer->thread, ts, event->value);
+                continue;
+            }
+            fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f,"
+                         " \"dur\": %.3f, \"args\": {\"value\": %lld}}",
+                    events++ ? "," : "", event->name, buffer->thread, ts, event->duration / 1000.0,
+                    event->value);
+
+            int n = 0;
+            while (n < nameCount && names[n] != event->name) {
+                n++;
+            }
+            if (n == nameCount && nameCount < TRACE_MAX_NAMES) {
+                names[nameCount] = event->name;
+                counts[n] = totals[n] = longest[n] = slow[n] = 0;
+                nameCount++;
+            }
+            if (n < nameCount) {
+                counts[n]++;
+                totals[n] += event->duration;
+                longest[n] = event->duration > longest[n] ? event->duration : longest[n];
+                slow[n] += event->duration >= 1000000;
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+    int ok = fclose(out) == 0;
+
+    fprintf(stderr, "%s %lld trace events to %s", ok ? "Wrote" : "Could not write", events, TRACE_FILE);
+    if (dropped > 0) {
+        fprintf(stderr, " (%lld dropped)", dropped);
+    }
+    fprintf(stderr, "\n");
+    for (int n = 0; n < nameCount; n++) {
+        fprintf(stderr, "  %-16s %8lld spans, mean %.3f ms, max %.3f ms, %lld over 1 ms\n", names[n],
+                counts[n], totals[n] / 1e6 / counts[n], longest[n] / 1e6, slow[n]);
+    }
+}
+#endif
+
+// Store a keystroke timestamp, overwriting the oldest once the ring is full
+void recordKeystroke(KeystrokeRing *ring, long long timestamp) {
+    ring->timestamps[ring->count & (KEYSTROKE_RING_SIZE - 1)] = timestamp;
+    ring->count++;
+}
+
+// Time since the last recorded keystroke, or 0 before the first
+long long keystrokeGap(const KeystrokeRing *ring, long long timestamp) {
+    if (ring->count == 0) {
+        return 0;
+    }
+    return timestamp - ring->timestamps[(ring->count - 1) & (KEYSTROKE_RING_SIZE - 1)];
+}
+
+// Comparison function for qsort on long long values
+int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Fill in p50/p95/p99 of the gaps between the keystrokes still in the ring
+void computeLatencyPercentiles(KeystrokeRing *ring, TypingResult *result) {
+    int kept = ring->count < KEYSTROKE_RING_SIZE ? ring->count : KEYSTROKE_RING_SIZE;
+    int first = ring->count - kept;
+    int intervalCount = 0;
+
+    for (int i = first + 1; i < ring->count; i++) {
+        ring->intervals[intervalCount++] =
+            ring->timestamps[i & (KEYSTROKE_RING_SIZE - 1)] -
+            ring->timestamps[(i - 1) & (KEYSTROKE_RING_SIZE - 1)];
+    }
+
+    result->latencyP50 = result->latencyP95 = result->latencyP99 = 0;
+    if (intervalCount == 0) {
+        return;
+    }
+    qsort(ring->intervals, intervalCount, sizeof(long long), compareLongLong);
+
+    // Nearest-rank percentiles, converted from nanoseconds to milliseconds
+    result->latencyP50 = ring->intervals[(intervalCount * 50 + 99) / 100 - 1] / 1e6f;
+    result->latencyP95 = ring->intervals[(intervalCount * 95 + 99) / 100 - 1] / 1e6f;
+    result->latencyP99 = ring->intervals[(intervalCount * 99 + 99) / 100 - 1] / 1e6f;
+}
+
+// Prepare an empty arena; blocks are allocated on first use
+void initArena(Arena *arena, size_t blockSize) {
+    arena->current = NULL;
+    arena->blockSize = blockSize;
+    arenaAlloc(arena, 0); // Allocate the first block up front, not during the first test
+}
+
+// Bump-allocate size bytes, 16-byte aligned; returns NULL when out of memory
+void *arenaAlloc(Arena *arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    ArenaBlock *block = arena->current;
+
+    if (block == NULL || block->capacity - block->used < size) {
+        size_t capacity = arena->blockSize > size ? arena->blockSize : size;
+        ArenaBlock *fresh = malloc(sizeof(ArenaBlock) + 15 + capacity);
+        if (fresh == NULL) {
+            return NULL;
+        }
+        fresh->previous = block;
+        fresh->capacity = capacity;
+        fresh->used = 0;
+        arena->current = block = fresh;
+    }
+
+    // Memory starts at the first 16-byte boundary after the header
+    char *base = (char *)(((uintptr_t)(block + 1) + 15) & ~(uintptr_t)15);
+    void *result = base + block->used;
+    block->used += size;
+    return result;
+}
+
+// Grow an allocation, in place when it is the most recent one
+void *arenaResize(Arena *arena, void *block, size_t oldSize, size_t newSize) {
+    ArenaBlock *current = arena->current;
+    oldSize = (oldSize + 15) & ~(size_t)15;
+
+    if (block != NULL && current != NULL) {
+        char *base = (char *)(((uintptr_t)(current + 1) + 15) & ~(uintptr_t)15);
+        size_t aligned = (newSize + 15) & ~(size_t)15;
+        if ((char *)block + oldSize == base + current->used &&
+            (size_t)((char *)block - base) + aligned <= current->capacity) {
+            current->used = (size_t)((char *)block - base) + aligned;
+            return block;
+        }
+    }
+
+    void *moved = arenaAlloc(arena, newSize);
+    if (moved != NULL && block != NULL) {
+        memcpy(moved, block, oldSize < newSize ? oldSize : newSize);
+    }
+    return moved;
+}
+
+// Forget every allocation; if several blocks were needed, keep one big enough for all
+void resetArena(Arena *arena) {
+    ArenaBlock *block = arena->current;
+    if (block == NULL) {
+        return;
+    }
+    if (block->previous != NULL) {
+        size_t total = 0;
+        while (block != NULL) {
+            ArenaBlock *previous = block->previous;
+            total += block->capacity;
+            free(block);
+            block = previous;
+        }
+        arena->current = NULL;
+        if (total > arena->blockSize) {
+            arena->blockSize = total;
+        }
+        arenaAlloc(arena, 0); // The next test starts with one block that fits it
+        return;
+    }
+    block->used = 0;
+}
+
+// Release every block
+void freeArena(Arena *arena) {
+    resetArena(arena);
+    free(arena->current);
+    arena->current = NULL;
+}
+
+// Start an empty text in the given arena
+void initTextBuilder(TextBuilder *builder, Arena *arena) {
+    memset(builder, 0, sizeof(*builder));
+    builder->arena = arena;
+}
+
+// Append a word, space-separated from the previous one, and record where it starts
+int appendWord(TextBuilder *builder, const char *word, int length) {
+    int separator = (builder->wordCount > 0) ? 1 : 0;
+    int needed = builder->length + separator + length + 1;
+
+    if (needed > builder->capacity) {
+        int capacity = builder->capacity ? builder->capacity * 2 : 256;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char *text = arenaResize(builder->arena, builder->text, builder->capacity, capacity);
+        if (text == NULL) {
+            return 0;
+        }
+        builder->text = text;
+        builder->capacity = capacity;
+    }
+    if (builder->wordCount == builder->wordCapacity) {
+        int capacity = builder->wordCapacity ? builder->wordCapacity * 2 : 32;
+        int *starts = arenaResize(builder->arena, builder->wordStarts,
+                                  builder->wordCapacity * sizeof(int), capacity * sizeof(int));
+        if (starts == NULL) {
+            return 0;
+        }
+        builder->wordStarts = starts;
+        builder->wordCapacity = capacity;
+    }
+
+    if (separator) {
+        builder->text[builder->length++] = ' ';
+    }
+    builder->wordStarts[builder->wordCount++] = builder->length;
+    memcpy(builder->text + builder->length, word, length);
+    builder->length += length;
+    builder->text[builder->length] = '\0';
+    return 1;
+}
+
+// Make room for extra more characters and the terminating null
+int reserveText(TextBuilder *builder, int extra) {
+    int needed = builder->length + extra + 1;
+    if (needed <= builder->capacity) {
+        return 1;
+    }
+    int capacity = builder->capacity ? builder->capacity * 2 : 256;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    char *text = arenaResize(builder->arena, builder->text, builder->capacity, capacity);
+    if (text == NULL) {
+        return 0;
+    }
+    builder->text = text;
+    builder->capacity = capacity;
+    return 1;
+}
+
+// Record the start of every word in text[from..length), where a word is
+// anything between spaces and newlines
+int markWords(TextBuilder *builder, int from) {
+    for (int i = from; i < builder->length; i++) {
+        char ch = builder->text[i];
+        if (ch == ' ' || ch == '\n' || (i > 0 && builder->text[i - 1] != ' ' && builder->text[i - 1] != '\n')) {
+            continue;
+        }
+        if (builder->wordCount == builder->wordCapacity) {
+            int capacity = builder->wordCapacity ? builder->wordCapacity * 2 : 32;
+            int *starts = arenaResize(builder->arena, builder->wordStarts,
+                                      builder->wordCapacity * sizeof(int), capacity * sizeof(int));
+            if (starts == NULL) {
+                return 0;
+            }
+            builder->wordStarts = starts;
+            builder->wordCapacity = capacity;
+        }
+        builder->wordStarts[builder->wordCount++] = i;
+    }
+    return 1;
+}
+
+// Append text exactly as it is, spacing and line breaks included
+int appendText(TextBuilder *builder, const char *text, int length) {
+    if (!reserveText(builder, length)) {
+        return 0;
+    }
+    int from = builder->length;
+    memcpy(builder->text + from, text, length);
+    builder->length += length;
+    builder->text[builder->length] = '\0';
+    return markWords(builder, from);
+}
+
+// SplitMix64 step, used to expand one seed into generator state
+uint64_t splitMix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Seed xoshiro256** so the same seed always gives the same sequence
+void seedRng(Rng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitMix64(&seed);
+    }
+}
+
+// Next 64 random bits from xoshiro256**
+uint64_t rngNext(Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t x = s[1] * 5;
+    uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+// Uniform value in [0, bound) without modulo bias (Lemire's method)
+uint32_t rngBounded(Rng *rng, uint32_t bound) {
+    uint64_t product = (rngNext(rng) >> 32) * bound;
+    uint32_t low = (uint32_t)product;
+    if (low < bound) {
+        uint32_t threshold = (0u - bound) % bound;
+        while (low < threshold) {
+            product = (rngNext(rng) >> 32) * bound;
+            low = (uint32_t)product;
+        }
+    }
+    return (uint32_t)(product >> 32);
+}
+
+// Prepare a sampler; the swap table is allocated on first use
+void initWordSampler(WordSampler *sampler, uint64_t seed) {
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->seed = seed;
+    seedRng(&sampler->rng, seed);
+}
+
+// Start drawing distinct indexes from [0, population)
+void beginSample(WordSampler *sampler, int population) {
+    sampler->population = population;
+    sampler->drawn = 0;
+    sampler->used = 0;
+    for (int i = 0; i < sampler->capacity; i++) {
+        sampler->slots[i] = -1;
+    }
+}
+
+// Find a permutation position in the swap table, optionally adding it
+// Returns the table index, or -1 if it is absent (or cannot be added)
+int samplerSlot(WordSampler *sampler, int position, int insert) {
+    if (insert && (sampler->used + 1) * 2 > sampler->capacity) {
+        // Grow and rehash to keep probes short
+        int capacity = sampler->capacity ? sampler->capacity * 2 : 64;
+        int *slots = malloc(capacity * sizeof(int));
+        int *values = malloc(capacity * sizeof(int));
+        if (slots == NULL || values == NULL) {
+            free(slots);
+            free(values);
+            return -1;
+        }
+        for (int i = 0; i < capacity; i++) {
+            slots[i] = -1;
+        }
+        for (int i = 0; i < sampler->capacity; i++) {
+            if (sampler->slots[i] >= 0) {
+                int h = (int)(((uint32_t)sampler->slots[i] * 2654435761u) & (capacity - 1));
+                while (slots[h] >= 0) {
+                    h = (h + 1) & (capacity - 1);
+                }
+                slots[h] = sampler->slots[i];
+                values[h] = sampler->values[i];
+            }
+        }
+        free(sampler->slots);
+        free(sampler->values);
+        sampler->slots = slots;
+        sampler->values = values;
+        sampler->capacity = capacity;
+    }
+    if (sampler->capacity == 0) {
+        return -1;
+    }
+
+    int h = (int)(((uint32_t)position * 2654435761u) & (sampler->capacity - 1));
+    while (sampler->slots[h] >= 0) {
+        if (sampler->slots[h] == position) {
+            return h;
+        }
+        h = (h + 1) & (sampler->capacity - 1);
+    }
+    if (!insert) {
+        return -1;
+    }
+    sampler->slots[h] = position;
+    sampler->values[h] = position;
+    sampler->used++;
+    return h;
+}
+
+// Draw the next index with one step of a partial Fisher-Yates shuffle
+// Indexes only repeat once the whole population has been drawn
+int nextSample(WordSampler *sampler) {
+    if (sampler->drawn == sampler->population) {
+        beginSample(sampler, sampler->population); // Start a fresh pass
+    }
+    int i = sampler->drawn++;
+    int j = i + (int)rngBounded(&sampler->rng, (uint32_t)(sampler->population - i));
+
+    // Positions never swapped still hold their own index
+    int slot = samplerSlot(sampler, i, 0);
+    int valueI = (slot >= 0) ? sampler->values[slot] : i;
+
+    // Swap: position j yields its word and takes over the one at i,
+    // which is never looked at again in this pass
+    slot = samplerSlot(sampler, j, 1);
+    if (slot < 0) {
+        return j; // Out of memory: still a valid index, just not distinct
+    }
+    int picked = sampler->values[slot];
+    sampler->values[slot] = valueI;
+    return picked;
+}
+
+// Release the swap table
+void freeWordSampler(WordSampler *sampler) {
+    free(sampler->slots);
+    free(sampler->values);
+    memset(sampler, 0, sizeof(*sampler));
+}
+
+// Position of a letter in the bigram table, or -1 for anything else
+int letterIndex(int ch) {
+    if (ch >= 'a' && ch <= 'z') {
+        return ch - 'a';
+    }
+    if (ch >= 'A' && ch <= 'Z') {
+        return ch - 'A';
+    }
+    return -1;
+}
+
+// Count one attempt into a skill counter, halving it first when it is full
+void countSkill(uint16_t *attempts, uint16_t *errors, uint16_t *timed, uint32_t *latency,
+                int correct, uint32_t millis) {
+    if (*attempts == UINT16_MAX || *timed == UINT16_MAX) {
+        *attempts /= 2;
+        *errors /= 2;
+        *timed /= 2;
+        *latency /= 2;
+    }
+    (*attempts)++;
+    *errors += !correct;
+    if (millis > 0) {
+        (*timed)++;
+        *latency += millis;
+    }
+}
+
+// Count one typed character against the key and the letter bigram it ends
+// gap is the time since the previous keystroke; keys that shared a batch
+// have no gap of their own and only count towards the error rates
+void recordSkill(SkillTable *skills, int previous, int target, int correct, long long gap) {
+    if (target < 32 || target > 126) {
+        return;
+    }
+    long long millis = gap / 1000000;
+    if (millis > SKILL_MAX_LATENCY_MS) {
+        millis = SKILL_MAX_LATENCY_MS;
+    }
+    int key = target - 32;
+    countSkill(&skills->keyAttempts[key], &skills->keyErrors[key], &skills->keyTimed[key],
+               &skills->keyLatency[key], correct, (uint32_t)millis);
+
+    int first = letterIndex(previous);
+    int second = letterIndex(target);
+    if (first >= 0 && second >= 0) {
+        int pair = first * 26 + second;
+        countSkill(&skills->pairAttempts[pair], &skills->pairErrors[pair], &skills->pairTimed[pair],
+                   &skills->pairLatency[pair], correct, (uint32_t)millis);
+    }
+}
+
+// How much each bigram needs practice, from 0 to 255
+// The error rate starts from a prior of 1 in 20, so a pair seen a handful of
+// times cannot swing it; a pair slower than the user's average key adds up to 0.25
+void skillWeakness(const SkillTable *skills, unsigned char *weakness) {
+    double latency = 0;
+    long long timed = 0;
+    for (int key = 0; key < SKILL_KEYS; key++) {
+        latency += skills->keyLatency[key];
+        timed += skills->keyTimed[key];
+    }
+    double meanLatency = timed ? latency / timed : 0;
+
+    for (int pair = 0; pair < SKILL_PAIRS; pair++) {
+        double score = (skills->pairErrors[pair] + 1.0) / (skills->pairAttempts[pair] + 20.0);
+        if (meanLatency > 0 && skills->pairTimed[pair] >= 5) {
+            double slowness = skills->pairLatency[pair] / (double)skills->pairTimed[pair] / meanLatency - 1;
+            if (slowness > 0) {
+                score += 0.25 * (slowness < 1 ? slowness : 1);
+            }
+        }
+        weakness[pair] = (unsigned char)(score >= 1 ? 255 : score * 255 + 0.5);
+    }
+}
+
+// Path of a user's skill table, next to their history log
+void skillFileName(const char *username, char *buffer, size_t size) {
+    userFileName(username, ".skill", buffer, size);
+}
+
+// Load the current user's skill counters; a user without a file starts from zero
+void loadSkills(AppState *state) {
+    char fileName[HISTORY_PATH_LEN];
+    skillFileName(state->users[state->currentUserIndex].name, fileName, sizeof(fileName));
+    FILE *file = fopen(fileName, "rb");
+    int ok = file != NULL &&
+             fread(&state->skills, sizeof(SkillTable), 1, file) == 1 &&
+             memcmp(state->skills.magic, SKILL_MAGIC, 4) == 0 &&
+             state->skills.version == SKILL_VERSION;
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (!ok) {
+        memset(&state->skills, 0, sizeof(SkillTable));
+        memcpy(state->skills.magic, SKILL_MAGIC, 4);
+        state->skills.version = SKILL_VERSION;
+    }
+}
+
+// Hand a copy of the current user's skill table to the persistence worker
+int saveSkills(AppState *state) {
+    PersistEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = PERSIST_EVENT_SKILLS;
+    snprintf(event.name, sizeof(event.name), "%s", state->users[state->currentUserIndex].name);
+    event.data.skills = malloc(sizeof(SkillTable));
+    if (event.data.skills == NULL) {
+        // No copy to queue, so write it before the session changes it
+        persistFlush(&state->persist);
+        if (!writeSkillFile(event.name, &state->skills)) {
+            framePrintf("Error: Could not write a skill table in %s.\n", HISTORY_DIR);
+            return 0;
+        }
+        return 1;
+    }
+    memcpy(event.data.skills, &state->skills, sizeof(SkillTable));
+    persistPush(&state->persist, &event);
+    return 1;
+}
+
+// Replace a user's skill file; runs on the persistence worker
+int writeSkillFile(const char *username, const SkillTable *skills) {
+    char fileName[HISTORY_PATH_LEN];
+    skillFileName(username, fileName, sizeof(fileName));
+    makeHistoryDir();
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) {
+        return 0;
+    }
+    int ok = fwrite(skills, sizeof(SkillTable), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+// List the letter bigrams of every word once, so a session can weight the
+// words without walking their text again
+int indexWordPairs(WordList *list) {
+    free(list->pairs);
+    free(list->pairStarts);
+    list->pairs = NULL;
+    list->pairStarts = malloc((size_t)(list->count + 1) * sizeof(int));
+    if (list->pairStarts == NULL) {
+        return 0;
+    }
+
+    int total = 0;
+    for (int w = 0; w < list->count; w++) {
+        int length;
+        const char *word = getWord(list, w, &length);
+        for (int i = 1; i < length; i++) {
+            total += (letterIndex(word[i - 1]) >= 0 && letterIndex(word[i]) >= 0);
+        }
+    }
+    list->pairs = malloc((size_t)(total ? total : 1) * sizeof(uint16_t));
+    if (list->pairs == NULL) {
+        free(list->pairStarts);
+        list->pairStarts = NULL;
+        return 0;
+    }
+
+    int used = 0;
+    for (int w = 0; w < list->count; w++) {
+        int length;
+        const char *word = getWord(list, w, &length);
+        list->pairStarts[w] = used;
+        for (int i = 1; i < length; i++) {
+            int first = letterIndex(word[i - 1]);
+            int second = letterIndex(word[i]);
+            if (first >= 0 && second >= 0) {
+                list->pairs[used++] = (uint16_t)(first * 26 + second);
+            }
+        }
+    }
+    list->pairStarts[list->count] = used;
+    return 1;
+}
+
+// Add delta to one word's weight in the Fenwick tree
+void adjustAdaptiveWeight(AdaptiveSampler *sampler, int index, double delta) {
+    for (int i = index + 1; i <= sampler->count; i += i & -i) {
+        sampler->tree[i] += delta;
+    }
+    sampler->total += delta;
+}
+
+// Weight every word by its weakest bigram, so words that practise a weak
+// pair come up up to 1 + ADAPTIVE_BOOST times as often
+// weakness is a table from skillWeakness, or NULL to draw uniformly
+// The endurance stream is typed a byte at a time, so words with non-ASCII
+// characters get no weight and are never drawn; usable counts the rest
+// The weights live in the arena, so the sampler is gone when it is reset
+int initAdaptiveSampler(AdaptiveSampler *sampler, Arena *arena, const WordList *list,
+                        const unsigned char *weakness, uint64_t seed) {
+    memset(sampler, 0, sizeof(*sampler));
+    seedRng(&sampler->rng, seed);
+    sampler->count = list->count;
+    sampler->weights = arenaAlloc(arena, (size_t)list->count * sizeof(double));
+    sampler->tree = arenaAlloc(arena, ((size_t)list->count + 1) * sizeof(double));
+    if (sampler->weights == NULL || sampler->tree == NULL) {
+        return 0;
+    }
+    memset(sampler->tree, 0, ((size_t)list->count + 1) * sizeof(double));
+
+    for (int w = 0; w < list->count; w++) {
+        int length;
+        const char *word = getWord(list, w, &length);
+        if (asciiPrefix(word, length) < length) {
+            sampler->weights[w] = 0;
+            continue;
+        }
+        int weakest = 0;
+        if (weakness != NULL && list->pairStarts != NULL) {
+            for (int p = list->pairStarts[w]; p < list->pairStarts[w + 1]; p++) {
+                if (weakness[list->pairs[p]] > weakest) {
+                    weakest = weakness[list->pairs[p]];
+                }
+            }
+        }
+        sampler->weights[w] = 1.0 + ADAPTIVE_BOOST * weakest / 255.0;
+        sampler->total += sampler->weights[w];
+        sampler->usable++;
+    }
+
+    // Build the tree in place in O(n): each node passes its sum to its parent
+    for (int i = 1; i <= list->count; i++) {
+        sampler->tree[i] += sampler->weights[i - 1];
+        int parent = i + (i & -i);
+        if (parent <= list->count) {
+            sampler->tree[parent] += sampler->tree[i];
+        }
+    }
+    return 1;
+}
+
+// Draw a word with probability proportional to its weight
+// The last ADAPTIVE_RECENT picks are held out, so a heavy word cannot repeat straight away
+int nextAdaptiveWord(AdaptiveSampler *sampler) {
+    double target = (rngNext(&sampler->rng) >> 11) * (1.0 / 9007199254740992.0) * sampler->total;
+    int index = 0;
+    int step = 1;
+    while (step * 2 <= sampler->count) {
+        step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+        if (index + step <= sampler->count && sampler->tree[index + step] <= target) {
+            index += step;
+            target -= sampler->tree[index];
+        }
+    }
+    if (index >= sampler->count) {
+        index = sampler->count - 1; // Rounding at the very top of the range
+        while (index > 0 && sampler->weights[index] == 0) {
+            index--;
+        }
+    }
+
+    if (sampler->usable > ADAPTIVE_RECENT) {
+        int slot = sampler->recentCount % ADAPTIVE_RECENT;
+        if (sampler->recentCount >= ADAPTIVE_RECENT) {
+            int back = sampler->recent[slot];
+            adjustAdaptiveWeight(sampler, back, sampler->weights[back]);
+        }
+        sampler->recent[slot] = index;
+        sampler->recentCount++;
+        adjustAdaptiveWeight(sampler, index, -sampler->weights[index]);
+    }
+    return index;
+}
+
+// Stat a leaderboard ranks users by
+float rankKey(const User *user, int metric) {
+    switch (metric) {
+        case RANK_BY_ACCURACY:
+            return user->bestAccuracy;
+        case RANK_BY_ENDURANCE:
+            return (float)user->enduranceHighScore;
+        default:
+            return user->bestWPM;
+    }
+}
+
+// Leaderboard order: higher stat first, then the user who joined first
+int rankBefore(const RankEntry *a, const RankEntry *b) {
+    if (a->key != b->key) {
+        return a->key > b->key;
+    }
+    return a->user < b->user;
+}
+
+// qsort comparison for building a rank index
+int compareRankEntries(const void *a, const void *b) {
+    const RankEntry *left = a;
+    const RankEntry *right = b;
+    if (rankBefore(left, right)) {
+        return -1;
+    }
+    return rankBefore(right, left) ? 1 : 0;
+}
+
+// Binary search for where (key, user) sits, or would be inserted
+int rankPosition(const RankIndex *rank, float key, int user) {
+    RankEntry probe = { key, user };
+    int low = 0;
+    int high = rank->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (rankBefore(&rank->entries[mid], &probe)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Sort every user once after loading; later changes move single entries
+// Returns 0 when out of memory
+int buildRankIndexes(AppState *state) {
+    if (!reserveUsers(state, state->userCount)) {
+        return 0;
+    }
+    // Loading fills users[] directly, so the columns are written here in one go
+    for (int i = 0; i < state->userCount; i++) {
+        storeUserColumns(state, i);
+    }
+    for (int m = 0; m < RANK_METRIC_COUNT; m++) {
+        RankIndex *rank = &state->ranks[m];
+        const float *keys = rankColumn(&state->columns, m);
+        for (int i = 0; i < state->userCount; i++) {
+            rank->entries[i].key = keys[i];
+            rank->entries[i].user = i;
+        }
+        rank->count = state->userCount;
+        if (rank->count > 0) { // An empty store has no entries array yet, and qsort wants one
+            qsort(rank->entries, rank->count, sizeof(RankEntry), compareRankEntries);
+        }
+    }
+    state->ranked = 1;
+    return 1;
+}
+
+// Move a user whose stats changed from before to their new place
+// Only metrics that actually changed are touched
+void updateUserRanks(AppState *state, int index, const User *before) {
+    if (!state->ranked) {
+        return;
+    }
+    for (int m = 0; m < RANK_METRIC_COUNT; m++) {
+        float oldKey = rankKey(before, m);
+        float newKey = rankKey(&state->users[index], m);
+        if (oldKey == newKey) {
+            continue;
+        }
+        RankIndex *rank = &state->ranks[m];
+        int from = rankPosition(rank, oldKey, index);
+        memmove(&rank->entries[from], &rank->entries[from + 1],
+                (rank->count - from - 1) * sizeof(RankEntry));
+        rank->count--;
+
+        int to = rankPosition(rank, newKey, index);
+        memmove(&rank->entries[to + 1], &rank->entries[to],
+                (rank->count - to) * sizeof(RankEntry));
+        rank->entries[to].key = newKey;
+        rank->entries[to].user = index;
+        rank->count++;
+    }
+}
+
+// 1-based leaderboard position of a user
+int userRank(AppState *state, int metric, int index) {
+    return rankPosition(&state->ranks[metric],
+                        rankKey(&state->users[index], metric), index) + 1;
+}
+
+// Display leaderboard
+// Show the top users by the chosen stat and the current user's position
+void showLeaderboard(AppState *state) {
+    framePrintf("\n===== Leaderboard =====\n");
+    if (state->userCount == 0) {
+        framePrintf("No users found.\n");
+        framePrintf("Press any key to continue...");
+        getch();
+        return;
+    }
+
+    framePrintf("Rank by:\n");
+    framePrintf("1. WPM\n");
+    framePrintf("2. Accuracy\n");
+    framePrintf("3. Endurance\n");
+    framePrintf("Enter your choice (1-3): ");
+    int metric = getValidIntInput(1, 3) - 1;
+    RankIndex *rank = &state->ranks[metric];
+    const UserColumns *columns = &state->columns;
+
+    // Display leaderboard
+    framePrintf("Rank | Username             | WPM    | Accuracy | Tests | Endurance\n");
+    framePrintf("-----|----------------------|--------|----------|-------|----------\n");
+
+    // Display top users
+    int displayCount = rank->count < LEADERBOARD_SIZE ? rank->count : LEADERBOARD_SIZE;
+    for (int i = 0; i < displayCount; i++) {
+        int index = rank->entries[i].user;
+        framePrintf("%-4d | %-20s | %-6.2f | %-8.2f | %-5d | %-5d\n",
+               i + 1,
+               columnName(columns, index),
+               columns->bestWPM[index],
+               columns->bestAccuracy[index],
+               columns->testsCompleted[index],
+               (int)columns->enduranceHighScore[index]);
+    }
+
+    // If current user is not in the top users, also display their position
+    int currentUserRank = userRank(state, metric, state->currentUserIndex);
+    if (currentUserRank > LEADERBOARD_SIZE) {
+        int index = state->currentUserIndex;
+        framePrintf("...\n");
+        framePrintf("%-4d | %-20s | %-6.2f | %-8.2f | %-5d | %-5d (You)\n",
+               currentUserRank,
+               columnName(columns, index),
+               columns->bestWPM[index],
+               columns->bestAccuracy[index],
+               columns->testsCompleted[index],
+               (int)columns->enduranceHighScore[index]);
+    }
+
+    // The spread of the ranked stat over every user, from one pass over its column
+    static const char *const metricNames[RANK_METRIC_COUNT] = { "Best WPM", "Best accuracy", "Endurance" };
+    ColumnScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scanColumn(rankColumn(columns, metric), state->userCount, 0.0f, &scan);
+    framePrintf("\n%s over %d users: %.2f to %.2f, average %.2f\n", metricNames[metric],
+           scan.count, scan.min, scan.max, scan.sum / scan.count);
+
+    framePrintf("\nPress any key to return to menu...");
+    getch();
+}
+
+// Path of one of a user's files in HISTORY_DIR; bytes that are unsafe in file
+// names become %XX escapes, so every distinct username gets its own files
+void userFileName(const char *username, const char *extension, char *buffer, size_t size) {
+    static const char hex[] = "0123456789ABCDEF";
+    char safe[3 * MAX_NAME_LEN];
+    int length = 0;
+    for (int i = 0; username[i] != '\0' && i < MAX_NAME_LEN - 1; i++) {
+        unsigned char ch = (unsigned char)username[i];
+        int plain = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+                    (ch >= '0' && ch <= '9') || ch == '-' || ch == '_';
+        if (plain) {
+            safe[length++] = (char)ch;
+        } else {
+            safe[length++] = '%';
+            safe[length++] = hex[ch >> 4];
+            safe[length++] = hex[ch & 15];
+        }
+    }
+    safe[length] = '\0';
+    snprintf(buffer, size, "%s/%s%s", HISTORY_DIR, safe, extension);
+}
+
+// Path of a user's history log
+void historyFileName(const char *username, char *buffer, size_t size) {
+    userFileName(username, ".hist", buffer, size);
+}
+
+void makeHistoryDir(void) {
+    #ifdef _WIN32
+        _mkdir(HISTORY_DIR);
+    #else
+        mkdir(HISTORY_DIR, 0755); // Fails harmlessly when it already exists
+    #endif
+}
+
+// Read only the summary block of a user's history log
+// Returns 0 when the user has no readable history yet
+int readHistorySummary(const char *username, HistorySummary *summary) {
+    char fileName[HISTORY_PATH_LEN];
+    historyFileName(username, fileName, sizeof(fileName));
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    int ok = fread(summary, sizeof(HistorySummary), 1, file) == 1 &&
+             memcmp(summary->magic, HISTORY_MAGIC, 4) == 0 &&
+             summary->version == HISTORY_VERSION;
+    fclose(file);
+    return ok;
+}
+
+// Hand one finished test to the persistence worker for the user's log
+int appendHistory(AppState *state, const TypingResult *result, int mode, int difficulty) {
+    PersistEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = PERSIST_EVENT_HISTORY;
+    snprintf(event.name, sizeof(event.name), "%s", state->users[state->currentUserIndex].name);
+
+    HistoryRecord *record = &event.data.history;
+    record->timestamp = (int64_t)time(NULL);
+    record->mode = (uint8_t)mode;
+    record->difficulty = (uint8_t)difficulty;
+    record->words = (uint16_t)result->wordsCompleted;
+    record->wpm = result->wpm;
+    record->accuracy = result->accuracy;
+    record->mistyped = result->mistyped;
+    record->missed = result->missed;
+    record->extra = result->extra;
+    record->duration = result->timeTaken;
+    persistPush(&state->persist, &event);
+    return 1;
+}
+
+// Append one record to the user's log and fold it into the summary; runs on
+// the persistence worker. The record goes in first, so a crash before the
+// summary is rewritten only loses that record; the stale count lets the next
+// append reuse its place. The summary is locked throughout, so sessions of
+// the same user in other processes append after this record, not over it
+int writeHistoryRecord(const char *username, const HistoryRecord *record) {
+    char fileName[HISTORY_PATH_LEN];
+    historyFileName(username, fileName, sizeof(fileName));
+
+    FILE *file = fopen(fileName, "r+b");
+    if (file == NULL) {
+        // Appending creates the log without emptying one another process just made
+        makeHistoryDir();
+        file = fopen(fileName, "ab");
+        if (file == NULL || fclose(file) != 0 || (file = fopen(fileName, "r+b")) == NULL) {
+            return 0;
+        }
+    }
+    #ifdef _WIN32
+        LockHandle lock = (HANDLE)_get_osfhandle(_fileno(file));
+    #else
+        LockHandle lock = fileno(file);
+    #endif
+    if (!lockFileRange(lock, 0, sizeof(HistorySummary), 1)) {
+        fclose(file);
+        return 0;
+    }
+
+    HistorySummary summary;
+    size_t got = fread(&summary, sizeof(summary), 1, file);
+    if (got == 0 && feof(file) && ftell(file) == 0) {
+        memset(&summary, 0, sizeof(summary)); // A new, empty log
+        memcpy(summary.magic, HISTORY_MAGIC, 4);
+        summary.version = HISTORY_VERSION;
+    } else if (got != 1 || memcmp(summary.magic, HISTORY_MAGIC, 4) != 0 ||
+               summary.version != HISTORY_VERSION) {
+        lockFileRange(lock, 0, sizeof(HistorySummary), 0);
+        fclose(file); // Not a history log this version can update
+        return 0;
+    }
+
+    // Last HISTORY_RECENT_SIZE results, oldest overwritten first
+    int slot = summary.count % HISTORY_RECENT_SIZE;
+    summary.recentWpm[slot] = record->wpm;
+    summary.recentAccuracy[slot] = record->accuracy;
+
+    // One bucket per UTC day, reused once it is HISTORY_DAYS days old
+    int32_t day = (int32_t)(record->timestamp / 86400);
+    HistoryDay *bucket = &summary.days[day % HISTORY_DAYS];
+    if (bucket->day != day) {
+        memset(bucket, 0, sizeof(HistoryDay));
+        bucket->day = day;
+    }
+    bucket->tests++;
+    bucket->wpmSum += record->wpm;
+    bucket->accuracySum += record->accuracy;
+
+    long offset = (long)(sizeof(HistorySummary) + (size_t)summary.count * sizeof(HistoryRecord));
+    summary.count++;
+    int ok = fseek(file, offset, SEEK_SET) == 0 &&
+             fwrite(record, sizeof(HistoryRecord), 1, file) == 1 &&
+             fflush(file) == 0 &&
+             fseek(file, 0, SEEK_SET) == 0 &&
+             fwrite(&summary, sizeof(summary), 1, file) == 1 &&
+             fflush(file) == 0;
+    lockFileRange(lock, 0, sizeof(HistorySummary), 0);
+    return fclose(file) == 0 && ok;
+}
+
+// Averages over the newest tests, at most window of them; returns how many were used
+int recentAverages(const HistorySummary *summary, int window, float *wpm, float *accuracy) {
+    int available = summary->count < HISTORY_RECENT_SIZE ? (int)summary->count : HISTORY_RECENT_SIZE;
+    int used = window < available ? window : available;
+    double wpmSum = 0, accuracySum = 0;
+    for (int i = 1; i <= used; i++) {
+        int slot = (int)((summary->count - i) % HISTORY_RECENT_SIZE);
+        wpmSum += summary->recentWpm[slot];
+        accuracySum += summary->recentAccuracy[slot];
+    }
+    *wpm = used ? (float)(wpmSum / used) : 0;
+    *accuracy = used ? (float)(accuracySum / used) : 0;
+    return used;
+}
+
+// Averages over tests from the last HISTORY_DAYS days; returns the number of tests
+int dailyAverages(const HistorySummary *summary, int32_t today, float *wpm, float *accuracy) {
+    int tests = 0;
+    double wpmSum = 0, accuracySum = 0;
+    for (int i = 0; i < HISTORY_DAYS; i++) {
+        const HistoryDay *bucket = &summary->days[i];
+        if (bucket->tests > 0 && bucket->day <= today && today - bucket->day < HISTORY_DAYS) {
+            tests += bucket->tests;
+            wpmSum += bucket->wpmSum;
+            accuracySum += bucket->accuracySum;
+        }
+    }
+    *wpm = tests ? (float)(wpmSum / tests) : 0;
+    *accuracy = tests ? (float)(accuracySum / tests) : 0;
+    return tests;
+}
+
+// Aggregate every user's history log and skill table into one report
+// Each worker fills its own totals, so they share nothing but the counter of
+// the next user; the totals are merged once every worker is done
+int runReport(AppState *state, const char *fileName) {
+    int threads = reportThreadCount();
+    if (threads > state->userCount) {
+        threads = state->userCount > 0 ? state->userCount : 1;
+    }
+    ReportWorker *workers = calloc(threads, sizeof(ReportWorker));
+    if (workers == NULL) {
+        framePrintf("Error: Not enough memory for the report.\n");
+        return 0;
+    }
+    volatile uint32_t nextUser = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].state = state;
+        workers[t].nextUser = &nextUser;
+    }
+    // This thread is worker 0; a worker that fails to start leaves its share to the others
+    for (int t = 1; t < threads; t++) {
+        #ifdef _WIN32
+            workers[t].thread = CreateThread(NULL, 0, reportThread, &workers[t], 0, NULL);
+            workers[t].started = workers[t].thread != NULL;
+        #else
+            workers[t].started = pthread_create(&workers[t].thread, NULL, reportThread, &workers[t]) == 0;
+        #endif
+    }
+    reportWorker(&workers[0]);
+    for (int t = 1; t < threads; t++) {
+        if (workers[t].started) {
+            #ifdef _WIN32
+                WaitForSingleObject(workers[t].thread, INFINITE);
+                CloseHandle(workers[t].thread);
+            #else
+                pthread_join(workers[t].thread, NULL);
+            #endif
+            mergeReportTotals(&workers[0].totals, &workers[t].totals);
+        }
+    }
+
+    ReportTotals *totals = &workers[0].totals;
+    size_t nameLength = strlen(fileName);
+    int json = nameLength >= 5 && strcmp(fileName + nameLength - 5, ".json") == 0;
+    FILE *out = fopen(fileName, "w");
+    if (out == NULL) {
+        framePrintf("Error: Could not create %s.\n", fileName);
+        free(workers);
+        return 0;
+    }
+    if (json) {
+        writeReportJson(out, totals);
+    } else {
+        writeReportCsv(out, totals);
+    }
+    if (fclose(out) != 0) {
+        framePrintf("Error: Could not write to %s.\n", fileName);
+        free(workers);
+        return 0;
+    }
+    long long tests = 0;
+    for (int m = 0; m <= HISTORY_MODE_TEXT; m++) {
+        tests += totals->modeTests[m];
+    }
+    framePrintf("Wrote a report of %lld tests by %lld users to %s using %d threads.\n",
+                tests, totals->users, fileName, threads);
+    free(workers);
+    return 1;
+}
+
+// Take users one at a time until none are left
+void reportWorker(ReportWorker *worker) {
+    for (;;) {
+        #if defined(__GNUC__) || defined(__clang__)
+            uint32_t index = __atomic_fetch_add(worker->nextUser, 1, __ATOMIC_RELAXED);
+        #else
+            uint32_t index = (uint32_t)InterlockedIncrement((volatile LONG *)worker->nextUser) - 1;
+        #endif
+        if (index >= (uint32_t)worker->state->userCount) {
+            return;
+        }
+        TRACE_BEGIN(userStart);
+        reportUser(&worker->state->users[index], &worker->totals);
+        TRACE_END("report_user", userStart, index);
+    }
+}
+
+#ifdef _WIN32
+DWORD WINAPI reportThread(LPVOID argument) {
+    reportWorker(argument);
+    return 0;
+}
+#else
+void *reportThread(void *argument) {
+    reportWorker(argument);
+    return NULL;
+}
+#endif
+
+// One report thread per online processor
+int reportThreadCount(void) {
+    #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        long count = (long)info.dwNumberOfProcessors;
+    #else
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+    if (count < 1) {
+        return 1;
+    }
+    return count < REPORT_MAX_THREADS ? (int)count : REPORT_MAX_THREADS;
+}
+
+// Fold one user's mapped history log and skill table into the totals
+void reportUser(const User *user, ReportTotals *totals) {
+    char fileName[HISTORY_PATH_LEN];
+    MappedFile map;
+
+    historyFileName(user->name, fileName, sizeof(fileName));
+    if (mapFile(fileName, &map)) {
+        HistorySummary summary;
+        if (map.size >= sizeof(summary)) {
+            memcpy(&summary, map.data, sizeof(summary));
+        }
+        if (map.size >= sizeof(summary) && memcmp(summary.magic, HISTORY_MAGIC, 4) == 0 &&
+            summary.version == HISTORY_VERSION) {
+            // A log being appended to may hold a record the summary does not count yet
+            size_t records = (map.size - sizeof(summary)) / sizeof(HistoryRecord);
+            if (records > summary.count) {
+                records = summary.count;
+            }
+            totals->users++;
+            for (size_t i = 0; i < records; i++) {
+                HistoryRecord record;
+                TypingResult result;
+                memcpy(&record, map.data + sizeof(summary) + i * sizeof(HistoryRecord), sizeof(record));
+                historyToResult(&record, &result);
+                addReportResult(totals, &result, record.mode, record.difficulty);
+            }
+        }
+        unmapFile(&map);
+    }
+
+    skillFileName(user->name, fileName, sizeof(fileName));
+    if (mapFile(fileName, &map)) {
+        const SkillTable *skills = (const SkillTable *)map.data;
+        if (map.size == sizeof(SkillTable) && memcmp(skills->magic, SKILL_MAGIC, 4) == 0 &&
+            skills->version == SKILL_VERSION) {
+            for (int pair = 0; pair < SKILL_PAIRS; pair++) {
+                totals->pairAttempts[pair] += skills->pairAttempts[pair];
+                totals->pairErrors[pair] += skills->pairErrors[pair];
+            }
+        }
+        unmapFile(&map);
+    }
+}
+
+// The parts of a test result that a history record keeps
+void historyToResult(const HistoryRecord *record, TypingResult *result) {
+    memset(result, 0, sizeof(*result));
+    result->wpm = record->wpm;
+    result->accuracy = record->accuracy;
+    result->mistyped = record->mistyped;
+    result->missed = record->missed;
+    result->extra = record->extra;
+    result->timeTaken = record->duration;
+    result->wordsCompleted = record->words;
+}
+
+void addReportResult(ReportTotals *totals, const TypingResult *result, int mode, int difficulty) {
+    if (mode >= 0 && mode <= HISTORY_MODE_TEXT) {
+        totals->modeTests[mode]++;
+    }
+    if (difficulty < 1 || difficulty > DIFFICULTY_COUNT) {
+        return; // Text mode results are only counted per mode
+    }
+    int d = difficulty - 1;
+    totals->tests[d]++;
+    totals->accuracySum[d] += result->accuracy;
+    totals->wpmSum[d] += result->wpm;
+    totals->mistyped[d] += result->mistyped;
+    totals->missed[d] += result->missed;
+    totals->extra[d] += result->extra;
+    int bucket = result->wpm > 0 ? (int)(result->wpm / REPORT_WPM_BUCKET) : 0;
+    totals->wpmHistogram[d][bucket < REPORT_WPM_BUCKETS ? bucket : REPORT_WPM_BUCKETS - 1]++;
+}
+
+void mergeReportTotals(ReportTotals *into, const ReportTotals *from) {
+    into->users += from->users;
+    for (int m = 0; m <= HISTORY_MODE_TEXT; m++) {
+        into->modeTests[m] += from->modeTests[m];
+    }
+    for (int d = 0; d < DIFFICULTY_COUNT; d++) {
+        into->tests[d] += from->tests[d];
+        into->accuracySum[d] += from->accuracySum[d];
+        into->wpmSum[d] += from->wpmSum[d];
+        into->mistyped[d] += from->mistyped[d];
+        into->missed[d] += from->missed[d];
+        into->extra[d] += from->extra[d];
+        for (int b = 0; b < REPORT_WPM_BUCKETS; b++) {
+            into->wpmHistogram[d][b] += from->wpmHistogram[d][b];
+        }
+    }
+    for (int pair = 0; pair < SKILL_PAIRS; pair++) {
+        into->pairAttempts[pair] += from->pairAttempts[pair];
+        into->pairErrors[pair] += from->pairErrors[pair];
+    }
+}
+
+// The bigrams with the most errors, most first; returns how many were found
+int mostMissedPairs(const ReportTotals *totals, int *pairs, int count) {
+    int found = 0;
+    for (int pair = 0; pair < SKILL_PAIRS; pair++) {
+        if (totals->pairErrors[pair] == 0) {
+            continue;
+        }
+        // Insertion into the short sorted list
+        int pos = found < count ? found++ : count;
+        while (pos > 0 && totals->pairErrors[pairs[pos - 1]] < totals->pairErrors[pair]) {
+            if (pos < count) {
+                pairs[pos] = pairs[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < count) {
+            pairs[pos] = pair;
+        }
+    }
+    return found;
+}
+
+// One row per value: section,difficulty,key,count,value; difficulty 0 means all
+void writeReportCsv(FILE *out, const ReportTotals *totals) {
+    static const char *modeNames[] = { "unknown", "endurance", "raw_speed", "race", "text" };
+    fprintf(out, "section,difficulty,key,count,value\n");
+    fprintf(out, "users,0,with_history,%lld,\n", totals->users);
+    for (int m = 1; m <= HISTORY_MODE_TEXT; m++) {
+        fprintf(out, "tests,0,%s,%lld,\n", modeNames[m], totals->modeTests[m]);
+    }
+    for (int d = 0; d < DIFFICULTY_COUNT; d++) {
+        long long tests = totals->tests[d];
+        double share = tests > 0 ? 1.0 / tests : 0;
+        fprintf(out, "accuracy,%d,mean,%lld,%.2f\n", d + 1, tests, totals->accuracySum[d] * share);
+        fprintf(out, "accuracy,%d,mistyped_per_test,%lld,%.2f\n", d + 1, tests, totals->mistyped[d] * share);
+        fprintf(out, "accuracy,%d,missed_per_test,%lld,%.2f\n", d + 1, tests, totals->missed[d] * share);
+        fprintf(out, "accuracy,%d,extra_per_test,%lld,%.2f\n", d + 1, tests, totals->extra[d] * share);
+        fprintf(out, "wpm,%d,mean,%lld,%.2f\n", d + 1, tests, totals->wpmSum[d] * share);
+        // Key is the bucket's lowest WPM, value its share of the difficulty's tests
+        for (int b = 0; b < REPORT_WPM_BUCKETS; b++) {
+            fprintf(out, "wpm,%d,%d,%lld,%.4f\n", d + 1, b * REPORT_WPM_BUCKET,
+                    totals->wpmHistogram[d][b], totals->wpmHistogram[d][b] * share);
+        }
+    }
+    int pairs[REPORT_BIGRAMS];
+    int found = mostMissedPairs(totals, pairs, REPORT_BIGRAMS);
+    for (int i = 0; i < found; i++) {
+        int pair = pairs[i];
+        fprintf(out, "bigram,0,%c%c,%llu,%.4f\n", 'a' + pair / 26, 'a' + pair % 26,
+                (unsigned long long)totals->pairErrors[pair],
+                (double)totals->pairErrors[pair] / totals->pairAttempts[pair]);
+    }
+}
+
+void writeReportJson(FILE *out, const ReportTotals *totals) {
+    fprintf(out, "{\n  \"users\": %lld,\n", totals->users);
+    fprintf(out, "  \"tests\": {\"endurance\": %lld, \"raw_speed\": %lld, \"race\": %lld, \"text\": %lld},\n",
+            totals->modeTests[HISTORY_MODE_ENDURANCE], totals->modeTests[HISTORY_MODE_RAW_SPEED],
+            totals->modeTests[HISTORY_MODE_RACE], totals->modeTests[HISTORY_MODE_TEXT]);
+    fprintf(out, "  \"difficulties\": [\n");
+    for (int d = 0; d < DIFFICULTY_COUNT; d++) {
+        long long tests = totals->tests[d];
+        double share = tests > 0 ? 1.0 / tests : 0;
+        fprintf(out, "    {\"difficulty\": %d, \"tests\": %lld, \"accuracy\": %.2f, \"wpm\": %.2f,"
+                     " \"mistyped_per_test\": %.2f, \"missed_per_test\": %.2f, \"extra_per_test\": %.2f,\n",
+                d + 1, tests, totals->accuracySum[d] * share, totals->wpmSum[d] * share,
+                totals->mistyped[d] * share, totals->missed[d] * share, totals->extra[d] * share);
+        fprintf(out, "     \"wpm_histogram\": [");
+        for (int b = 0; b < REPORT_WPM_BUCKETS; b++) {
+            fprintf(out, "%s{\"from\": %d, \"tests\": %lld}", b > 0 ? ", " : "",
+                    b * REPORT_WPM_BUCKET, totals->wpmHistogram[d][b]);
+        }
+        fprintf(out, "]}%s\n", d + 1 < DIFFICULTY_COUNT ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"most_missed_bigrams\": [");
+    int pairs[REPORT_BIGRAMS];
+    int found = mostMissedPairs(totals, pairs, REPORT_BIGRAMS);
+    for (int i = 0; i < found; i++) {
+        int pair = pairs[i];
+        fprintf(out, "%s\n    {\"bigram\": \"%c%c\", \"errors\": %llu, \"attempts\": %llu, \"error_rate\": %.4f}",
+                i > 0 ? "," : "", 'a' + pair / 26, 'a' + pair % 26,
+                (unsigned long long)totals->pairErrors[pair],
+                (unsigned long long)totals->pairAttempts[pair],
+                (double)totals->pairErrors[pair] / totals->pairAttempts[pair]);
+    }
+    fprintf(out, "%s]\n}\n", found > 0 ? "\n  " : "");
+}
+
+// Display user profile
+void showProfile(AppState *state) {
+    User user = state->users[state->currentUserIndex];
+    framePrintf("\n===== Profile: %s =====\n", user.name);
+    framePrintf("Tests completed: %d\n", user.testsCompleted);
+    framePrintf("Best WPM: %.2f\n", user.bestWPM);
+    framePrintf("Best accuracy: %.2f%%\n", user.bestAccuracy);
+    framePrintf("Average accuracy: %.2f%%\n", user.averageAccuracy);
+    framePrintf("Endurance high score: %d words\n", user.enduranceHighScore);
+    if (state->userCount > 1) {
+        // Where the user stands among everyone, from one pass over the best WPM column
+        ColumnScan scan;
+        memset(&scan, 0, sizeof(scan));
+        scanColumn(state->columns.bestWPM, state->userCount, user.bestWPM, &scan);
+        framePrintf("Best WPM is above %.0f%% of all %d users (average %.2f, top %.2f)\n",
+               100.0 * scan.below / scan.count, scan.count, scan.sum / scan.count, scan.max);
+    }
+
+    // Recent form comes from the history summary, however long the log is
+    HistorySummary history;
+    persistFlush(&state->persist); // The last test may still be on its way to the log
+    if (readHistorySummary(user.name, &history) && history.count > 0) {
+        float wpm, accuracy;
+        int tests;
+        framePrintf("\nRecent form:\n");
+        tests = recentAverages(&history, 10, &wpm, &accuracy);
+        framePrintf("Last %d tests: %.2f WPM, %.2f%% accuracy\n", tests, wpm, accuracy);
+        if (history.count > 10) {
+            tests = recentAverages(&history, HISTORY_RECENT_SIZE, &wpm, &accuracy);
+            framePrintf("Last %d tests: %.2f WPM, %.2f%% accuracy\n", tests, wpm, accuracy);
+        }
+        tests = dailyAverages(&history, (int32_t)(time(NULL) / 86400), &wpm, &accuracy);
+        framePrintf("Last %d days: %d tests, %.2f WPM, %.2f%% accuracy\n",
+               HISTORY_DAYS, tests, wpm, accuracy);
+    }
+
+    // Bigrams the endurance stream is practising, weakest first
+    unsigned char weakness[SKILL_PAIRS];
+    skillWeakness(&state->skills, weakness);
+    int shown = 0;
+    int picked[SKILL_PAIRS] = {0};
+    while (shown < 5) {
+        int weakest = -1;
+        for (int pair = 0; pair < SKILL_PAIRS; pair++) {
+            if (!picked[pair] && state->skills.pairAttempts[pair] >= 10 &&
+                (weakest < 0 || weakness[pair] > weakness[weakest])) {
+                weakest = pair;
+            }
+        }
+        if (weakest < 0) {
+            break;
+        }
+        picked[weakest] = 1;
+        int attempts = state->skills.pairAttempts[weakest];
+        int timed = state->skills.pairTimed[weakest];
+        framePrintf("%s%c%c %.0f%% errors, %d ms", shown ? " | " : "\nWeakest bigrams: ",
+               'a' + weakest / 26, 'a' + weakest % 26,
+               100.0 * state->skills.pairErrors[weakest] / attempts,
+               timed ? (int)(state->skills.pairLatency[weakest] / timed) : 0);
+        shown++;
+    }
+    if (shown > 0) {
+        framePrintf("\n");
+    }
+    
+    // Calculate skill level based on stats
+    float normalizedWPM = user.bestWPM / 200.0 * 100; // Normalize WPM
+    float skillRating = (normalizedWPM * 0.5) + (user.bestAccuracy * 0.3) + (user.averageAccuracy * 0.2);
+    if (skillRating > 100) skillRating = 100; // Cap at 100
+
+    
+    framePrintf("\nSkill assessment: ");
+    if (skillRating > 100) {
+        setColour(GREEN, state);
+        framePrintf("Expert");
+    } else if (skillRating > 80) {
+        setColour(CYAN, state);
+        framePrintf("Advanced");
+    } else if (skillRating > 60) {
+        setColour(YELLOW, state);
+        framePrintf("Intermediate");
+    } else {
+        setColour(DEFAULT, state);
+        framePrintf("Beginner");
+    }
+    setColour(DEFAULT, state);
+    
+    framePrintf("\n\nPress any key to return to menu...");
+    getch();
+}
+
+// Process typing results and update user stats
+void processTypingResults(const GameMode *mode, TypingResult results[], int count, AppState *state) {
+    User *user = &state->users[state->currentUserIndex];
+    float totalWPM = 0;
+    float totalAccuracy = 0;
+    int totalChars = 0;
+    int totalCorrectChars = 0;
+
+    for (int i = 0; i < count; i++) {
+        totalWPM += results[i].wpm;
+        totalAccuracy += results[i].accuracy;
+        totalChars += results[i].totalChars;
+        totalCorrectChars += results[i].correctChars;
+
+        // Display individual test results
+        framePrintf("\n===== Test %d Results =====\n", i + 1);
+        framePrintf("Time taken: %.2f seconds\n", results[i].timeTaken);
+        framePrintf("Words per minute: %.2f\n", results[i].wpm);
+        framePrintf("Accuracy: %.2f%%\n", results[i].accuracy);
+        framePrintf("Words with mistakes: %d of %d\n", results[i].wordErrors, results[i].wordsCompleted);
+        framePrintf("Key latency p50/p95/p99: %.1f / %.1f / %.1f ms\n",
+               results[i].latencyP50, results[i].latencyP95, results[i].latencyP99);
+
+        
+    }
+
+    // Calculate averages
+    float avgWPM = totalWPM / count;
+    float avgAccuracy = totalAccuracy / count;
+
+    // Update user statistics
+    User before = *user;
+    int scoresBest = (mode->scoring & MODE_SCORE_BEST) != 0;
+    if (scoresBest && avgWPM > user->bestWPM) {
+        framePrintf("\nNew personal best WPM: %.2f (previous: %.2f)\n", avgWPM, user->bestWPM);
+        user->bestWPM = avgWPM;
+    }
+
+    if (scoresBest && avgAccuracy > user->bestAccuracy) {
+        framePrintf("\nNew personal best accuracy: %.2f%% (previous: %.2f%%)\n", avgAccuracy, user->bestAccuracy);
+        user->bestAccuracy = avgAccuracy;
+    }
+    updateUserRanks(state, state->currentUserIndex, &before);
+
+    // Update running average accuracy
+    user->totalCharsTyped += totalChars;
+    user->totalCorrectChars += totalCorrectChars;
+    user->averageAccuracy = (float)user->totalCorrectChars / user->totalCharsTyped * 100;
+
+    // Increment tests completed
+    user->testsCompleted += count;
+
+    // Save user data
+    markUserDirty(state, state->currentUserIndex);
+    saveDirtyUsers(state);
+
+    framePrintf("\nPress any key to return to menu...");
+    getch();
+}
+
+// Function to get console width
+int getConsoleWidth() {
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi)) {
+        return csbi.srWindow.Right - csbi.srWindow.Left + 1;
+    }
+#else
+    struct winsize w;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0) {
+        return w.ws_col;
+    }
+#endif
+    return 80; // Default width if unable to determine
+}
+
+// Function to get console height
+int getConsoleHeight() {
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi)) {
+        return csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+    }
+#else
+    struct winsize w;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0) {
+        return w.ws_row;
+    }
+#endif
+    return 24; // Default height if unable to determine
+}
+
+// Time one operation: double the iteration count until a batch takes
+// BENCH_MIN_NANOS, then print the batch as a CSV row
+void runBenchmark(FILE *out, const char *name, BenchOperation operation, BenchContext *context) {
+    long long iterations = 1;
+    while (1) {
+        long long start = monotonicNanos();
+        for (long long i = 0; i < iterations; i++) {
+            operation(context);
+        }
+        long long elapsed = monotonicNanos() - start;
+        if (elapsed >= BENCH_MIN_NANOS) {
+            fprintf(out, "%s,%d,%lld,%.1f\n", name, context->size, iterations,
+                    (double)elapsed / iterations);
+            fflush(out);
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+// Position-based scoring of a whole text
+// A different typed character is changed on each call, so the work cannot be
+// hoisted out of the loop
+void benchAccuracy(BenchContext *context) {
+    int mistyped, missed, extra;
+    context->pos = (context->pos + 1) % context->size;
+    context->typed[context->pos] ^= 1;
+    context->checksum += calculateAccuracy(context->target, context->typed, &mistyped, &missed, &extra);
+    context->typed[context->pos] ^= 1;
+}
+
+// Bulk character compare through the kernel picked for this CPU
+void benchCountMatches(BenchContext *context) {
+    context->checksum += countMatches(context->target, context->typed, context->size);
+}
+
+// One keystroke as typingTest renders it: one cell, then one frame
+void benchRender(BenchContext *context) {
+    if (context->pos == context->size) {
+        context->pos = 0; // Start again from the top of a new view
+        initTypingView(&context->view);
+        context->view.cursorRow = 1; // On the first typed row
+    }
+    renderLayoutTyped(&context->view, &context->layout, context->target, context->typed,
+                      context->pos, context->pos + 1, context->pos + 1, context->state);
+    context->pos++;
+    frameFlush();
+}
+
+void benchLayout(BenchContext *context) {
+    resetArena(&context->state->session);
+    layoutText(&context->layout, &context->state->session, context->target, context->size, 80, NULL);
+}
+
+// Read and index a word list into a fresh arena
+void benchLoadWords(BenchContext *context) {
+    WordStore store;
+    memset(&store, 0, sizeof(store));
+    loadWordsFromFile(context->fileName, &store.lists[0], &store);
+    freeWordStore(&store);
+}
+
+// Map a word list that has a current .idx sidecar
+void benchMapWords(BenchContext *context) {
+    WordList list;
+    memset(&list, 0, sizeof(list));
+    loadMappedWords(context->fileName, &list);
+    free(list.entries);
+    unmapFile(&list.source);
+}
+
+// Map a word list with no sidecar, so it is scanned and the sidecar written
+void benchScanWords(BenchContext *context) {
+    char indexName[sizeof(context->fileName) + 4];
+    snprintf(indexName, sizeof(indexName), "%s.idx", context->fileName);
+    remove(indexName);
+    benchMapWords(context);
+}
+
+void benchSaveUsers(BenchContext *context) {
+    saveUsersToFile(context->state);
+}
+
+void benchLoadUsers(BenchContext *context) {
+    loadUsersFromFile(context->state);
+}
+
+void benchOpenUserStore(BenchContext *context) {
+    openUserStore(context->state);
+    closeUserStore(&context->state->store);
+}
+
+void benchBuildRanks(BenchContext *context) {
+    buildRankIndexes(context->state);
+}
+
+// A personal best that moves one user somewhere else on the leaderboard
+void benchUpdateRank(BenchContext *context) {
+    AppState *state = context->state;
+    int index = (int)rngBounded(&context->rng, (uint32_t)state->userCount);
+    User before = state->users[index];
+    state->users[index].bestWPM = (float)rngBounded(&context->rng, 20000) / 100;
+    storeUserColumns(state, index);
+    updateUserRanks(state, index, &before);
+}
+
+// One pass over every user's best WPM, read from the User rows
+void benchScanRows(BenchContext *context) {
+    AppState *state = context->state;
+    ColumnScan scan;
+    memset(&scan, 0, sizeof(scan));
+    for (int i = 0; i < state->userCount; i++) {
+        float value = state->users[i].bestWPM;
+        if (scan.count == 0) {
+            scan.min = scan.max = value;
+        } else if (value < scan.min) {
+            scan.min = value;
+        } else if (value > scan.max) {
+            scan.max = value;
+        }
+        scan.sum += value;
+        scan.below += value < 100.0f;
+        scan.count++;
+    }
+    context->checksum += scan.sum + scan.below;
+}
+
+// The same pass over the best WPM column
+void benchScanColumns(BenchContext *context) {
+    ColumnScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scanColumn(context->state->columns.bestWPM, context->state->userCount, 100.0f, &scan);
+    context->checksum += scan.sum + scan.below;
+}
+
+// Replace the user table with count users with random stats
+void fillBenchUsers(AppState *state, int count, Rng *rng) {
+    clearUsers(state);
+    for (int i = 0; i < count; i++) {
+        char name[MAX_NAME_LEN];
+        snprintf(name, sizeof(name), "user%d", i);
+        int index = addUser(state, name);
+        if (index < 0) {
+            return;
+        }
+        User *user = &state->users[index];
+        user->bestWPM = (float)rngBounded(rng, 20000) / 100;
+        user->bestAccuracy = (float)rngBounded(rng, 10000) / 100;
+        user->testsCompleted = (int)rngBounded(rng, 1000);
+        user->enduranceHighScore = (int)rngBounded(rng, 500);
+        user->totalCharsTyped = (int)rngBounded(rng, 1000000);
+        user->totalCorrectChars = user->totalCharsTyped / 10 * 9;
+        user->averageAccuracy = 90.0f;
+    }
+}
+
+// Write count random lowercase words, one per line
+int writeBenchWords(const char *fileName, int count, Rng *rng) {
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        char word[16];
+        int length = 3 + (int)rngBounded(rng, 8);
+        for (int c = 0; c < length; c++) {
+            word[c] = (char)('a' + rngBounded(rng, 26));
+        }
+        word[length++] = '\n';
+        fwrite(word, 1, length, file);
+    }
+    return fclose(file) == 0;
+}
+
+// Headless benchmarks of the hot paths, printed to stdout as CSV
+// They run inside BENCH_DIR so no real users.txt, users.dat or word list is touched,
+// and everything the code under test prints is sent to the null device
+int runBenchmarks(AppState *state) {
+    static const int textSizes[] = { 1000, 100000 };
+    static const int wordCounts[] = { 1000, 100000, 1000000 };
+    static const int userCounts[] = { 100, 10000, 100000 };
+
+    #ifdef _WIN32
+        _mkdir(BENCH_DIR);
+        int entered = _chdir(BENCH_DIR) == 0;
+    #else
+        mkdir(BENCH_DIR, 0755);
+        int entered = chdir(BENCH_DIR) == 0;
+    #endif
+    if (!entered) {
+        framePrintf("Error: Could not enter %s.\n", BENCH_DIR);
+        return 0;
+    }
+
+    frameFlush();
+    fflush(stdout);
+    #ifdef _WIN32
+        FILE *out = stdout;
+        HANDLE savedOutput = frame.output;
+        BOOL savedConsole = frame.isConsole;
+        frame.output = CreateFileA("NUL", GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        frame.isConsole = FALSE;
+    #else
+        FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+        int null = open("/dev/null", O_WRONLY);
+        if (out == NULL || null < 0) {
+            framePrintf("Error: Could not open /dev/null.\n");
+            return 0;
+        }
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    #endif
+
+    BenchContext context;
+    memset(&context, 0, sizeof(context));
+    context.state = state;
+    seedRng(&context.rng, 1); // Same inputs on every run
+    fprintf(out, "benchmark,size,iterations,ns_per_op\n");
+
+    for (int s = 0; s < (int)(sizeof(textSizes) / sizeof(textSizes[0])); s++) {
+        context.size = textSizes[s];
+        context.target = malloc(context.size + 1);
+        context.typed = malloc(context.size + 1);
+        if (context.target == NULL || context.typed == NULL) {
+            free(context.target);
+            free(context.typed);
+            break;
+        }
+        for (int i = 0; i < context.size; i++) {
+            context.target[i] = (i % 6 == 5) ? ' ' : (char)('a' + rngBounded(&context.rng, 26));
+            context.typed[i] = (i % 23 == 22) ? 'x' : context.target[i]; // Some mistakes
+        }
+        context.target[context.size] = '\0';
+        context.typed[context.size] = '\0';
+
+        runBenchmark(out, "accuracy", benchAccuracy, &context);
+        runBenchmark(out, "count_matches", benchCountMatches, &context);
+        runBenchmark(out, "layout_text", benchLayout, &context); // Leaves the layout for benchRender
+        context.pos = context.size; // benchRender starts a new view
+        runBenchmark(out, "render_keystroke", benchRender, &context);
+        free(context.target);
+        free(context.typed);
+        context.target = context.typed = NULL;
+    }
+
+    snprintf(context.fileName, sizeof(context.fileName), "words.txt");
+    for (int s = 0; s < (int)(sizeof(wordCounts) / sizeof(wordCounts[0])); s++) {
+        context.size = wordCounts[s];
+        if (!writeBenchWords(context.fileName, context.size, &context.rng)) {
+            break;
+        }
+        runBenchmark(out, "load_words", benchLoadWords, &context);
+        runBenchmark(out, "map_words_scan", benchScanWords, &context);
+        runBenchmark(out, "map_words_indexed", benchMapWords, &context);
+    }
+    remove("words.txt");
+    remove("words.txt.idx");
+
+    for (int s = 0; s < (int)(sizeof(userCounts) / sizeof(userCounts[0])); s++) {
+        context.size = userCounts[s];
+        fillBenchUsers(state, context.size, &context.rng);
+        runBenchmark(out, "save_users_text", benchSaveUsers, &context);
+        runBenchmark(out, "load_users_text", benchLoadUsers, &context);
+        createUserStore(state);
+        runBenchmark(out, "open_user_store", benchOpenUserStore, &context);
+        runBenchmark(out, "build_ranks", benchBuildRanks, &context);
+        runBenchmark(out, "update_rank", benchUpdateRank, &context);
+        runBenchmark(out, "scan_stat_rows", benchScanRows, &context);
+        runBenchmark(out, "scan_stat_columns", benchScanColumns, &context);
+    }
+    remove(USERS_FILE);
+    remove(USER_STORE_FILE);
+    clearUsers(state);
+
+    frameFlush();
+    #ifdef _WIN32
+        CloseHandle(frame.output);
+        frame.output = savedOutput;
+        frame.isConsole = savedConsole;
+        if (_chdir("..") == 0) {
+            _rmdir(BENCH_DIR);
+        }
+    #else
+        dup2(fileno(out), STDOUT_FILENO);
+        fclose(out);
+        if (chdir("..") == 0) {
+            rmdir(BENCH_DIR);
+        }
+    #endif
+    return 1;
 }
\ No newline at end of file